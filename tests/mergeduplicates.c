@@ -0,0 +1,67 @@
+//loads decks containing duplicates with a merge policy set, and checks no info or hint is lost in merging them
+#define main vtnmain
+#include "../vtn.c"
+#undef main
+
+int failures = 0;
+
+struct vocab * findquestion(char * question)//returns the entry of the current deck with the given question, or NULL
+{
+    int i;
+    struct vocab * entry;
+    for (i=0;i<numberoftiers;i++) for (entry=levellist(currentdeck,i)->head;entry;entry=entry->next) if (!strcmp(entry->question,question)) return entry;
+    return NULL;
+}
+
+void expecttext(char * question, char * info, char * hint)//fails unless the entry has the given info and hint (NULL for none)
+{
+    struct vocab * entry = findquestion(question);
+    char * text;
+    if (!entry) {printf("FAIL: '%s' wasn't loaded\n",question);failures++;return;}
+    text = vocabinfo(entry);
+    if (info ? !text || strcmp(text,info) : text!=NULL) {printf("FAIL: '%s' has info '%s', expected '%s'\n",question,text ? text : "(none)",info ? info : "(none)");failures++;}
+    text = vocabhint(entry);
+    if (hint ? !text || strcmp(text,hint) : text!=NULL) {printf("FAIL: '%s' has hint '%s', expected '%s'\n",question,text ? text : "(none)",hint ? hint : "(none)");failures++;}
+}
+
+void writedeck(char * filename, char * text)
+{
+    FILE * file = fopen(filename,"w");
+    if (!file || fputs(text,file)==EOF || fclose(file)) {printf("FAIL: can't write %s\n",filename);exit(EXIT_FAILURE);}
+}
+
+int main()
+{
+    char first[64], second[64];
+    sprintf(first,"/tmp/mergeduplicates%d.~sv",(int)getpid());
+    sprintf(second,"/tmp/mergeduplicates%d-2.~sv",(int)getpid());
+    freopen("/dev/null","w",stderr);
+    newdeck(DINPUTFILENAME);
+
+    //a file with a duplicate of its own, each copy holding part of the text, and records after it
+    writedeck(first,"kucing~cat~~a pet~0~0~1\n"
+                    "anjing~dog~an animal~~0~0~1\n"
+                    "kucing~cat~small feline~~1~3~2\n"
+                    "burung~bird~flies~tweets~0~0~1");
+    mergepolicy = MERGEKEEPHIGHER;
+    wgetrecordsfromfile(NULL,first,'~');
+    expecttext("kucing","small feline","a pet");
+    expecttext("anjing","an animal",NULL);
+    expecttext("burung","flies","tweets");
+    if (deckentries(currentdeck)!=3) {printf("FAIL: %d entries loaded from one file, expected 3\n",deckentries(currentdeck));failures++;}
+
+    //a second file merged into the first, filling in text the loaded entries lack
+    writedeck(second,"anjing~dog~~barks~0~0~1\n"
+                     "ikan~fish~swims~~0~0~1");
+    wgetrecordsfromfile(NULL,second,'~');
+    expecttext("anjing","an animal","barks");
+    expecttext("kucing","small feline","a pet");
+    expecttext("ikan","swims",NULL);
+    if (deckentries(currentdeck)!=4) {printf("FAIL: %d entries after merging a second file, expected 4\n",deckentries(currentdeck));failures++;}
+
+    if (unshownerrors) {printf("FAIL: %d errors while loading\n",unshownerrors);failures++;}
+    remove(first);
+    remove(second);
+    printf("%s\n",failures ? "mergeduplicates: FAILED" : "mergeduplicates: passed");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,12 +1,31 @@
+#define _GNU_SOURCE //fopencookie() and memfd_create(), for compressed decks
 #include <time.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
 #include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <math.h>
 #include <ncurses.h>
 #include <panel.h>
 #include <menu.h>
 #include <form.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <malloc.h>
+#include <locale.h>
 
 #ifdef _WIN32
 # define CLEARCOMMAND "cls"
@@ -21,75 +40,638 @@
 #define DOUTPUTFILENAME "vtdb.~sv"
 #define MAXINTVALUE 2147483647
 #define MAXTEXTLENGTH 255
-#define N2LTONORM 5
-#define NORMTON2L 3
-#define NORMTOKNOWN 5
-#define KNOWNTONORM 2
-#define KNOWNTOOLD 3
-#define OLDTONORM 1
+#define MAXDECKS 16
+#define NOOFFSET 0xffffffffu //offset used in compiled deck records for a field with no text
+#define PROGRESSOPENTRIES 3 //times a progress file is looked for and created, if it keeps coming and going under another tester
+#define RIGHTBIT 0x80 //status bit set if the last answer to an entry was right
+#define LIVEBIT 0x40 //status bit set if the slot is in use by an entry
+#define KNOWNMASK 0x3f //status bits holding the 'known' level
+#define MAXSTREAK 255 //streak counters saturate here
+#define LAZYINFO 1 //entry has info in its deck's source file that hasn't been read yet
+#define LAZYHINT 2 //entry has a hint in its deck's source file that hasn't been read yet
+#define FIELDEND '\1' //follows every field in the text of a full-text index, so no match can run from one field into the next
+#define FINDRANKS 7 //ways a found entry can match, from the whole question down to info or a hint, which its place in the results follows
+#define MAXSORTTHREADS 8 //most threads used to sort the suffixes of a full-text index
+#define HISTORYBLOCKROWS 4096 //graded answers held in memory before being appended to the history file as a block
+#define HISTORYCOMPACTBLOCKS 64 //a history file with more blocks than this is rewritten as one block when next read
+#define HISTORYHINT 4 //outcome bit set if the hint was used, the grade is in the low bits
+#define MAXOPTIONALPARTS 4 //bracketed parts of an answer that may be left out, beyond this they have to be typed
+#define CSVBLOCKSIZE 65536 //bytes of a .csv file read at a time when importing
+#define CSVFIELDS 7 //question, answer, info, hint, right, counter and level
+#define CSVREPORTLINES 10 //line numbers of malformed rows listed in the import summary
+#define CSVFIELD 1 //returned by csvreadfield when more fields of the record follow
+#define CSVRECORD 0 //returned by csvreadfield when it has read the last field of a record
+#define CSVEND -1 //returned by csvreadfield when there is nothing left to read
+#define FORMATSV 0 //formats the command-line converter reads and writes
+#define FORMATCSV 1
+#define FORMATTSV 2
+#define FORMATJSONL 3 //written only
+#define FORMATCOMPILED 4 //a compiled .vtd deck, which the tester maps rather than reads, for --deck only
+#define TIMESTARTED 0 //points in starting up that --timings reports on
+#define TIMEOPTIONS 1
+#define TIMELOADSTART 2
+#define TIMECURSES 3
+#define TIMELOADED 4
+#define TIMEMENU 5
+#define TIMEQUESTION 6
+#define TIMEPOINTS 7
+#define SIMLEARNERS 1000 //defaults for the simulate subcommand
+#define SIMENTRIES 100
+#define SIMREVIEWS 20000
+#define SIMSTABILITY 200.0
+#define SIMGROWTH 2.0
+#define SIMLAPSE 0.5
+#define MAXSIMTHREADS 256
+#define FOOTRECORDS 0 //kinds of deck data the memory report breaks the heap down into
+#define FOOTTEXT 1
+#define FOOTPROGRESS 2
+#define FOOTMATCHERS 3
+#define FOOTINDEXES 4
+#define FOOTHISTORY 5
+#define FOOTCATEGORIES 6
+#define PACKEDEXTENSION ".vtz" //a .~sv deck compressed a block at a time
+#define PACKBLOCKSIZE 262144 //bytes of text compressed as one block of a .vtz deck, each of which is unpacked on its own
+#define PACKHASHBITS 14 //size of the compressor's table of where each 4-byte sequence was last seen
+#define PACKMINMATCH 4 //shortest run of bytes the compressor refers back to rather than storing
+#define MAXUNPACKTHREADS 8 //most threads unpacking the blocks of a .vtz deck at once
+#define RESYNCLINES 16 //most inserted, deleted or changed lines in a row that are stepped over when diffing a watched deck file line by line
+#define UNLINKLINES 8 //lines before a removed entry's own that are looked at for the entry before it in its list, before the list is walked
+#define MAXSHIFTS 32 //moves of a watched file's text noted for lazy entries to allow for, before every entry's offset is brought up to date
+#define MAXTIERS 16 //most proficiency tiers (lists) a deck can be split into, levels have to fit in KNOWNMASK
+#define MAXTIERNAME 31
+#define MAXTIERWEIGHT 100 //largest weight a tier can be given
+#define TIERSFILENAME "vtn.tiers" //optional file defining the tiers, read from the working directory at startup
+#define MAXNEARMISS 2 //most edits a near miss can be away from an accepted answer, fewer for short answers
+#define GRADEWRONG 0
+#define GRADERIGHT 1
+#define GRADENEARMISS 2 //a typo away from an accepted answer, neither right nor wrong
+#define MAXDRILLMOVES 10 //changes of tier listed by entry in the summary at the end of a rapid drill, any more are only counted
+#define MAXDRILLNOTE 100 //longest line listing one of them
+#define MAXLATENCY 60000 //answer times are capped at this many ms when averaged, as a longer wait is the learner being away rather than slow
+#define LATENCYWEIGHT 4 //each answer moves an entry's average answer time a quarter of the way to its own time
+#define SLOWANSWERFACTOR 2 //a right answer taking more than this many times the entry's average is slow
+#define SLOWESTSHOWN 3 //entries listed in the stats as the slowest to answer
+#define METRICSBUFFERSIZE 16384 //room for the text of one scrape of the metrics endpoint
+#define EVENTIDLE 1 //waitforkey() may apply changes made to the decks elsewhere, as the screen waiting isn't holding on to any entries
+#define EVENTWAKE 2 //waitforkey() returns ERR once it has run posted work or a timer, not only when a key is pressed
+#define SHAREDPROGRESSINTERVAL 1000 //ms between looks, while the main menu waits, at whether other testers have answered from a compiled deck
+#define PROGRAMTITLE "Vocab Tester Version N by Rob Davies"
+#define BROWSEQUESTION 0 //orders the deck browser lists entries in
+#define BROWSEANSWER 1
+#define BROWSELEVEL 2
+#define BROWSESTREAK 3
+#define BROWSEORDERS 4
+#define BROWSETIERCOLUMNS 14 //columns given to the tier name in the deck browser
+#define BROWSESTREAKCOLUMNS 6
+#define MERGENONE 0 //no duplicate detection, records are just appended (the original behaviour)
+#define MERGEKEEPHIGHER 1 //keep the progress of whichever duplicate is known better
+#define MERGEKEEPNEWER 2 //progress from the file being loaded replaces the progress in memory
+#define MERGESUMSTREAKS 3 //streaks in the same direction are added together, the higher 'known' level is kept
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
+//first two characters of a suffix as a bucket number, the second taken as 0 if the first ends its field
+#define SUFFIXBUCKET(text,i) ((((unsigned char)(text)[i])<<8)|((text)[i]==FIELDEND ? 0 : (unsigned char)(text)[(i)+1]))
+//an entry's progress is kept in its deck's status and streak arrays, where calculatescore() can scan it without touching the entries
+//Reads and writes are atomic, as a compiled deck's progress can be shared with other testers
+#define RIGHT(entry) ((__atomic_load_n(&(entry)->deck->status[(entry)->id],__ATOMIC_RELAXED) & RIGHTBIT) ? 1 : 0)
+#define COUNTER(entry) (__atomic_load_n(&(entry)->deck->streak[(entry)->id],__ATOMIC_RELAXED))
+#define KNOWN(entry) (__atomic_load_n(&(entry)->deck->status[(entry)->id],__ATOMIC_RELAXED) & KNOWNMASK)
+#define STREAKKEY(entry) (RIGHT(entry) ? MAXSTREAK+COUNTER(entry) : MAXSTREAK-COUNTER(entry)) //0 for the longest run of wrong answers up to 2*MAXSTREAK for the longest run of right ones
+#define COUNTMETRIC(counter,amount) __atomic_add_fetch(&metrics.counter,(amount),__ATOMIC_RELAXED)//lock-free, as loading threads count as well as the UI
+//every allocation made here goes through the counting versions, so the stats screen can say how much memory is in use
+#define malloc(size) countedmalloc(size)
+#define calloc(count,size) countedcalloc(count,size)
+#define realloc(pointer,size) countedrealloc(pointer,size)
+#define free(pointer) countedfree(pointer)
 
-struct vocab
+struct vocab//list node for one entry, 80 bytes on 64-bit systems. Its progress is kept apart, in the deck's status and streak arrays
 {
-    int index; //identifies the entry in the list, allowing it to be selected by use of a random number
+    unsigned short questionwidth, answerwidth;//columns the question and answer take up on screen plus one, 0 until they're first needed
     char * question;//pointer to question text
     char * answer;//pointer to the answer text, which is required for the response to be considered correct
     char * info;//pointer to optional extra text giving advice such as to how to format the response
     char * hint;//pointer to optional text giving a clue to the answer
-    int right;//indicates whether counter is counting correct or incorrect responses
-    int counter;//counts how many times in a row the answer has been correct/incorrect
-    int known;//indicates to what level the vocab is known, and thus to which list it belongs
+    struct deck * deck;//the deck this entry belongs to
+    int id;//this entry's slot in the deck's progress arrays (and its record number in a compiled deck), -1 until it has one
+    unsigned char lazy;//LAZYINFO and/or LAZYHINT if info or hint are still waiting in the deck's source file
+    unsigned char shiftsapplied;//how many of the deck's shifts extra already allows for
+    unsigned short latency;//moving average of the ms taken to answer it, 0 if it hasn't been answered
+    long extra;//where this entry's info and hint fields started in the deck's source file, if lazy is set. sourceoffset() gives where they are now
+    struct answermatcher * matcher;//compiled from answer the first time it's graded, NULL until then
     struct vocab * next;//pointer to next in list
 };
 
-struct listinfo//struct holds head, tail and the number of entries for the n2l, norm, known and old lists
+struct listinfo//struct holds head, tail and the number of entries for the list of one tier
 {
     struct vocab * head;
     int entries;
     struct vocab * tail;
 };
 
+struct tier//one proficiency level, entries move up a tier after a run of right answers and down after a run of wrong ones
+{
+    char name[MAXTIERNAME+1];
+    int weight;//how often this tier is drawn from in a test, relative to the other tiers
+    int promoteafter;//right answers in a row before moving up a tier, 0 for never
+    int demoteafter;//wrong answers in a row before moving down, 0 for never
+    int demoteto;//tier moved down to
+    int norepeat;//set if this tier shouldn't be drawn from again until the new entries' tier has been
+    char * upmessage;//said when an entry moves up out of this tier, NULL for the general message
+    char * downmessage;//said when an entry moves down out of it
+};
+
+struct csvreader//reads RFC 4180 records from a file a block at a time, so memory use doesn't depend on the size of the file
+{
+    FILE * file;
+    char separator;
+    int quoting;//set if fields can be quoted (.csv), otherwise quotes are just text (.~sv and .tsv)
+    unsigned char block[CSVBLOCKSIZE];
+    int position, filled;
+    long line;//line of the file reached, counting line breaks within quoted fields
+    long recordline;//line the last record started on
+    char * record;//text of the record just read, each field followed by a null, grown to fit
+    int length, capacity;
+    int quoted;//set if the field just read was in quotes
+    int malformed;//set if anything in the record just read breaks the grammar
+    int badrows;//rows rejected with csvrejectrecord
+    long badlines[CSVREPORTLINES];//lines the first of those started on
+    int longrows;//rows with text cut short by csvclipfields
+    long longline;//line the first of those started on
+};
+
+struct simsettings//a simulation run, from the command line
+{
+    int learners, entries, reviews, threads;
+    double stability;//questions until a just-met entry is remembered with a probability of 1/e
+    double growth;//stability is multiplied by this after a right answer...
+    double lapse;//...and by this after a wrong one
+    uint64_t seed;
+    int * halfway, * mastered;//questions each learner took to get half and then 90% of the entries onto the top tier, or -1
+};
+
+struct simjob//a run of learners for one simulating thread, and the totals it adds up
+{
+    int firstlearner, lastlearner;
+    long long reviews, rights, moves;
+    long long tierreviews[MAXTIERS], tierrights[MAXTIERS], finalentries[MAXTIERS];
+};
+
+struct memorycounters//running totals kept by countedmalloc() and friends, updated atomically as the indexing and simulating threads allocate too
+{
+    size_t live;//bytes in use, as malloc counts them (its rounding up included)
+    size_t peak;
+    unsigned long long allocations, frees;
+};
+
+struct metrics//totals served by the metrics endpoint, counted with COUNTMETRIC where things happen and only read when it's scraped
+{
+    unsigned long long questions;
+    unsigned long long answers[3];//by grade
+    unsigned long long hints;
+    unsigned long long promotions[MAXTIERS], demotions[MAXTIERS];//by the tier moved to
+    long long tierentries[MAXTIERS];//entries on each tier, across every deck
+    unsigned long long loads, loadmicroseconds, saves, savemicroseconds;
+    unsigned long long scrapes;
+};
+
+struct event//work handed to the UI thread by another thread, or a timer waiting to go off on it
+{
+    void (*function)(void * argument);
+    void * argument;
+    struct timespec due;//timers only
+    struct event * next;
+};
+
+struct footprint//heap use of one kind of deck data, found by walking the decks
+{
+    size_t bytes;
+    size_t blocks;
+    size_t slack;//bytes allocated but not used, such as the tail of a text field's buffer
+};
+
+struct deckheader//start of a compiled (.vtd) deck file, followed by the records and then the text pool
+{
+    char magic[4];
+    unsigned int entries;
+    unsigned int poolsize;
+};
+
+struct deckrecord//one per entry in a compiled deck file, each field is an offset into the text pool
+{
+    unsigned int question;
+    unsigned int answer;
+    unsigned int extra;//info then hint, one after the other (an empty string where there is none), or NOOFFSET if there are neither
+};
+
+struct progressheader//start of a compiled deck's progress (.vtp) file, followed by the status array then the streak array
+{
+    char magic[4];
+    unsigned int entries;
+    unsigned int changes;//bumped by every tester with the file mapped each time it updates progress, so each can tell when the others have
+};
+
+struct packheader//start of each block of a compressed (.vtz) deck, which is "VTZ1" followed by the blocks
+{
+    unsigned int rawsize;//bytes of text the block unpacks to
+    unsigned int packedsize;//bytes of compressed data that follow, the same as rawsize if the block is stored as it is
+    unsigned int check;//linehash() of the block's text, so a corrupt block is caught even where it still unpacks
+};
+
+struct packedfile//a compressed deck being read or written as a stdio stream of its text
+{
+    FILE * file;//the compressed file, when writing
+    unsigned char * block, * packed;//text waiting to be packed, and room to pack it into, when writing
+    size_t length;//bytes in block
+    unsigned char * map;//the compressed file, mapped, when reading
+    size_t mapsize;
+    char * text;//all of the text, in a shared mapping of memfd, which the blocks are unpacked into. The memfd outlives the stream as the deck's source, so a compressed deck costs its whole unpacked size in memory
+    size_t size, position;
+    int memfd;
+    int blocks, nextblock;//blocks in the file, and the next one for a thread to take
+    size_t * rawstarts, * packedstarts;//where each block's text goes and where its header is, with a last entry for the end
+    unsigned char * done;//1 once a block is unpacked, 2 if it's corrupt
+    int unpacked;//blocks from the start that are all unpacked
+    pthread_mutex_t lock;
+    pthread_cond_t unpackedblock;
+    pthread_t threads[MAXUNPACKTHREADS];
+    int numberofthreads;
+};
+
+struct historyheader//start of each block of a review history (.vth) file, followed by each column of the block in turn
+{
+    char magic[4];
+    unsigned int rows;
+};
+
+struct historycolumns//graded answers, one array per field, as they are stored in a history file
+{
+    unsigned int rows, capacity;
+    unsigned int * keys;//vocabhash of the entry's question and answer, which stays the same across saves and reloads
+    unsigned int * times;//seconds since the epoch
+    unsigned int * latencies;//milliseconds from the question being shown to the answer being entered
+    unsigned char * outcomes;//GRADERIGHT etc, plus HISTORYHINT
+};
+
+struct historytotals//one entry's totals when analysing the review history
+{
+    unsigned int key;//0 if the slot is empty
+    unsigned int lastseen;
+    unsigned int reviews;
+    unsigned int wrongs;
+    unsigned short latency;//moving average of the time taken to answer, as kept in struct vocab
+};
+
+struct offsetshift//text of a watched file that moved when a change to it was applied
+{
+    long from;//offset in the file before the change from which text moved
+    long by;
+};
+
+struct watchedline//one line of a watched deck file, so the lines that haven't changed can be recognised without being parsed
+{
+    uint64_t hash;//of the whole line
+    long start;//offset of the line in the file
+    struct vocab * entry;//read from the line, NULL if it was faulty
+    int id;//entry's id, which is checked before entry is used, in case the entry has been deleted since
+    unsigned char status, streak;//progress as the line gives it, so a change made to it elsewhere can be told from one made here
+};
+
+struct deck//a set of lists loaded from one file
+{
+    char filename[MAXTEXTLENGTH+1];//file the deck was loaded from, offered as the default when saving
+    struct listinfo lists[MAXTIERS];//one list per tier, the tier being the 'known' level of its entries
+    int intest;//set if testme() should draw from this deck
+    int changed;//set when entries or progress have changed since the deck was last saved
+    FILE * source;//text file the deck was read from, kept open while any entries have info or hints still to be read from it
+    char separator;//field separator used in source
+    size_t unpackedsize;//bytes of text held in memory by source when it's a compressed deck's unpacked text, 0 for an ordinary file
+    char * map;//read-only mapping of a compiled deck file, NULL if the deck was read from text
+    size_t mapsize;
+    struct progressheader * progressmap;//writable shared mapping of a compiled deck's progress file
+    size_t progressmapsize;
+    int progressfd;//the progress file, held open with a shared lock for as long as it's mapped
+    unsigned int progresschanges;//progressmap->changes as of this tester's last look
+    //progress of every entry, indexed by entry id. For a compiled deck these point into progressmap and are updated in place
+    unsigned char * status;//RIGHTBIT, LIVEBIT and the 'known' level packed into a byte
+    unsigned char * streak;//how many answers in a row have been right (or wrong)
+    int slots;//ids handed out so far
+    int capacity;//slots allocated in status and streak, 0 if they belong to a mapping
+    int textversion;//bumped whenever entries come or go or their text is changed, so indexes know when they're out of date
+    struct searchkey * searchindex;//every question and answer in the deck, sorted, built when first searched
+    int searchkeys;
+    int searchversion;//textversion when searchindex was built
+    struct vocab ** browseorders[BROWSEORDERS];//every entry of the deck in each order the browser lists them in, built when it's first browsed
+    int browseentries;
+    int browseversion;//textversion when the question and answer orders were sorted
+    struct textindex * textindex;//full-text index, built in the background when the deck is first searched, NULL until then
+    struct historycolumns history;//graded answers not yet appended to the deck's history file
+    int latencyversion;//textversion+1 when the entries' average answer times were last worked out from the history, 0 if they never have been
+    int watch;//inotify watch on the directory of the file the deck was read from, 0 if it isn't watched
+    char watchedname[MAXTEXTLENGTH+1];//the file being watched, whose changes are applied to the deck as they're made
+    struct stat watchedstat;//how the file was when the deck last matched it, so the deck's own saves and repeated events are ignored
+    struct watchedline * lines;//every line of the watched file as it was then, in order
+    int numberoflines;
+    struct offsetshift shifts[MAXSHIFTS];//moves of the text after each change applied to the watched file, which lazy entries allow for when read rather than all being updated
+    int numberofshifts;
+};
+
+struct answermatcher//every accepted form of an answer, normalised and hashed so a response can be graded with one probe
+{
+    int version;//value of matcherversion when this was compiled
+    unsigned int size;//slots in the table, always a power of two
+    unsigned int * hashes;
+    char ** forms;//normalised text of the form in each slot, NULL if the slot is empty
+};
+
+struct searchkey//one question or answer text in a deck's search index
+{
+    char * text;
+    struct vocab * entry;
+};
+
+struct textindex//suffix array over every field of every entry of a deck, for finding entries by any piece of their text
+{
+    int version;//deck's textversion when the entries were copied
+    volatile int ready;//set by the indexing thread as it finishes
+    int joined;
+    pthread_t thread;
+    struct vocab ** entries;//every entry of the deck when the index was started
+    int numberofentries;
+    int sourcefd;//the index's own descriptor of the deck's source file, for reading lazy info and hints, or -1
+    char separator;
+    long * extras;//file offset of each entry's lazy info and hint, or -1
+    char * text;//lowercased text of the fields, each followed by FIELDEND
+    unsigned int length, capacity;
+    unsigned int * segmentstarts;//where in text each run of an entry's fields starts, in order
+    int * segmententries;//which entry each run belongs to
+    int numberofsegments, segmentcapacity;
+    unsigned int * suffixes;//position of every suffix of text that doesn't start with FIELDEND, in sorted order
+    unsigned int numberofsuffixes;
+};
+
+struct sortjob//a run of suffix buckets for one thread to sort
+{
+    struct textindex * index;
+    unsigned int * buckets;//where each bucket starts in the suffix array
+    int firstbucket, lastbucket;
+};
+
+struct vocabtable//open addressing hash table of entries keyed on question+answer, used to find duplicates when merging
+{
+    struct vocab ** slots;
+    unsigned int * hashes;//hash of each slot's entry, so most probes don't need a strcmp
+    unsigned int size;//always a power of two
+    unsigned int used;
+};
+
 struct fuzzymatch
 {
     struct vocab * entry;
     int score;
 };
 
+struct drillsummary//what happened in a rapid drill, shown when it ends rather than after every answer
+{
+    struct timespec started;
+    int answers, right, nearmisses, wrong, movedup, moveddown;
+    int moves;//changes of tier listed in move, at most MAXDRILLMOVES
+    char move[MAXDRILLMOVES][MAXDRILLNOTE+1];
+};
+
 int maxtextlength = MAXTEXTLENGTH; //allows use of this #define within text strings
 FILE * inputfile = NULL;
 FILE * outputfile = NULL;
-struct listinfo n2l, norm, known, old;
-int changedflag = 0;
-char currentfilename[MAXTEXTLENGTH+1] = DOUTPUTFILENAME;
+struct deck * decks[MAXDECKS];
+int numberofdecks = 0;
+struct deck * currentdeck = NULL;//the deck that is loaded into, saved and edited
+int watchfd = -1;//inotify instance watching the files decks were read from, -1 until one is watched
+int mergepolicy = MERGENONE;//set by reloaddatabase when a second deck is loaded without unloading the first
+int foldcase = 0;//answers are case sensitive unless this is set
+int folddiacritics = 0;//accented letters must be typed with their accents unless this is set
+int nearmissgrading = 0;//near misses count as wrong unless this is set
+int slowanswers = 0;//set if a right answer much slower than the entry's average is let off like a near miss, rather than counting towards moving up
+int rapiddrill = 0;//set to test without popups: how each answer went is shown on the status line, and a right answer goes straight on to the next question
+int matcherversion = 0;//bumped when the grading options change, so compiled answers are compiled again
+struct tier tiers[MAXTIERS] =//the original four lists, replaced by the contents of TIERSFILENAME if there is one
+{
+    {"need to learn",32,5,0,0,1,"Looks like you know this one a little better now!\nIt will be brought up less frequently.",NULL},
+    {"normal",62,5,3,0,0,"Looks like you know this one now!\nIt will be brought up much less frequently.","This one could do with some learning..."},
+    {"known",5,3,2,1,0,"OK! So this one's well-learnt.\nIt probably won't be brought up much any more.","OK, perhaps you don't know this one as well as you once did..."},
+    {"old",1,0,1,1,0,NULL,"This old one caught you out, huh? It will be brought up a few more times to help you remember it."},
+};
+int numberoftiers = 4;
+int newtier = 1;//tier new entries are added to, also drawn from instead of a norepeat tier that has come up since it last was
+int rolltable[MAXTIERS*MAXTIERWEIGHT];//tier for each possible roll when choosing which tier to test from, only tiers with entries get rolls
+int rolltotal = 0;
+uint64_t randomstate[4];//xoshiro256** state, drives every random choice in a test so a seed replays the same questions
+uint64_t randomseed;//seed the state was set from, noted in the log and shown with the stats
+int seedgiven = 0;//set if --seed was on the command line
+char * startdeckname = NULL;//deck given with --deck, loaded alongside setting up curses instead of asking which to load
+int startdeckformat = -1;
+int starttest = 0;//set by --test to go straight into Test Me! once the deck is loaded
+int showtimings = 0;//set by --timings
+struct timespec timings[TIMEPOINTS];//when each point in starting up was reached, zero if it hasn't been
+char * timingnames[TIMEPOINTS] = {"started","options read","deck loading started","curses set up","deck loaded","main menu shown","first question shown"};
+pthread_t uithread;//the only thread that may draw, other threads' errors just go in the log
+pthread_t startdeckthread;
+int startdeckthreaded = 0;//set if the --deck deck is being loaded by startdeckthread, rather than having been loaded before curses was set up
+int startdeckpending = 0;//set until the UI thread has taken the --deck deck over from the loading thread, which has the decks to itself until then
+struct event * postedwork = NULL, * lastpostedwork = NULL;//work other threads have handed to the UI thread, oldest first
+pthread_mutex_t postedworklock = PTHREAD_MUTEX_INITIALIZER;
+int wakefds[2] = {-1,-1};//pipe written to when work is posted, so the event loop wakes up for it
+struct event * timers = NULL;//timers waiting to go off, soonest first, only touched by the UI thread
+int runningevents = 0;//set while posted work or a timer runs, so a popup it opens doesn't run more under it
+int eventsidle = 0;//set while waitforkey() waits with EVENTIDLE
+int unshownerrors = 0;//errors logged by other threads, for the UI thread to point out
+struct simsettings simulation;
 int nlines,ncols;
+struct memorycounters memorycounters;
+struct metrics metrics;
+char * metricsaddress = NULL;//--metrics port on localhost, or Unix socket path, NULL if metrics aren't served
+int metricsfd = -1;//listening socket of the metrics endpoint
+pthread_t metricsthread;
+char * footprintnames[FOOTCATEGORIES] = {"entry records","question/answer text","progress arrays","answer matchers","search indexes","review history"};
 char passingstring[(2*MAXTEXTLENGTH)+1];
 
 void loaddatabase();//select which database to load and pass it to wgetrecordsfromfile
 char * validfilename (char * filename, char * extension);//filename validation
-void wgetrecordsfromfile(WINDOW * window,char * inputfilename,char separator);//load a file into memory
+int hasextension (char * filename, char * extension);//returns 1 if filename ends with the given extension
+void wgetrecordsfromfile(WINDOW * window,char * inputfilename,char separator);//load a file into memory, noting progress in window unless it's NULL
+void wimportcsv(WINDOW * window,char * inputfilename);//load a .csv file into memory, skipping malformed rows and listing them at the end, noting progress in window unless it's NULL
+struct csvreader * csvopenreader(FILE * file, char separator, int quoting);//starts reading a file, skipping any UTF-8 byte order mark
+void csvclosereader(struct csvreader * reader);//frees the reader and closes its file
+int csvnextchar(struct csvreader * reader);//returns the next byte of the file, reading another block when needed, or EOF
+int csvreadfield(struct csvreader * reader);//appends the next field to reader->record, returning CSVFIELD, CSVRECORD or CSVEND
+int csvreadrecord(struct csvreader * reader, char * fields[], int maxfields);//reads a record, pointing the first maxfields fields into reader->record (NULL if blank), returns the number of fields or CSVEND
+int csvcheckrecord(struct csvreader * reader, char * fields[], int numberoffields);//returns 1 if a record has a question and an answer and nothing wrong with it, otherwise notes it as a bad row and returns 0
+void csvclipfields(struct csvreader * reader, char * fields[]);//cuts text fields down to what a .~sv field can hold, noting the row if any were too long
+int cliptext(char * text, int maxbytes);//cuts text to at most maxbytes without splitting a UTF-8 character, returns 1 if anything was cut
+void csvsummary(struct csvreader * reader, char * target);//describes the bad and cut short rows, if there were any
+char * copyfield(char * field);//copies a field to memory big enough for the editor to read new text into, or returns NULL if it's blank
 char * readtextfromfile(int maxchars,char separator);//get text field from file
+int scantextfromfile(FILE * file,char * target,int maxchars,char separator);//read text field from file into target, or skip over it if target is NULL. Returns 0 for a blank field
+char * vocabinfo(struct vocab * entry);//returns an entry's info, reading it from its deck's source file the first time it's needed
+char * vocabhint(struct vocab * entry);//returns an entry's hint, reading it from its deck's source file the first time it's needed
+void readextrafromfile(struct vocab * entry);//reads an entry's info and hint from its deck's source file
+void materializedeck(struct deck * deck);//reads every outstanding info and hint of a deck, so its source file can be closed
 int readnumberfromfile(int maxvalue,char separator);//get integer field from file
 struct vocab * addtolist(struct vocab * newentry, struct listinfo * list);//add given (already filled in) vocab record to given list
 int removefromlist(struct vocab * entry, struct listinfo * list,int freeup);//remove given entry from given list. Also destroy record if freeup is true
+void freevocab(struct vocab * entry);//frees a record and all of its text
+unsigned int vocabhash(char * question, char * answer);//FNV-1a hash of question and answer together, for finding duplicates
+void vocabtableinsert(struct vocabtable * table, struct vocab * entry);//adds entry to the hash table, growing it if it gets over half full
+struct vocab * vocabtablefind(struct vocabtable * table, struct vocab * entry);//returns the entry in the table with the same question and answer as the given one, or NULL
+void buildvocabtable(struct vocabtable * table);//fills a hash table with every entry currently loaded
+void freevocabtable(struct vocabtable * table);//frees the table (but not the entries in it)
+int mergeprogress(struct vocab * existing, struct vocab * incoming, int right, int counter, int level);//applies mergepolicy to a loaded entry and the progress of its incoming duplicate, returns 1 if the existing entry was changed
+void sortintolists(struct deck * deck);//moves any entries of a deck whose 'known' level doesn't match their list into the right list, in one pass
 int unloaddatabase();//clears all vocab from memory, ready to load another database
 void reloaddatabase();//optionally saves and unloads present database before loading another 
-void reindex (struct listinfo * list);//necessary to stop gaps in the numbering system, which could cause random vocab selection to fail
+void watchdeck(struct deck * deck, char * filename);//starts watching the file a deck was read from, so changes made to it elsewhere are picked up
+void unwatchdeck(struct deck * deck);//stops watching a deck's file
+int watchedfilechanged(struct deck * deck);//returns 1 if a deck's watched file has changed since it was last looked at, noting how it is now
+void checkwatcheddecks();//applies any changes made to watched deck files since the last check
+int readwatchedlines(char * filename, struct watchedline ** lines, int * numberoflines);//reads a file, noting where each line starts and a hash of it, returns 0 if it can't be read
+int readchangedlines(struct deck * deck, struct watchedline ** lines, int * numberoflines, int * prefix, int * suffix, long * shift);//reads a deck's watched file as readwatchedlines does, but only the lines between those unchanged at its start and end, returns 0 if it can't be read
+uint64_t linehash(char * text, size_t length);//64-bit hash of a line, so different lines as good as never collide
+void pairwatchedline(struct deck * deck, struct watchedline * line, struct watchedline * oldline, int shiftsapplied);//carries an entry over from a line of a watched file to the same line in the file's new version
+void applydeckchanges(struct deck * deck);//diffs a deck's watched file against how it was, adding, removing and updating only the entries whose lines have changed, and keeping the progress of those still there
+void unlinkwatchedentry(struct deck * deck, int line);//removes and frees the entry read from a line of a deck's watched file
+long sourceoffset(struct vocab * entry);//where a lazy entry's info and hint are in its deck's source now, allowing for the shifts since its offset was taken
+void settleshifts(struct deck * deck);//brings every lazy entry's offset up to date with its deck's shifts, so the shifts can be forgotten
+struct deck * newdeck(char * filename);//adds an empty deck to the decks array and makes it current
+void closedeck(struct deck * deck);//unloads a deck and removes it from the decks array, leaving at least one deck open
+struct listinfo * levellist(struct deck * deck, int level);//returns the deck's list for the given 'known' level
+int deckintest(struct deck * deck);//returns 1 if testme() draws from the given deck (the current deck, if no decks have been chosen)
+int levelentries(int level);//returns the number of entries at the given level across all decks being tested
+struct vocab * selectentry(int level, int selector);//returns the selector'th entry (from 1) at the given level across all decks being tested
+void movetolevel(struct vocab * entry, int from, int to);//moves an entry from one level's list to another's in the same deck
+int deckentries(struct deck * deck);//returns the number of entries in every tier of a deck
+void loadtiers(char * filename);//replaces the default tiers with those defined in the given file, if it exists
+void buildrolltable();//shares out the rolls used to choose a tier in testme() between the tiers with entries, according to their weights
+int fillrolltable(int * table, int * tierentries);//fills a roll table for tiers with the given numbers of entries, returning the number of rolls
+int choosetier(uint64_t * state, int * table, int total, int * blocked, int newtierentries);//rolls for a tier, drawing from newtier instead of a norepeat tier in the blocked bitmask, and updates the mask
+int newprogressslot(struct deck * deck);//hands out an id for a new entry in a deck read from text, growing the progress arrays as needed
+void setprogress(struct vocab * entry, int right, int counter);//sets an entry's streak, saturating the counter at MAXSTREAK
+void setlevel(struct vocab * entry, int level);//sets an entry's 'known' level (without moving it to another list)
+void noteprogresschange(struct deck * deck);//counts an update to a compiled deck's shared progress
+void checksharedprogress();//re-sorts the lists of compiled decks whose progress other testers have changed since the last check
+struct vocab * findentrybyid(struct deck * deck, int id);//returns the entry in the deck with the given id, or NULL
+int wmapdeck(WINDOW * window,char * deckfilename);//maps a compiled deck file and its progress file into the current deck, noting progress in window unless it's NULL
+void unmapdeck(struct deck * deck);//releases a compiled deck's mappings (its entries must already have been unloaded)
+int wcompiledeck(WINDOW * window,char * deckfilename);//writes the current deck out as a compiled deck and progress file
+int openprogressfile(char * progressfilename);//opens a compiled deck's progress file for reading and writing, creating it if there isn't one, returns -1 if it can't
+size_t packblock(unsigned char * source, size_t length, unsigned char * target);//LZ77 compresses a block into target, which needs room for length+length/255+16 bytes, returning the compressed size
+int unpackblock(unsigned char * source, size_t length, unsigned char * target, size_t rawsize);//decompresses a block, returning 0 if it's corrupt
+FILE * openpacked(char * filename, struct packedfile ** packed);//opens a compressed deck as a stream of its text, with threads unpacking the blocks ahead of the reader, or returns NULL
+FILE * createpacked(FILE * file);//wraps a file being written in a stream that compresses what's written to it, or closes the file and returns NULL
+FILE * finishunpacking(FILE * stream, struct packedfile * packed);//swaps a stream opened by openpacked for an ordinary one reading the unpacked text, once it's all been read
+void * unpackblocks(void * packed);//body of an unpacking thread, which takes blocks in turn until there are none left
+ssize_t readpacked(void * cookie, char * buffer, size_t size);//stdio read function of a compressed deck, waiting for blocks that aren't unpacked yet
+ssize_t writepacked(void * cookie, const char * buffer, size_t size);//stdio write function of a compressed deck, packing each block as it fills
+int seekpacked(void * cookie, off64_t * offset, int whence);//stdio seek function of a compressed deck being read
+int closepacked(void * cookie);//stdio close function of a compressed deck, writing the last block or stopping the unpacking threads
+int flushpacked(struct packedfile * packed);//compresses and writes out the text waiting in the block, returning 0 on failure
+void deckmenu();//lets the user open more decks, choose the current deck and which decks are tested together
 void savedatabase();//does what it says on the tin, optionally allows user to give filename, which is passed to wwriteliststofile
-int wwriteliststofile(WINDOW * window,char * outputfilename);//output a file from memory to disk
+int wwriteliststofile(WINDOW * window,char * outputfilename);//output a file from memory to disk, locked against other testers saving it at the same time
+void rewatchdeck(struct deck * deck);//notes the lines of a deck's watched file after the deck has been saved over it, in the order the entries were written
 void databasemenu();//provides ability to add entries to database, and edit entries from outside testing mode
 struct vocab * createnewvocab();//allows user to create now vocab record within the program
+struct vocab * searchasyoutype();//lets the user pick an entry of the current deck from a list that narrows with every key typed
+void buildsearchindex(struct deck * deck);//sorts every question and answer in the deck (ignoring case) so a prefix can be found by binary search
+int comparesearchkeys(const void * a, const void * b);//qsort comparison for search keys
+int searchbound(struct deck * deck, char * prefix, int after);//returns the first key starting with prefix, or if after is set the first key after all of those
+int browsedeck();//lists every entry of the current deck, sorted by question, answer, level or streak, for one to be picked to edit. Returns -1 if the editor asked for the main menu
+void buildbrowseorders(struct deck * deck);//sorts the deck's entries by question and answer if they've changed since it was last done, and by level and streak every time
+int comparebrowsequestions(const void * a, const void * b);//qsort comparison of entries by question, then answer
+int comparebrowseanswers(const void * a, const void * b);//qsort comparison of entries by answer, then question
+void startindexing(struct deck * deck);//copies the text of every entry of a deck and starts a thread building a full-text index over it
+void finishindexing(struct deck * deck);//waits for a deck's indexing thread, if there is one
+void indexbuilt(void * unused);//joins the indexing threads that have finished, posted by each as it finishes
+void waitforindex(struct textindex * index);//pops up a note until an index being built is ready, keeping the event loop going meanwhile
+void freetextindex(struct deck * deck);//waits for and frees a deck's full-text index
+void * indexdeck(void * index);//body of the indexing thread: reads lazy info and hints, then sorts the suffixes
+void appendindextext(struct textindex * index, char * text);//adds a field, lowercased, to the text of an index
+void addindexsegment(struct textindex * index, int entry);//notes that the text from here on belongs to the given entry
+void * sortbuckets(void * job);//sorts the suffixes in a run of buckets, run by each sorting thread
+void sortsuffixes(unsigned int * suffixes, int n, char * text, int depth);//three-way radix quicksort of suffixes that already agree on their first depth characters
+int findtext(struct deck * deck, char * query, struct vocab *** results);//finds every entry of a deck with the query in any field, best matches first, returning how many
+struct vocab * pickentry(char * title, struct vocab ** entries, int numberofentries);//lets the user choose one of a list of entries, returns NULL if they don't
 struct vocab * vocabsearch(char * searchstring);//returns a pointer to vocab entry if the question or answer matches given search string
 struct vocab * vocabfuzzysearch(char * searchstring);//returns a pointer to a user-selected vocab entry out of a list of up to 10 possible suggestions
 int editormenu(struct vocab * entry, int fromtest);//shows menu to edit current entry, fromtest is 1 when run from within the test and 0 when from the menu, returns 1 to be run again, 0 to continue without the menu or -1 to return to the main menu
 void testme();//main code for learning vocab, including options menu
+int foldcodepoint(int codepoint);//applies the case and accent folding options to a unicode character
+void normaliseanswer(char * source, char * target);//copies source to target with brackets removed, spaces tidied and letters folded as the options say
+unsigned int texthash(char * text);//FNV-1a hash of a string
+struct answermatcher * compileanswer(char * answer);//builds the table of accepted forms of an answer: the whole answer, each '/' alternative, with and without each bracketed part
+int editdistance(char * pattern, char * text, int limit);//Damerau (optimal string alignment) distance between two strings, or limit+1 once it's known to be over limit
+int gradeanswer(struct vocab * entry, char * response);//returns GRADERIGHT if the response is an accepted form of the entry's answer, GRADENEARMISS if it's a typo away from one, else GRADEWRONG
+void recordanswer(struct vocab * entry, int grade, int usedhint);//updates an entry's right/wrong streak after it has been answered
+void notedrillanswer(struct vocab * entry, int grade, int usedhint, int slow, int streak, int level, int newlevel, char * feedback, int size, struct drillsummary * summary);//writes how an answer went to feedback for the status line of a rapid drill, and notes it for the summary
+void showdrillsummary(struct drillsummary * summary);//pops up the answers given and changes of tier made in a rapid drill
+int levelafteranswer(struct vocab * entry, int level, int grade, int usedhint);//moves an entry to another list if its streak calls for it, returns the level it ends up on
+void updatestreak(int * right, int * counter, int grade, int usedhint);//the right/wrong streak after an answer
+int tierafteranswer(int level, int counter, int grade, int usedhint);//the tier an entry belongs on after an answer, given its streak once the answer is counted
+void optionsmenu();//lets the user change the grading options
 char * wgettextfromkeyboard(WINDOW * window, char * target,int maxchars);//set given string (char pointer) from keyboard, allocating memory if necessary
 int getyesorno(char * question);//asks for yes or no, returns true (1) if yes
+int getchoice(char * question, char * choices[], int numberofchoices);//pops up a question with a menu of choices, returns the number of the chosen one
+void openeventloop();//sets up the pipe other threads wake the event loop with, before any of them start
+void postwork(void (*function)(void *), void * argument);//hands work to the UI thread, to be run the next time it waits for a key. Safe from any thread
+void addtimer(int milliseconds, void (*function)(void *), void * argument);//runs a function on the UI thread once the given time has passed
+int runevents();//runs the work posted so far and any timers that are due, returns how many were run
+int waitforkey(WINDOW * window, int flags);//the event loop: runs posted work, timers and (with EVENTIDLE) changes to watched decks until a key is pressed in window, and returns it
+void resizescreen();//redraws everything after the terminal has been resized
+void drawbackground();//draws the title, and the note that the --deck deck is loading if it is, on stdscr
+void checkprogressregularly(void * unused);//timer looking at idle moments for answers other testers have given from compiled decks
 void clrscr();//clears the screen. Now with #ifdef preprocessor script for portability!!
 void clearinputbuffer();//clears the input buffer after each request for input, so that the following request is not getting the overflow
+void recordhistory(struct vocab * entry, int grade, int usedhint, unsigned int latency);//notes a graded answer in its deck's history, appending a block to the file when enough have built up
+void addhistoryrow(struct historycolumns * columns, unsigned int key, unsigned int time, unsigned int latency, unsigned char outcome);//adds one row to each column, growing them as needed
+void reservehistory(struct historycolumns * columns, unsigned int rows);//makes sure the columns have room for the given number of rows
+struct historytotals * findhistorytotals(struct historytotals ** table, unsigned int * size, unsigned int * used, unsigned int key);//finds (or adds) an entry's totals in a table keyed on its hash, growing the table as it fills
+void flushhistory(struct deck * deck);//appends the deck's graded answers held in memory to its history file
+int writehistoryblock(FILE * file, struct historycolumns * columns);//writes the columns as one block, returns 0 on failure
+int readhistory(char * filename, struct historycolumns * columns);//adds every row of a history file to the columns (compacting the file if it has many blocks), returns the number of blocks
+void freehistory(struct historycolumns * columns);
+void historyfilename(struct deck * deck, char * filename);//the history file that goes with a deck
+void readlatencies(struct deck * deck);//works out each entry's average answer time by replaying the deck's review history, unless the entries haven't changed since it was last done
+unsigned short averagelatency(unsigned short average, unsigned int latency);//moves an average answer time towards the time of one more answer
+void showhistory();//shows trends from the review history of every deck being tested
+void * countedmalloc(size_t size);//malloc, counted in memorycounters
+void * countedcalloc(size_t count, size_t size);//calloc, counted in memorycounters
+void * countedrealloc(void * pointer, size_t size);//realloc, counted in memorycounters
+void countedfree(void * pointer);//free, counted in memorycounters
+void countallocation(size_t oldsize, size_t newsize);//moves the live total from one block size to another, raising the peak if it's passed
+void countblock(struct footprint * footprint, void * block, size_t used);//adds a heap block, of which used bytes are in use, to a footprint
+size_t measurememory(struct footprint * footprints, size_t * unpacked);//walks every deck, filling in the footprint of each kind of data and the bytes of compressed decks' text held unpacked, and returns the bytes of compiled decks mapped
+char * memoryreport(char * target, size_t size);//writes a table of the memory in use into target
+void showmemory();//shows how much memory the decks and the rest of the tester are using
+void startmetrics();//starts serving the metrics on the --metrics port or socket, in a thread of their own
+void * servemetrics(void * unused);//body of the metrics thread, answering every connection with the metrics as they are
+int writemetrics(char * target, int size);//writes every metric in Prometheus text format, returns the length
+void countduration(unsigned long long * count, unsigned long long * microseconds, struct timespec * started);//adds a load or save that began at started to the metrics
 float calculatescore(int showstats);//returns overall idea of progress as percentage, displays screenful of stats if 'showstats' is true
 void startup();//sets up curses mode, erroring if no can do
-void shutdown();//asks about saving if appropriate and exits
+void * loadstartdeck(void * unused);//body of the thread loading the --deck deck while curses is set up
+void finishstartdeck(void * unused);//waits for the --deck deck to be loaded, and says if anything went wrong. Posted by the loading thread as it finishes, so there's seldom a wait
+void marktime(int point);//notes when a point in starting up is first reached
+void reporttimings(FILE * file);//writes how long each part of starting up took
+int commandline(int argc, char * argv[]);//reads the command-line options, and runs a subcommand without starting curses if there is one, returning the exit status, or -1 to start the tester
+void seedrandom(uint64_t * state, uint64_t seed);//sets a random number generator's state from a seed
+uint64_t nextrandom(uint64_t * state);//returns the next 64 random bits
+unsigned int randombelow(uint64_t * state, unsigned int bound);//returns a random number from 0 to bound-1, with every value equally likely
+int formatfromname(char * name);//returns the format named, or given by a file's extension, or -1
+int convertdeck(char * inputfilename, int inputformat, char * outputfilename, int outputformat);//streams every record of one file into another, one record at a time, returning the exit status
+void writefield(FILE * file, char * text, int format);//writes one text field, quoted or escaped as the format needs
+void writenumber(FILE * file, int number);//writes a small non-negative number, without the cost of fprintf
+int simulate(int argc, char * argv[]);//runs virtual learners through testme()'s choice of questions and tiers, and reports how they got on
+void * simulatelearners(void * job);//body of a simulating thread
+int compareints(const void * a, const void * b);//qsort comparison for ints
+void reportmastery(char * what, int * reviews);//prints the median and mean of the questions learners took to reach a point
+void closedown();//asks about saving if appropriate and exits
 void outofmemory();//HowCanThisBe!? Quits...
 WINDOW * nicebigwindow();//creates a bordered, blue window, taking up most of the screen, with keypad enabled
 WINDOW * innerwindow(WINDOW * outerwindow);//creates an area within another window for purposes of displaying text with a margin
@@ -97,8 +679,13 @@ void popupinfo(int colour,char * title,char * message);//pops up a window with t
 void popuperror(char * errormessage);//pops up an error and makes a note in the log
 void donothing(),showscore();//does nothing!
 void windowtitle(WINDOW * window, char * title);//writes the given string to the given window (top centre)
-int textwidth (char * text);//returns the width of a given string (which may include newlines) in chars when displayed without wrapping (for purposes of determining optimum window width)
+int textwidth (char * text);//returns the width of a given string (which may include newlines) in columns when displayed without wrapping (for purposes of determining optimum window width)
 int textheight (char * text, int width);//returns the height of a given string (which may include newlines) in lines when displayed wrapped to the given width (for purposes of determining optimum window width)
+int textprefix(char * text, int columns);//returns how many bytes of the first line of text fit in the given number of columns
+int fieldprefix(char * text, unsigned short * width, int columns);//as textprefix, for a question or answer whose width is cached in the entry
+int asciirun(unsigned char * text);//returns how many bytes at the start of text are plain ASCII other than a newline, checking a word at a time
+int decodeutf8(unsigned char ** text);//returns the character text points to and moves past it, taking a malformed byte as a character of its own
+int codepointwidth(int codepoint);//returns the columns a character takes up on screen: 2 for East Asian wide and fullwidth, 0 for combining marks, otherwise 1
 
 void loaddatabase()//select which database to load
 {
@@ -147,18 +734,28 @@ void loaddatabase()//select which database to load
                 usingfilename = 0;
             }
         }
-        if (usingfilename) inputfilename=validfilename(wgettextfromkeyboard(wloaddatabase,inputfilename,MAXTEXTLENGTH),extension);
+        if (usingfilename)
+        {
+            inputfilename=wgettextfromkeyboard(wloaddatabase,inputfilename,MAXTEXTLENGTH);
+            if (hasextension(inputfilename,".vtd")) usingfilename = 2;//compiled deck, which is mapped rather than read
+            else if (!hasextension(inputfilename,PACKEDEXTENSION)) inputfilename=validfilename(inputfilename,extension);
+        }
     }
-    if (usingfilename)
+    if (usingfilename==2)
     {
-        wgetrecordsfromfile(wloaddatabase,inputfilename,separator);
-        inputfilename=validfilename(inputfilename,".~sv");
-        strcpy(currentfilename,inputfilename);
+        if (wmapdeck(wloaddatabase,inputfilename)) strcpy(currentdeck->filename,inputfilename);
+    }
+    else if (usingfilename)
+    {
+        if (separator==',') wimportcsv(wloaddatabase,inputfilename);
+        else wgetrecordsfromfile(wloaddatabase,inputfilename,separator);
+        if (!hasextension(inputfilename,PACKEDEXTENSION)) inputfilename=validfilename(inputfilename,".~sv");//a compressed deck is saved compressed
+        strcpy(currentdeck->filename,inputfilename);
     }
     free(inputfilename);
     getmaxyx(wloaddatabase,nlines,ncols);
     mvwprintw(wloaddatabase,nlines-1,0,"Press any key to continue...");
-    wgetch(wloaddatabase);
+    waitforkey(wloaddatabase,0);
     delwin(wloaddatabase);
     del_panel(ploaddatabase);
     delwin(wbloaddatabase);
@@ -190,20 +787,38 @@ char * validfilename (char * filename, char * extension)//filename validation
     return filename;
 }
 
+int hasextension (char * filename, char * extension)
+{
+    int filenamelength = strlen(filename), extensionlength = strlen(extension);
+    return filenamelength>extensionlength && !strcmp(filename+filenamelength-extensionlength,extension);
+}
+
 void wgetrecordsfromfile(WINDOW * window,char * inputfilename,char separator)
 {
-    int goodcounter = 0,badcounter = 0;
-    struct vocab * newvocab;
+    int goodcounter = 0,badcounter = 0,mergedcounter = 0,skippedcounter = 0;
+    int right, counter, level;
+    long extra;
+    struct vocab * newvocab, * duplicate;
     struct listinfo * newvocablist;
-    if (!(inputfile = fopen(inputfilename, "r")))
+    struct vocabtable table = {NULL,NULL,0,0};
+    struct packedfile * packed = NULL;
+    struct timespec started;
+    int wasempty = !deckentries(currentdeck);//a deck is only watched if it all comes from one file
+    clock_gettime(CLOCK_MONOTONIC,&started);
+    if (!(inputfile = hasextension(inputfilename,PACKEDEXTENSION) ? openpacked(inputfilename,&packed) : fopen(inputfilename, "r")))
     {
         sprintf(passingstring,"Unable to read input file: '%s'. File does not exist or is in use.",inputfilename);
         popuperror(passingstring);
-        wprintw(window,"Loading file Failed.");
+        if (window) wprintw(window,"Loading file Failed.");
     }
     else
     {
-        wprintw(window,"Opened input file %s, reading contents...\n",inputfilename);
+        materializedeck(currentdeck);//entries already loaded can't keep reading from their old source once there is a new one
+        if (window) wprintw(window,"Opened input file %s, reading contents...\n",inputfilename);
+        if (mergepolicy) buildvocabtable(&table);//hash what's already loaded, so each incoming record can be checked in one probe
+        currentdeck->source = inputfile;//set now, as merging a duplicate reads the info and hint of records from this file
+        currentdeck->numberofshifts = 0;
+        currentdeck->separator = separator;
         while (!feof(inputfile))
         {
             newvocab = (struct vocab *)malloc(sizeof(struct vocab));
@@ -213,78 +828,390 @@ void wgetrecordsfromfile(WINDOW * window,char * inputfilename,char separator)
             }
             else
             {
+                newvocab->matcher=NULL;
+                newvocab->questionwidth=newvocab->answerwidth=0;
+                newvocab->latency=0;
                 newvocab->question=newvocab->answer=newvocab->info=newvocab->hint=NULL;
+                newvocab->deck=currentdeck;
+                newvocab->id=-1;
                 newvocab->question=readtextfromfile(MAXTEXTLENGTH,separator);
                 newvocab->answer=readtextfromfile(MAXTEXTLENGTH,separator);
-                newvocab->info=readtextfromfile(MAXTEXTLENGTH,separator);
-                newvocab->hint=readtextfromfile(MAXTEXTLENGTH,separator);
-                newvocab->right=readnumberfromfile(1,separator);
-                newvocab->counter=readnumberfromfile(0,separator);
-                newvocab->known=readnumberfromfile(3,separator);
+                //info and hint are only needed when an entry comes up, so just note where they are
+                extra=ftell(inputfile);
+                newvocab->lazy=0;
+                if (scantextfromfile(inputfile,NULL,MAXTEXTLENGTH,separator)) newvocab->lazy|=LAZYINFO;
+                if (scantextfromfile(inputfile,NULL,MAXTEXTLENGTH,separator)) newvocab->lazy|=LAZYHINT;
+                newvocab->extra=extra;
+                newvocab->shiftsapplied=0;
+                right=readnumberfromfile(1,separator);
+                counter=readnumberfromfile(0,separator);
+                level=readnumberfromfile(numberoftiers-1,separator);
 
-                switch (newvocab->known)
-                {
-                    case 0: newvocablist = &n2l;break;
-                    case 1: newvocablist = &norm;break;
-                    case 2: newvocablist = &known;break;
-                    case 3: newvocablist = &old;break;
-                }
+                newvocablist = levellist(currentdeck,level);
 
-                addtolist(newvocab,newvocablist);
-                if (newvocab->question==NULL||newvocab->answer==NULL)
+                if (newvocab->question==NULL||newvocab->answer==NULL)//check before adding, as removing from the end of a list means walking all of it
                 {
                     badcounter++;
-                    fprintf(stderr,"Removing faulty vocab record (%d) created at line %i of input file...\n",badcounter,(goodcounter+badcounter));
-                    removefromlist(newvocab,newvocablist,1);
+                    fprintf(stderr,"Removing faulty vocab record (%d) created at line %i of input file...\n",badcounter,(goodcounter+badcounter+mergedcounter+skippedcounter));
+                    freevocab(newvocab);
+                }
+                else if (mergepolicy && (duplicate = vocabtablefind(&table,newvocab)))
+                {
+                    if (mergeprogress(duplicate,newvocab,right,counter,level)) mergedcounter++;
+                    else skippedcounter++;
+                    freevocab(newvocab);
+                }
+                else
+                {
+                    newvocab->id=newprogressslot(currentdeck);
+                    setprogress(newvocab,right,counter);
+                    addtolist(newvocab,newvocablist);
+                    if (mergepolicy) vocabtableinsert(&table,newvocab);//so duplicates within the file being loaded are caught too
+                    goodcounter++;
                 }
-                else goodcounter++;
             }
         }
-        fclose(inputfile);
-        wprintw(window,"...finished.\n%i entries read from %s.\n\n",goodcounter,inputfilename);
+        currentdeck->unpackedsize = packed ? packed->size : 0;//a compressed deck's text stays in memory while the deck reads info and hints from it
+        if (packed) inputfile = finishunpacking(inputfile,packed);//the unpacked text, which info and hints can be read from like any file
+        currentdeck->source = inputfile;//kept open for reading info and hints as they're needed (a compressed deck's stream has just been swapped)
+        currentdeck->textversion++;//the full-text index is built when the deck is first searched, or rebuilt if this was merged into a deck already searched
+        if (wasempty && separator=='~' && !packed) watchdeck(currentdeck,inputfilename);
+        else unwatchdeck(currentdeck);
+        if (window) wprintw(window,"...finished.\n%i entries read from %s.\n\n",goodcounter+mergedcounter+skippedcounter,inputfilename);
+        if (mergepolicy)
+        {
+            freevocabtable(&table);
+            if (mergedcounter) sortintolists(currentdeck);//merged progress may have changed some 'known' levels
+            if (window) wprintw(window,"Merged into the loaded database:\n%i entries added\n%i duplicates merged\n%i duplicates skipped\n\n",goodcounter,mergedcounter,skippedcounter);
+        }
         if (badcounter)
         {
             sprintf(passingstring,"%i faulty entries encountered!\n\nIt is HIGHLY recommended you do NOT save back to the original file.\n\nSee error log for details.",badcounter);
             popuperror(passingstring);
         }
+        countduration(&metrics.loads,&metrics.loadmicroseconds,&started);
     }
     return;
 }
 
+void wimportcsv(WINDOW * window,char * inputfilename)
+{
+    int goodcounter = 0,mergedcounter = 0,skippedcounter = 0;
+    int right, counter, level, numberoffields;
+    char * fields[CSVFIELDS];
+    FILE * file;
+    struct csvreader * reader;
+    struct vocab * newvocab, * duplicate;
+    struct vocabtable table = {NULL,NULL,0,0};
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC,&started);
+    if (!(file = fopen(inputfilename, "rb")))
+    {
+        sprintf(passingstring,"Unable to read input file: '%s'. File does not exist or is in use.",inputfilename);
+        popuperror(passingstring);
+        if (window) wprintw(window,"Loading file Failed.");
+        return;
+    }
+    reader = csvopenreader(file,',',1);
+    if (window)
+    {
+        wprintw(window,"Opened input file %s, importing contents...\n",inputfilename);
+        update_panels();
+        doupdate();
+    }
+    if (mergepolicy) buildvocabtable(&table);
+    while ((numberoffields = csvreadrecord(reader,fields,CSVFIELDS))!=CSVEND)
+    {
+        if (!csvcheckrecord(reader,fields,numberoffields)) continue;
+        csvclipfields(reader,fields);
+        if (!(newvocab = (struct vocab *)malloc(sizeof(struct vocab)))) outofmemory();
+        newvocab->matcher=NULL;
+        newvocab->questionwidth=newvocab->answerwidth=0;
+        newvocab->latency=0;
+        newvocab->deck=currentdeck;
+        newvocab->id=-1;
+        newvocab->question=copyfield(fields[0]);
+        newvocab->answer=copyfield(fields[1]);
+        newvocab->info=copyfield(fields[2]);
+        newvocab->hint=copyfield(fields[3]);
+        newvocab->lazy=0;
+        newvocab->extra=0;
+        right = fields[4] && atoi(fields[4]) ? 1 : 0;//progress columns can be left off
+        counter = fields[5] && atoi(fields[5])>0 ? atoi(fields[5]) : 0;
+        level = fields[6] ? atoi(fields[6]) : newtier;
+        if (level<0) level = 0;
+        if (level>=numberoftiers) level = numberoftiers-1;
+
+        if (mergepolicy && (duplicate = vocabtablefind(&table,newvocab)))
+        {
+            if (mergeprogress(duplicate,newvocab,right,counter,level)) mergedcounter++;
+            else skippedcounter++;
+            freevocab(newvocab);
+        }
+        else
+        {
+            newvocab->id=newprogressslot(currentdeck);
+            setprogress(newvocab,right,counter);
+            addtolist(newvocab,levellist(currentdeck,level));
+            if (mergepolicy) vocabtableinsert(&table,newvocab);
+            goodcounter++;
+        }
+    }
+    csvsummary(reader,passingstring);
+    csvclosereader(reader);
+    currentdeck->textversion++;//as for a .~sv file, the full-text index waits for a search
+    unwatchdeck(currentdeck);//only .~sv files are watched
+    if (window) wprintw(window,"...finished.\n%i entries read from %s.\n\n",goodcounter+mergedcounter+skippedcounter,inputfilename);
+    if (mergepolicy)
+    {
+        freevocabtable(&table);
+        if (mergedcounter) sortintolists(currentdeck);
+        if (window) wprintw(window,"Merged into the loaded database:\n%i entries added\n%i duplicates merged\n%i duplicates skipped\n\n",goodcounter,mergedcounter,skippedcounter);
+    }
+    countduration(&metrics.loads,&metrics.loadmicroseconds,&started);
+    if (*passingstring) popuperror(passingstring);//one summary for the whole file, rather than a message per row
+}
+
+struct csvreader * csvopenreader(FILE * file, char separator, int quoting)
+{
+    struct csvreader * reader;
+    if (!(reader = (struct csvreader *)malloc(sizeof(struct csvreader)))) outofmemory();
+    reader->file = file;
+    reader->separator = separator;
+    reader->quoting = quoting;
+    reader->line = reader->recordline = 1;
+    reader->record = NULL;
+    reader->length = reader->capacity = 0;
+    reader->quoted = reader->malformed = reader->badrows = reader->longrows = 0;
+    reader->filled = fread(reader->block,1,CSVBLOCKSIZE,file);
+    reader->position = 0;
+    if (reader->filled>=3 && reader->block[0]==0xef && reader->block[1]==0xbb && reader->block[2]==0xbf) reader->position = 3;//UTF-8 byte order mark, as saved by Excel
+    return reader;
+}
+
+void csvclosereader(struct csvreader * reader)
+{
+    if (reader->file!=stdin) fclose(reader->file);
+    free(reader->record);
+    free(reader);
+}
+
+int csvnextchar(struct csvreader * reader)
+{
+    if (reader->position==reader->filled)
+    {
+        if (!reader->filled) return EOF;
+        reader->filled = fread(reader->block,1,CSVBLOCKSIZE,reader->file);
+        reader->position = 0;
+        if (!reader->filled) return EOF;
+    }
+    return reader->block[reader->position++];
+}
+
+int csvreadfield(struct csvreader * reader)
+{
+    int ch, inquotes = 0, closed = 0;
+    reader->quoted = 0;
+    ch = csvnextchar(reader);
+    if (ch==EOF) return CSVEND;
+    while ((ch==' ' || ch=='\t') && ch!=reader->separator) ch = csvnextchar(reader);//spaces before an opening quote don't count
+    if (ch=='"' && reader->quoting) {inquotes = reader->quoted = 1;ch = csvnextchar(reader);}
+    for (;;ch = csvnextchar(reader))
+    {
+        if (inquotes)
+        {
+            if (ch==EOF) {reader->malformed = 1;break;}//quotes never closed
+            if (ch=='"' && (ch = csvnextchar(reader))!='"') {inquotes = 0;closed = 1;}//not a doubled quote, so it was the closing one and ch is whatever follows it
+            else if (ch=='\r') continue;
+            else if (ch=='\n') {reader->line++;ch = ' ';}//a .~sv record has to fit on one line
+        }
+        if (!inquotes)
+        {
+            if (ch==reader->separator) return CSVFIELD;
+            if (ch=='\n') {reader->line++;break;}
+            if (ch==EOF) break;
+            if (ch=='\r') continue;
+            if (closed) {if (ch!=' ' && ch!='\t') reader->malformed = 1;continue;}//only spaces may follow the closing quote
+            if (ch=='"' && reader->quoting) reader->malformed = 1;//a quote inside a field that wasn't quoted
+        }
+        if (reader->length+1>=reader->capacity)
+        {
+            reader->capacity = reader->capacity ? 2*reader->capacity : 4*(MAXTEXTLENGTH+1);
+            if (!(reader->record = (char *)realloc(reader->record,reader->capacity))) outofmemory();
+        }
+        reader->record[reader->length++] = ch;
+    }
+    return CSVRECORD;
+}
+
+int csvreadrecord(struct csvreader * reader, char * fields[], int maxfields)
+{
+    int numberoffields = 0, result, start, i;
+    int starts[CSVFIELDS];
+    reader->malformed = 0;
+    reader->recordline = reader->line;
+    reader->length = 0;
+    do
+    {
+        start = reader->length;
+        result = csvreadfield(reader);
+        if (result==CSVEND) {if (!numberoffields) return CSVEND;break;}
+        if (!reader->quoted) while (reader->length>start && isspace((unsigned char)reader->record[reader->length-1])) reader->length--;//spaces around quoted text are dropped, within quotes they're kept
+        if (numberoffields<maxfields && numberoffields<CSVFIELDS) starts[numberoffields] = reader->length>start ? start : -1;
+        if (reader->length+1>=reader->capacity)
+        {
+            reader->capacity = reader->capacity ? 2*reader->capacity : 4*(MAXTEXTLENGTH+1);
+            if (!(reader->record = (char *)realloc(reader->record,reader->capacity))) outofmemory();
+        }
+        reader->record[reader->length++] = '\0';
+        numberoffields++;
+    }
+    while (result==CSVFIELD);
+    for (i=0;i<maxfields && i<CSVFIELDS;i++) fields[i] = i<numberoffields && starts[i]>=0 ? reader->record+starts[i] : NULL;//the record may have moved as it grew, so the pointers are only made now
+    return numberoffields;
+}
+
+int csvcheckrecord(struct csvreader * reader, char * fields[], int numberoffields)
+{
+    if (numberoffields==1 && !fields[0] && !reader->malformed) return 0;//blank line, not worth a mention
+    if (!reader->malformed && numberoffields>=2 && numberoffields<=CSVFIELDS && fields[0] && fields[1]) return 1;
+    if (reader->badrows<CSVREPORTLINES) reader->badlines[reader->badrows] = reader->recordline;
+    reader->badrows++;
+    return 0;
+}
+
+void csvclipfields(struct csvreader * reader, char * fields[])
+{
+    int i, clipped = 0;
+    for (i=0;i<4;i++) if (fields[i] && cliptext(fields[i],MAXTEXTLENGTH-1)) clipped = 1;//scantextfromfile stops a field one short of maxchars, so that's all a saved deck can give back
+    if (!clipped) return;
+    fprintf(stderr,"Text on line %li is longer than %i characters, and has been cut short\n",reader->recordline,MAXTEXTLENGTH-1);
+    if (!reader->longrows++) reader->longline = reader->recordline;
+}
+
+int cliptext(char * text, int maxbytes)
+{
+    int length = strlen(text);
+    if (length<=maxbytes) return 0;
+    while (maxbytes>0 && (text[maxbytes]&0xC0)==0x80) maxbytes--;//back off to the start of the character that doesn't fit
+    text[maxbytes] = '\0';
+    return 1;
+}
+
+void csvsummary(struct csvreader * reader, char * target)
+{
+    int i, length = 0;
+    *target = '\0';
+    if (reader->badrows)
+    {
+        length = sprintf(target,"%i malformed rows were skipped, on line%s",reader->badrows,reader->badrows>1?"s":"");
+        for (i=0;i<reader->badrows && i<CSVREPORTLINES;i++) length += sprintf(target+length,"%s %li",i?",":"",reader->badlines[i]);
+        if (reader->badrows>CSVREPORTLINES) length += sprintf(target+length," and %i more",reader->badrows-CSVREPORTLINES);
+        length += sprintf(target+length,".\n\nEach row needs a question and an answer%s.",reader->quoting?", and quotes can only go round a whole field":"");
+    }
+    if (reader->longrows) sprintf(target+length,"%s%i row%s had text longer than %i characters, which was cut short (the first on line %li). See error log for details.",length?"\n\n":"",reader->longrows,reader->longrows>1?"s":"",MAXTEXTLENGTH-1,reader->longline);
+}
+
+char * copyfield(char * field)
+{
+    char * copy;
+    int length;
+    if (!field) return NULL;
+    length = strlen(field);
+    if (length>MAXTEXTLENGTH) length = MAXTEXTLENGTH;//imports clip their fields already, this just keeps the copy the size the editor expects
+    if (!(copy = (char *)malloc(MAXTEXTLENGTH+1))) outofmemory();
+    memcpy(copy,field,length);
+    copy[length] = '\0';
+    if (length==MAXTEXTLENGTH) cliptext(copy,MAXTEXTLENGTH);//in case the cut split a character
+    return copy;
+}
+
 char * readtextfromfile(int maxchars,char separator)
 {
-    int i=0;
-    char ch;
     char * target = (char *)malloc(maxchars+1); //allocate memory for new string
     if (!target) outofmemory();
+    if (!scantextfromfile(inputfile,target,maxchars,separator)) {free(target);return NULL;}
+    return target;
+}
 
-    ch=getc(inputfile);
-    if (ch==separator||ch==EOF){free(target);return NULL;}//if field is blank (zero-length), return null pointer (||EOF added because it hangs on blank database)
+int scantextfromfile(FILE * file,char * target,int maxchars,char separator)
+{
+    int i=0;
+    char ch;
+
+    ch=getc(file);
+    if (ch==separator||ch==EOF) return 0;//if field is blank (zero-length), return 0 (||EOF added because it hangs on blank database)
     while (isspace(ch))
     {
-        ch = getc(inputfile);//cycle forward until you reach text
-        if (ch == separator||ch=='\n'||ch==EOF) {free(target);return NULL;}//if no text found(reached separator before anything else), return null pointer
+        ch = getc(file);//cycle forward until you reach text
+        if (ch == separator||ch=='\n'||ch==EOF) return 0;//if no text found(reached separator before anything else), return 0
     }
     if (ch=='"') //Entry is in quotes (generated by excel when exporting to .csv and field contains a comma)
     {
-        ch=getc(inputfile);//move to next character after the quotes
+        ch=getc(file);//move to next character after the quotes
         while (i<(maxchars-1) && ch!='"' && ch!='\n')//stop when you reach the end quotes, end of line, or when text too long
         {
-            target[i++]=ch;
-            ch = getc(inputfile); //copy name from file to target, one char at a time
+            if (target) target[i]=ch;
+            i++;
+            ch = getc(file); //copy name from file to target, one char at a time
         }
-        ch=getc(inputfile);//consume separator that follows quotes, so next field does not appear empty (this was a bug... SQEESH!)
+        ch=getc(file);//consume separator that follows quotes, so next field does not appear empty (this was a bug... SQEESH!)
     }
     else //entry is not in quotes, so char is currently first letter of string
     {
         while (i<(maxchars-1) && ch!=separator && ch!='\n')//stop when you reach separator, end of line, or when text too long
         {
-            target[i++]=ch;
-            ch = getc(inputfile); //copy name from file to target, one char at a time
+            if (target) target[i]=ch;
+            i++;
+            ch = getc(file); //copy name from file to target, one char at a time
         }
     }
-    target[i] = '\0';//terminate string
-    return target;
+    if (target) target[i] = '\0';//terminate string
+    return 1;
+}
+
+char * vocabinfo(struct vocab * entry)
+{
+    if (entry->lazy) readextrafromfile(entry);
+    return entry->info;
+}
+
+char * vocabhint(struct vocab * entry)
+{
+    if (entry->lazy) readextrafromfile(entry);
+    return entry->hint;
+}
+
+void readextrafromfile(struct vocab * entry)
+{
+    FILE * previousinputfile = inputfile;
+    long position;
+    inputfile = entry->deck->source;//readtextfromfile always reads from inputfile
+    if (!inputfile || (position = ftell(inputfile))<0 || fseek(inputfile,sourceoffset(entry),SEEK_SET))
+    {
+        popuperror("Unable to read info and hint from the database file!");
+        inputfile = previousinputfile;
+        entry->lazy = 0;
+        return;
+    }
+    entry->info=readtextfromfile(MAXTEXTLENGTH,entry->deck->separator);
+    entry->hint=readtextfromfile(MAXTEXTLENGTH,entry->deck->separator);
+    entry->lazy = 0;
+    fseek(inputfile,position,SEEK_SET);//the deck may still be being loaded from this stream, when a duplicate is merged
+    inputfile = previousinputfile;
+}
+
+void materializedeck(struct deck * deck)
+{
+    int i;
+    struct vocab * entry;
+    if (!deck->source) return;
+    finishindexing(deck);//the indexing thread may still be reading from the source
+    for (i=0;i<numberoftiers;i++) for (entry=levellist(deck,i)->head;entry;entry=entry->next) if (entry->lazy) readextrafromfile(entry);
+    fclose(deck->source);
+    deck->source = NULL;
+    deck->numberofshifts = 0;
+    deck->unpackedsize = 0;
 }
 
 int readnumberfromfile (int maxvalue,char separator)
@@ -317,22 +1244,21 @@ struct vocab * addtolist(struct vocab * newentry, struct listinfo * list)
     if (!list->head)//if head is null, there is no list, so create one
     {
         list->head = list->tail = newentry;//this is the new head and tail
-        list->entries = newentry->index = 1;
+        list->entries = 1;
         newentry->next = NULL;
+        rolltotal = 0;//the tier now has entries, so testme() has to share out the rolls again
     }
     else//just appending to the list
     {
         list->tail->next = newentry;//adjust current tail to point to new entry
         list->tail = newentry;//make the new entry the new tail
-        newentry->index=++list->entries;
+        list->entries++;
         newentry->next = NULL;
     }
     //give the entry the appropriate 'known' level for this list (for calculating scores, and deducing which list its in without searching)
-    if (list==&n2l) newentry->known = 0;
-    else if (list==&norm) newentry->known = 1;
-    else if (list==&known) newentry->known = 2;
-    else if (list==&old) newentry->known = 3;
+    if (list>=newentry->deck->lists && list<newentry->deck->lists+numberoftiers) setlevel(newentry,list-newentry->deck->lists);
     else {popuperror("Unable to correctly add vocab entry to list!");return NULL;}
+    COUNTMETRIC(tierentries[list-newentry->deck->lists],1);
 
     return newentry;
 }
@@ -345,6 +1271,7 @@ int removefromlist(struct vocab * entry, struct listinfo * list,int freeup)
         if (list->tail == entry) //if entry is only item in the list
         {
             list->head = list->tail = NULL;
+            rolltotal = 0;
         }
         else //if first in list, but not last
         {
@@ -374,134 +1301,1528 @@ int removefromlist(struct vocab * entry, struct listinfo * list,int freeup)
         }
     }//this entry is now not pointed to in any list
     list->entries--;
+    COUNTMETRIC(tierentries[list-entry->deck->lists],-1);
     /*following line removed because it could theoretically break a list if the entry was removed from a list after it had been added to another
     entry->next = NULL;//and doesn't point to anything either*/
-    reindex(list);
-    if (freeup) //if freeup is set, this also wipes the record and frees up the memory associated with it
-    {
-        if(entry->question) free(entry->question);
-        if(entry->answer) free(entry->answer);
-        if(entry->info) free(entry->info);
-        if(entry->hint) free(entry->hint);
-        if(entry) free(entry);
-    }
+    if (freeup) freevocab(entry);//if freeup is set, this also wipes the record and frees up the memory associated with it
     return 1;
 }
 
-int unloaddatabase()
+void freevocab(struct vocab * entry)
 {
-    int l = 0,counter = 0;
-    struct vocab * entry;
-    struct listinfo * list; //assigned by switch with l, cycles through all the lists
-    for (;l<=3;l++)
+    if (!entry) return;
+    free(entry->matcher);
+    if (entry->deck) entry->deck->textversion++;
+    if (entry->deck && entry->deck->map) {free(entry);return;}//text and progress of a compiled deck belong to the mappings
+    if (entry->id>=0) entry->deck->status[entry->id] = 0;//slot no longer in use
+    if(entry->question) free(entry->question);
+    if(entry->answer) free(entry->answer);
+    if(entry->info) free(entry->info);
+    if(entry->hint) free(entry->hint);
+    free(entry);
+}
+
+unsigned int vocabhash(char * question, char * answer)
+{
+    unsigned int hash = 2166136261u;
+    while (*question) {hash ^= (unsigned char)*question++;hash *= 16777619u;}
+    hash ^= 0xff;hash *= 16777619u;//separator, so "ab"+"c" and "a"+"bc" don't collide
+    while (*answer) {hash ^= (unsigned char)*answer++;hash *= 16777619u;}
+    return hash;
+}
+
+void vocabtableinsert(struct vocabtable * table, struct vocab * entry)
+{
+    unsigned int i, slot, oldsize = table->size;
+    struct vocab ** oldslots = table->slots;
+    unsigned int * oldhashes = table->hashes;
+    if (2*(table->used+1) > table->size)//keep it under half full so probe sequences stay short
     {
-        switch (l)
-        {
-            case 0: {list = &n2l;break;}
-            case 1: {list = &norm;break;}
-            case 2: {list = &known;break;}
-            case 3: {list = &old;break;}
-            default: {popuperror("List pointer error!");return 0;}
-        }
-        while (list->head!=NULL)
+        table->size = table->size ? 2*table->size : 1024;
+        table->slots = (struct vocab **)calloc(table->size,sizeof(struct vocab *));
+        table->hashes = (unsigned int *)malloc(table->size*sizeof(unsigned int));
+        if (!table->slots||!table->hashes) outofmemory();
+        for (i=0;i<oldsize;i++)//move everything across to the bigger table
         {
-            entry = list->head;
-            removefromlist(entry,list,1);
-            counter++;
+            if (!oldslots[i]) continue;
+            slot = oldhashes[i] & (table->size-1);
+            while (table->slots[slot]) slot = (slot+1) & (table->size-1);
+            table->slots[slot] = oldslots[i];
+            table->hashes[slot] = oldhashes[i];
         }
+        free(oldslots);
+        free(oldhashes);
     }
-    sprintf(passingstring,"Unloaded %i entries from memory.",counter);
-    popupinfo(4,"",passingstring);
-    return 1;
+    i = vocabhash(entry->question,entry->answer);
+    slot = i & (table->size-1);
+    while (table->slots[slot]) slot = (slot+1) & (table->size-1);
+    table->slots[slot] = entry;
+    table->hashes[slot] = i;
+    table->used++;
 }
 
-void reindex (struct listinfo * list)
+struct vocab * vocabtablefind(struct vocabtable * table, struct vocab * entry)
 {
-    int counter = 1;
-    struct vocab * workingentry = list->head;
-    while (workingentry)
+    unsigned int hash, slot;
+    if (!table->size) return NULL;
+    hash = vocabhash(entry->question,entry->answer);
+    slot = hash & (table->size-1);
+    while (table->slots[slot])
     {
-        workingentry->index = counter++;
-        workingentry=workingentry->next;
+        if (table->hashes[slot]==hash && !strcmp(table->slots[slot]->question,entry->question) && !strcmp(table->slots[slot]->answer,entry->answer)) return table->slots[slot];
+        slot = (slot+1) & (table->size-1);
     }
-    if (list->entries!=counter-1) popuperror("Reindexing Error!");
+    return NULL;
 }
 
-void reloaddatabase()//optionally saves and unloads present database before loading another
+void buildvocabtable(struct vocabtable * table)
 {
-    if (getyesorno("Do you want to save your current vocab before loading another database?\nWARNING: Selecting no could lose all data since last save!!")) savedatabase();
-    if (getyesorno("Do you want to unload the current database from memory before loading a new one?\nIf you do not, the current database and the one you are loading will be merged,\nwhich could cause duplicates.")) unloaddatabase();
-    loaddatabase();
+    int i;
+    struct listinfo * list;
+    struct vocab * entry;
+    for (i=0;i<numberoftiers;i++)
+    {
+        list = levellist(currentdeck,i);
+        for (entry=list->head;entry;entry=entry->next) vocabtableinsert(table,entry);
+    }
 }
 
-void savedatabase()
+void freevocabtable(struct vocabtable * table)
 {
-    char * deffilename = DOUTPUTFILENAME;
-    char * outputfilename = (char *)malloc(MAXTEXTLENGTH+1);
-    WINDOW * wbsavedatabase, * wsavedatabase;
-    PANEL * psavedatabase;
-
-    wbsavedatabase = nicebigwindow();
-    psavedatabase = new_panel(wbsavedatabase);
-    windowtitle(wbsavedatabase,"Save Database");
-    wsavedatabase = innerwindow(wbsavedatabase);
+    free(table->slots);
+    free(table->hashes);
+    table->slots = NULL;
+    table->hashes = NULL;
+    table->size = table->used = 0;
+}
 
-    wprintw(wsavedatabase,"Saving...\n");
-    update_panels();
-    doupdate();
+int mergeprogress(struct vocab * existing, struct vocab * incoming, int incomingright, int incomingcounter, int incominglevel)
+{
+    int changed = 0;
+    int right = RIGHT(existing), counter = COUNTER(existing), level = KNOWN(existing);
+    switch (mergepolicy)
+    {
+        case MERGEKEEPHIGHER: //the better known of the two wins, and on a tie the longer run of right answers
+            if (incominglevel > level || (incominglevel==level && incomingright && (!right || incomingcounter > counter)))
+            {
+                right = incomingright;
+                counter = incomingcounter;
+                level = incominglevel;
+            }
+            break;
+        case MERGEKEEPNEWER:
+            right = incomingright;
+            counter = incomingcounter;
+            level = incominglevel;
+            break;
+        case MERGESUMSTREAKS: //two runs of right (or wrong) answers make one longer run, otherwise the newer run is the current one
+            if (incomingright==right) counter += incomingcounter;
+            else {right = incomingright;counter = incomingcounter;}
+            if (incominglevel > level) level = incominglevel;
+            break;
+    }
+    if (counter>MAXSTREAK) counter = MAXSTREAK;
+    if (right!=RIGHT(existing)||counter!=COUNTER(existing)||level!=KNOWN(existing)) changed = 1;
+    setprogress(existing,right,counter);
+    setlevel(existing,level);//it will be moved to the right list by sortintolists once loading has finished
+    //fill in any info or hint the loaded entry lacks, taking the text over rather than copying it
+    if (!vocabinfo(existing) && vocabinfo(incoming)) {existing->info = incoming->info;incoming->info = NULL;changed = 1;}
+    if (!vocabhint(existing) && vocabhint(incoming)) {existing->hint = incoming->hint;incoming->hint = NULL;changed = 1;}
+    return changed;
+}
 
-    if (!outputfilename) outofmemory();
-    strcpy(outputfilename,deffilename);
-    popupinfo(3,"WARNING:","If you provide a database filename that already exists, that database will be OVERWRITTEN!");
-    if (strcmp(outputfilename,currentfilename))
+void sortintolists(struct deck * deck)
+{
+    int i;
+    struct listinfo * list, * destination;
+    struct vocab * entry, * prev, * next, * movedhead = NULL, * movedtail = NULL;
+    for (i=0;i<numberoftiers;i++)//unlink every entry that's in the wrong list onto a temporary chain...
     {
-        sprintf(passingstring,"Save to most recently loaded database: %s?",currentfilename);
-        if(getyesorno(passingstring))
+        list = levellist(deck,i);
+        prev = NULL;
+        for (entry=list->head;entry;entry=next)
         {
-            strcpy(outputfilename,currentfilename);
+            next = entry->next;
+            if (KNOWN(entry)==i) {prev = entry;continue;}
+            if (prev) prev->next = next;
+            else list->head = next;
+            if (list->tail==entry) list->tail = prev;
+            list->entries--;
+            COUNTMETRIC(tierentries[i],-1);
+            entry->next = NULL;
+            if (movedtail) movedtail->next = entry;
+            else movedhead = entry;
+            movedtail = entry;
         }
     }
-    sprintf(passingstring,"Save to default database: %s? (y/n)",outputfilename);
-    if (!getyesorno(passingstring))//user specifies filename for database output
+    for (entry=movedhead;entry;entry=next)//...then append them to the lists they belong in
     {
-        wprintw(wsavedatabase,"A .~sv file will be saved to the filename you provide.\nPlease enter a name for the .~sv file:\n");
-        outputfilename=validfilename(wgettextfromkeyboard(wsavedatabase,outputfilename,MAXTEXTLENGTH),".~sv");
+        next = entry->next;
+        destination = levellist(deck,KNOWN(entry)<numberoftiers ? KNOWN(entry) : numberoftiers-1);
+        addtolist(entry,destination);
     }
-    if (!wwriteliststofile(wsavedatabase,outputfilename)) popuperror("Error while saving!!"); //print error message if wwriteliststofile returned 0
-    else changedflag = 0;
-    free(outputfilename);
-    getmaxyx(wsavedatabase,nlines,ncols);
-    mvwprintw(wsavedatabase,nlines-1,0,"Press any key to continue...");
-    wgetch(wsavedatabase);
-    delwin(wsavedatabase);
-    del_panel(psavedatabase);
-    delwin(wbsavedatabase);
-    return;
 }
 
-int wwriteliststofile(WINDOW * window,char * outputfilename)
+int unloaddatabase()
 {
-    int i,counter=0;
-    struct listinfo * list;
+    int l = 0,counter = 0;
     struct vocab * entry;
-    if (!(outputfile = fopen(outputfilename, "w")))
+    struct listinfo * list; //assigned by switch with l, cycles through all the lists
+    flushhistory(currentdeck);//keyed on the entries' text, so the history is still good if they're loaded again
+    for (;l<numberoftiers;l++)
     {
+        list = levellist(currentdeck,l);
+        while (list->head!=NULL)//the whole list is going, so free straight from the head rather than removing one at a time
+        {
+            entry = list->head;
+            list->head = entry->next;
+            freevocab(entry);
+            counter++;
+        }
+        list->tail = NULL;
+        COUNTMETRIC(tierentries[l],-list->entries);
+        list->entries = 0;
+    }
+    if (currentdeck->map) unmapdeck(currentdeck);
+    freetextindex(currentdeck);
+    unwatchdeck(currentdeck);
+    if (currentdeck->source) {fclose(currentdeck->source);currentdeck->source = NULL;currentdeck->unpackedsize = 0;}
+    currentdeck->numberofshifts = 0;
+    currentdeck->slots = 0;//every id is free again
+    currentdeck->changed = 0;//nothing left to save
+    sprintf(passingstring,"Unloaded %i entries from memory.",counter);
+    popupinfo(4,"",passingstring);
+    return 1;
+}
+
+struct deck * newdeck(char * filename)
+{
+    struct deck * deck;
+    if (numberofdecks==MAXDECKS) {popuperror("Too many decks open! Unload one first.");return NULL;}
+    if (!(deck = (struct deck *)calloc(1,sizeof(struct deck)))) outofmemory();
+    strncpy(deck->filename,filename,MAXTEXTLENGTH);
+    decks[numberofdecks++] = deck;
+    currentdeck = deck;
+    return deck;
+}
+
+void closedeck(struct deck * deck)
+{
+    int i, j;
+    struct deck * previousdeck = currentdeck;
+    currentdeck = deck;
+    unloaddatabase();
+    currentdeck = previousdeck;
+    for (i=0,j=0;i<numberofdecks;i++) if (decks[i]!=deck) decks[j++] = decks[i];
+    numberofdecks = j;
+    free(deck->status);
+    free(deck->streak);
+    free(deck->searchindex);
+    for (i=0;i<BROWSEORDERS;i++) free(deck->browseorders[i]);
+    freehistory(&deck->history);
+    free(deck);
+    if (currentdeck==deck) currentdeck = numberofdecks ? decks[0] : NULL;
+    if (!numberofdecks) newdeck(DOUTPUTFILENAME);//there is always a deck to load into
+}
+
+struct listinfo * levellist(struct deck * deck, int level)
+{
+    if (level<0 || level>=numberoftiers) {popuperror("List pointer error!");return &deck->lists[newtier];}
+    return &deck->lists[level];
+}
+
+int deckintest(struct deck * deck)
+{
+    int i;
+    if (deck->intest) return 1;
+    for (i=0;i<numberofdecks;i++) if (decks[i]->intest) return 0;
+    return deck==currentdeck;
+}
+
+int levelentries(int level)
+{
+    int i, entries = 0;
+    for (i=0;i<numberofdecks;i++) if (deckintest(decks[i])) entries += levellist(decks[i],level)->entries;
+    return entries;
+}
+
+struct vocab * selectentry(int level, int selector)
+{
+    int i;
+    struct listinfo * list;
+    struct vocab * entry;
+    for (i=0;i<numberofdecks;i++)
+    {
+        if (!deckintest(decks[i])) continue;
+        list = levellist(decks[i],level);
+        if (selector > list->entries) {selector -= list->entries;continue;}//it's in a later deck, skip this one without walking it
+        for (entry=list->head;entry && selector>1;entry=entry->next) selector--;//counted along the list, so entries need no numbers kept up to date as others come and go
+        return entry;
+    }
+    return NULL;
+}
+
+void movetolevel(struct vocab * entry, int from, int to)
+{
+    removefromlist(entry,levellist(entry->deck,from),0);//not KNOWN(entry)'s list, which another tester sharing the progress may have just changed
+    addtolist(entry,levellist(entry->deck,to));
+}
+
+int deckentries(struct deck * deck)
+{
+    int i, entries = 0;
+    for (i=0;i<numberoftiers;i++) entries += deck->lists[i].entries;
+    return entries;
+}
+
+void loadtiers(char * filename)
+{
+    //one tier per line, lowest first: weight, right answers to move up, wrong answers to move down, tier to move down to, no-repeat flag, then the name
+    //blank lines and lines starting with '#' are skipped, and a 'newentries' line gives the tier new entries go in
+    FILE * file;
+    struct tier newtiers[MAXTIERS];
+    char line[MAXTEXTLENGTH+1], * name;
+    int count = 0, newentries = 1, linenumber = 0, namestart, i;
+    if (!(file = fopen(filename,"r"))) return;//no file, keep the defaults
+    while (fgets(line,sizeof(line),file))
+    {
+        linenumber++;
+        line[strcspn(line,"\r\n")] = '\0';
+        for (name = line;isspace(*name);name++);
+        if (!*name || *name=='#') continue;
+        if (sscanf(name,"newentries %d",&newentries)==1) continue;
+        if (count==MAXTIERS) {sprintf(passingstring,"Too many tiers in %s, only the first %i are used.",filename,MAXTIERS);popuperror(passingstring);break;}
+        namestart = 0;
+        if (sscanf(name,"%d %d %d %d %d %n",&newtiers[count].weight,&newtiers[count].promoteafter,&newtiers[count].demoteafter,&newtiers[count].demoteto,&newtiers[count].norepeat,&namestart)<5 || !namestart
+            || newtiers[count].weight<0 || newtiers[count].weight>MAXTIERWEIGHT || newtiers[count].promoteafter<0 || newtiers[count].demoteafter<0 || newtiers[count].demoteto<0)
+        {
+            sprintf(passingstring,"Line %i of %s isn't a valid tier, so the default tiers are being used.\nExpected: weight (0-%i), right answers to move up, wrong answers to move down, tier to move down to, no-repeat (0 or 1), name",linenumber,filename,MAXTIERWEIGHT);
+            popuperror(passingstring);
+            fclose(file);
+            return;
+        }
+        strncpy(newtiers[count].name,name+namestart,MAXTIERNAME);
+        newtiers[count].name[MAXTIERNAME] = '\0';
+        newtiers[count].upmessage = newtiers[count].downmessage = NULL;
+        count++;
+    }
+    fclose(file);
+    for (i=0;i<count;i++) if (newtiers[i].demoteto>=count) break;
+    if (count<2 || i<count || newentries<0 || newentries>=count)
+    {
+        sprintf(passingstring,"%s needs at least two tiers, and every tier number in it has to be one of them.\nThe default tiers are being used.",filename);
+        popuperror(passingstring);
+        return;
+    }
+    memcpy(tiers,newtiers,sizeof(newtiers));
+    numberoftiers = count;
+    newtier = newentries;
+}
+
+void buildrolltable()
+{
+    int i, tierentries[MAXTIERS];
+    for (i=0;i<numberoftiers;i++) tierentries[i] = levelentries(i);
+    rolltotal = fillrolltable(rolltable,tierentries);
+}
+
+int fillrolltable(int * table, int * tierentries)
+{
+    int i, j, total = 0;
+    for (i=0;i<numberoftiers;i++) if (tierentries[i]) for (j=0;j<tiers[i].weight;j++) table[total++] = i;
+    if (total) return total;
+    for (i=0;i<numberoftiers;i++) if (tierentries[i]) table[total++] = i;//only tiers with no weight have entries, so draw from them evenly
+    return total;
+}
+
+int choosetier(uint64_t * state, int * table, int total, int * blocked, int newtierentries)
+{
+    int level = table[randombelow(state,total)];
+    if ((*blocked & 1<<level) && newtierentries) level = newtier;//use the new entries' tier instead of repeating this one
+    if (level==newtier) *blocked = 0;//only drawing from the new entries' tier lets a norepeat tier come up again, as the 'need to learn' list always worked
+    else if (tiers[level].norepeat) *blocked |= 1<<level;
+    return level;
+}
+
+int newprogressslot(struct deck * deck)
+{
+    if (deck->slots==deck->capacity)//double the arrays when they fill up
+    {
+        deck->capacity = deck->capacity ? 2*deck->capacity : 1024;
+        deck->status = (unsigned char *)realloc(deck->status,deck->capacity);
+        deck->streak = (unsigned char *)realloc(deck->streak,deck->capacity);
+        if (!deck->status||!deck->streak) outofmemory();
+    }
+    deck->textversion++;
+    deck->status[deck->slots] = LIVEBIT|newtier;
+    deck->streak[deck->slots] = 0;
+    return deck->slots++;
+}
+
+void setprogress(struct vocab * entry, int right, int counter)
+{
+    unsigned char * status = &entry->deck->status[entry->id], * streak = &entry->deck->streak[entry->id];
+    int changed = 0;
+    if (counter>MAXSTREAK) counter = MAXSTREAK;
+    //only write when something has changed, so untouched pages of a mapped progress file stay clean
+    if (!right != !(__atomic_load_n(status,__ATOMIC_RELAXED)&RIGHTBIT))
+    {
+        //just the one bit, so a level being set by another tester at the same moment isn't lost
+        if (right) __atomic_fetch_or(status,RIGHTBIT,__ATOMIC_RELAXED);
+        else __atomic_fetch_and(status,(unsigned char)~RIGHTBIT,__ATOMIC_RELAXED);
+        changed = 1;
+    }
+    if (__atomic_load_n(streak,__ATOMIC_RELAXED)!=counter) {__atomic_store_n(streak,counter,__ATOMIC_RELAXED);changed = 1;}
+    if (changed) noteprogresschange(entry->deck);
+}
+
+void setlevel(struct vocab * entry, int level)
+{
+    unsigned char * status = &entry->deck->status[entry->id], old = __atomic_load_n(status,__ATOMIC_RELAXED);
+    do if ((old&(LIVEBIT|KNOWNMASK))==(LIVEBIT|(level&KNOWNMASK))) return;
+    while (!__atomic_compare_exchange_n(status,&old,(old&~KNOWNMASK)|LIVEBIT|(level&KNOWNMASK),0,__ATOMIC_RELAXED,__ATOMIC_RELAXED));//retried if another tester changed the right bit meanwhile
+    noteprogresschange(entry->deck);
+}
+
+void noteprogresschange(struct deck * deck)
+{
+    if (!deck->progressmap) return;
+    //if nobody else has updated it since this tester last did, the count stays in step. Otherwise the difference is left for checksharedprogress() to find
+    if (__atomic_fetch_add(&deck->progressmap->changes,1,__ATOMIC_RELEASE)==deck->progresschanges) deck->progresschanges++;
+}
+
+void checksharedprogress()
+{
+    int d;
+    unsigned int changes;
+    for (d=0;d<numberofdecks;d++)
+    {
+        if (!decks[d]->progressmap || (changes = __atomic_load_n(&decks[d]->progressmap->changes,__ATOMIC_ACQUIRE))==decks[d]->progresschanges) continue;
+        decks[d]->progresschanges = changes;
+        sortintolists(decks[d]);//other testers' answers have moved entries between tiers
+        rolltotal = 0;
+    }
+}
+
+struct vocab * findentrybyid(struct deck * deck, int id)
+{
+    int i;
+    struct vocab * entry;
+    for (i=0;i<numberoftiers;i++) for (entry=levellist(deck,i)->head;entry;entry=entry->next) if (entry->id==id) return entry;
+    return NULL;
+}
+
+int wmapdeck(WINDOW * window,char * deckfilename)
+{
+    int fd, i, exclusive;
+    struct stat filestats;
+    struct deckheader * header;
+    struct deckrecord * records;
+    char * pool, * progressfilename, magic[4];
+    unsigned char * arrays;
+    struct vocab * newvocab;
+    size_t progresssize;
+    struct deck * deck = currentdeck;
+    struct timespec started;
+
+    clock_gettime(CLOCK_MONOTONIC,&started);
+    if (deck->map || deckentries(deck))
+    {
+        popuperror("A compiled deck can only be opened into an empty deck.\nUse the Decks menu to open it alongside the one already loaded.");
+        return 0;
+    }
+    if ((fd = open(deckfilename,O_RDONLY))<0 || fstat(fd,&filestats)<0)
+    {
+        if (fd>=0) close(fd);
+        sprintf(passingstring,"Unable to read compiled deck: '%s'. File does not exist or is in use.",deckfilename);
+        popuperror(passingstring);
+        return 0;
+    }
+    if (window) wprintw(window,"Mapping compiled deck %s...\n",deckfilename);
+    deck->mapsize = filestats.st_size;
+    if (deck->mapsize<sizeof(struct deckheader) || (deck->map = (char *)mmap(NULL,deck->mapsize,PROT_READ,MAP_SHARED,fd,0))==MAP_FAILED)
+    {
+        close(fd);
+        deck->map = NULL;
+        popuperror("Unable to map compiled deck!");
+        return 0;
+    }
+    close(fd);//the mapping stays valid without the descriptor
+    deck->textversion++;
+    header = (struct deckheader *)deck->map;
+    records = (struct deckrecord *)(deck->map+sizeof(struct deckheader));
+    pool = (char *)(records+header->entries);
+    //check the file is what it says it is, so that no offset can point outside the mapping
+    if (memcmp(header->magic,"VTD2",4) || deck->mapsize != sizeof(struct deckheader)+(size_t)header->entries*sizeof(struct deckrecord)+header->poolsize || (header->poolsize && pool[header->poolsize-1]!='\0'))
+    {
+        unmapdeck(deck);
+        sprintf(passingstring,"'%s' is not a valid compiled deck!",deckfilename);
+        popuperror(passingstring);
+        return 0;
+    }
+    for (i=0;i<header->entries;i++)
+    {
+        if (records[i].question>=header->poolsize || records[i].answer>=header->poolsize || (records[i].extra!=NOOFFSET && (records[i].extra>=header->poolsize || records[i].extra+strlen(pool+records[i].extra)+1>=header->poolsize)))
+        {
+            unmapdeck(deck);
+            sprintf(passingstring,"Compiled deck '%s' is corrupt (record %i)!",deckfilename,i);
+            popuperror(passingstring);
+            return 0;
+        }
+    }
+
+    //progress lives in a separate small file next to the deck, which is created if it doesn't exist yet
+    if (!(progressfilename = (char *)malloc(MAXTEXTLENGTH+1))) outofmemory();
+    strcpy(progressfilename,deckfilename);
+    validfilename(progressfilename,".vtp");
+    progresssize = sizeof(struct progressheader)+2*(size_t)header->entries;
+    //every tester with the file mapped holds a shared lock on it, so it's only ever created or resized under an exclusive one, when nobody else has it
+    if ((fd = openprogressfile(progressfilename))<0 || flock(fd,LOCK_SH)<0 || fstat(fd,&filestats)<0)
+    {
+        if (fd>=0) close(fd);
+        sprintf(passingstring,"Unable to open progress file '%s'!",progressfilename);
+        popuperror(passingstring);
+        free(progressfilename);
+        unmapdeck(deck);
+        return 0;
+    }
+    if ((exclusive = (filestats.st_size!=progresssize)))
+    {
+        if (flock(fd,LOCK_EX|LOCK_NB)<0)
+        {
+            close(fd);
+            sprintf(passingstring,"Progress file '%s' doesn't match its deck, and is in use by another tester!",progressfilename);
+            popuperror(passingstring);
+            free(progressfilename);
+            unmapdeck(deck);
+            return 0;
+        }
+        if (!fstat(fd,&filestats) && filestats.st_size==progresssize-sizeof(unsigned int) && pread(fd,magic,4,0)==4 && !memcmp(magic,"VTP2",4))
+        {
+            //the same arrays as before, after a header that has since grown by the changes count
+            if (!(arrays = (unsigned char *)malloc(2*(size_t)header->entries+1))) outofmemory();
+            if (pread(fd,arrays,2*(size_t)header->entries,sizeof(struct progressheader)-sizeof(unsigned int))!=2*(ssize_t)header->entries || ftruncate(fd,progresssize)<0 || pwrite(fd,arrays,2*(size_t)header->entries,sizeof(struct progressheader))!=2*(ssize_t)header->entries) filestats.st_size = -1;
+            free(arrays);
+        }
+        else if (filestats.st_size!=progresssize)
+        {
+            if (filestats.st_size)
+            {
+                sprintf(passingstring,"Progress file '%s' doesn't match its deck, so progress has been reset.",progressfilename);
+                popuperror(passingstring);
+            }
+            if (ftruncate(fd,0)<0 || ftruncate(fd,progresssize)<0) filestats.st_size = -1;
+            else filestats.st_size = 0;//fill in the new records once mapped
+        }
+        if (filestats.st_size<0)
+        {
+            close(fd);
+            free(progressfilename);
+            unmapdeck(deck);
+            popuperror("Unable to create progress file!");
+            return 0;
+        }
+    }
+    deck->progressmapsize = progresssize;
+    if ((deck->progressmap = (struct progressheader *)mmap(NULL,progresssize,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0))==MAP_FAILED)
+    {
+        close(fd);
+        free(progressfilename);
+        deck->progressmap = NULL;
+        unmapdeck(deck);
+        popuperror("Unable to map progress file!");
+        return 0;
+    }
+    deck->progressfd = fd;//kept open, as closing it would give up the lock
+    deck->status = (unsigned char *)(deck->progressmap+1);
+    deck->streak = deck->status+header->entries;
+    deck->slots = header->entries;
+    deck->capacity = 0;
+    if (exclusive)
+    {
+        if (!filestats.st_size) memset(deck->status,LIVEBIT|1,header->entries);
+        memcpy(deck->progressmap->magic,"VTP3",4);
+        deck->progressmap->entries = header->entries;
+        deck->progressmap->changes = 0;
+        flock(fd,LOCK_SH);//filled in, so others can share it now
+    }
+    deck->progresschanges = __atomic_load_n(&deck->progressmap->changes,__ATOMIC_ACQUIRE);
+    wprintw(window,"Using progress file %s.\n",progressfilename);
+    free(progressfilename);
+
+    //each entry's text is used straight from the mapping, only the list nodes are allocated
+    for (i=0;i<header->entries;i++)
+    {
+        if (!(newvocab = (struct vocab *)malloc(sizeof(struct vocab)))) outofmemory();
+        newvocab->matcher = NULL;
+        newvocab->questionwidth = newvocab->answerwidth = 0;
+        newvocab->latency = 0;
+        newvocab->deck = deck;
+        newvocab->id = i;
+        newvocab->question = pool+records[i].question;
+        newvocab->answer = pool+records[i].answer;
+        newvocab->info = newvocab->hint = NULL;
+        newvocab->lazy = 0;//text is already to hand in the mapping, and only paged in when used
+        if (records[i].extra!=NOOFFSET)
+        {
+            if (pool[records[i].extra]) newvocab->info = pool+records[i].extra;
+            if (pool[records[i].extra+strlen(pool+records[i].extra)+1]) newvocab->hint = pool+records[i].extra+strlen(pool+records[i].extra)+1;
+        }
+        addtolist(newvocab,levellist(deck,KNOWN(newvocab)<numberoftiers ? KNOWN(newvocab) : numberoftiers-1));
+    }
+    wprintw(window,"...finished.\n%i entries mapped from %s.\n\n",header->entries,deckfilename);
+    countduration(&metrics.loads,&metrics.loadmicroseconds,&started);
+    return 1;
+}
+
+void unmapdeck(struct deck * deck)
+{
+    if (deck->progressmap)
+    {
+        msync(deck->progressmap,deck->progressmapsize,MS_SYNC);
+        munmap(deck->progressmap,deck->progressmapsize);
+        close(deck->progressfd);//and with it the lock
+    }
+    if (deck->map) munmap(deck->map,deck->mapsize);
+    deck->map = NULL;
+    deck->progressmap = NULL;
+    deck->status = deck->streak = NULL;//these pointed into the progress mapping
+    deck->slots = deck->capacity = 0;
+    deck->mapsize = deck->progressmapsize = 0;
+}
+
+int openprogressfile(char * progressfilename)
+{
+    int fd, tries;
+    //only one tester can create the file, and one that loses the race opens the file the other has just created
+    for (tries=0;tries<PROGRESSOPENTRIES;tries++)
+    {
+        if ((fd = open(progressfilename,O_RDWR))>=0 || errno!=ENOENT) return fd;
+        if ((fd = open(progressfilename,O_RDWR|O_CREAT|O_EXCL,0644))>=0 || errno!=EEXIST) return fd;
+    }
+    return -1;
+}
+
+int wcompiledeck(WINDOW * window,char * deckfilename)
+{
+    int i, fd, counter = 0, inuse;
+    struct stat target, mapped;
+    FILE * progressfile;
+    char * progressfilename;
+    unsigned char * status, * streak;
+    struct deckheader header;
+    struct deckrecord record;
+    struct progressheader progressheader;
+    struct vocab * entry;
+    unsigned int offset = 0;
+    struct timespec started;
+
+    clock_gettime(CLOCK_MONOTONIC,&started);
+    if (!(progressfilename = (char *)malloc(MAXTEXTLENGTH+1))) outofmemory();
+    strcpy(progressfilename,deckfilename);
+    validfilename(progressfilename,".vtp");
+    //a tester with the deck mapped holds a shared lock on its progress file, and rewriting the files under it would pull its mappings away
+    if ((fd = openprogressfile(progressfilename))<0 || flock(fd,LOCK_EX|LOCK_NB)<0)
+    {
+        if ((inuse = fd>=0 && errno==EWOULDBLOCK))//the lock may well be this tester's own, held on its own descriptor of the file
+        {
+            for (i=0;i<numberofdecks && inuse==1;i++) if (decks[i]->progressmap && !fstat(fd,&target) && !fstat(decks[i]->progressfd,&mapped) && target.st_dev==mapped.st_dev && target.st_ino==mapped.st_ino) inuse = 2;
+        }
+        if (fd>=0) close(fd);
+        free(progressfilename);
+        if (inuse==2) popuperror("That compiled deck is loaded in this tester, so it can't be rewritten! Close or unload it first.");
+        else popuperror(inuse ? "That compiled deck is open in another tester, so it can't be rewritten!" : "Error accessing progress file!");
+        return 0;
+    }
+    if (ftruncate(fd,0)<0 || !(progressfile = fdopen(fd,"wb")))//the lock is held until the file is closed
+    {
+        close(fd);
+        free(progressfilename);
+        popuperror("Error accessing progress file!");
+        return 0;
+    }
+    if (!(outputfile = fopen(deckfilename,"wb")))
+    {
+        fclose(progressfile);
+        free(progressfilename);
+        popuperror("Error accessing compiled deck file!");
+        return 0;
+    }
+    materializedeck(currentdeck);
+    wprintw(window,"Compiling...\n");
+    memcpy(header.magic,"VTD2",4);
+    header.entries = 0;
+    for (i=0;i<numberoftiers;i++) header.entries += levellist(currentdeck,i)->entries;
+    header.poolsize = 0;
+    fwrite(&header,sizeof(header),1,outputfile);//rewritten once the pool size is known
+    status = (unsigned char *)malloc(header.entries+1);
+    streak = (unsigned char *)malloc(header.entries+1);
+    if (!status||!streak) outofmemory();
+    for (i=0;i<numberoftiers;i++)//records first, working out where each string will go in the pool...
+    {
+        for (entry=levellist(currentdeck,i)->head;entry;entry=entry->next)
+        {
+            record.question = offset;offset += strlen(entry->question)+1;
+            record.answer = offset;offset += strlen(entry->answer)+1;
+            if (entry->info || entry->hint)
+            {
+                record.extra = offset;
+                offset += (entry->info ? strlen(entry->info) : 0)+1;
+                offset += (entry->hint ? strlen(entry->hint) : 0)+1;
+            }
+            else record.extra = NOOFFSET;
+            fwrite(&record,sizeof(record),1,outputfile);
+            status[counter] = LIVEBIT|(RIGHT(entry) ? RIGHTBIT : 0)|i;
+            streak[counter] = COUNTER(entry);
+            counter++;
+        }
+    }
+    for (i=0;i<numberoftiers;i++)//...then the pool itself, in the same order
+    {
+        for (entry=levellist(currentdeck,i)->head;entry;entry=entry->next)
+        {
+            fwrite(entry->question,strlen(entry->question)+1,1,outputfile);
+            fwrite(entry->answer,strlen(entry->answer)+1,1,outputfile);
+            if (entry->info || entry->hint)
+            {
+                if (entry->info) fputs(entry->info,outputfile);
+                fputc('\0',outputfile);
+                if (entry->hint) fputs(entry->hint,outputfile);
+                fputc('\0',outputfile);
+            }
+        }
+    }
+    header.poolsize = offset;
+    rewind(outputfile);
+    fwrite(&header,sizeof(header),1,outputfile);
+    memcpy(progressheader.magic,"VTP3",4);
+    progressheader.entries = header.entries;
+    progressheader.changes = 0;
+    fwrite(&progressheader,sizeof(progressheader),1,progressfile);
+    fwrite(status,1,counter,progressfile);
+    fwrite(streak,1,counter,progressfile);
+    free(status);
+    free(streak);
+    i = ferror(outputfile) || ferror(progressfile);
+    fclose(outputfile);
+    fclose(progressfile);
+    if (i)
+    {
+        free(progressfilename);
+        popuperror("Error while writing compiled deck!");
+        return 0;
+    }
+    wprintw(window,"...finished. %i entries compiled to %s, progress saved to %s\n",counter,deckfilename,progressfilename);
+    free(progressfilename);
+    countduration(&metrics.saves,&metrics.savemicroseconds,&started);
+    return 1;
+}
+
+size_t packblock(unsigned char * source, size_t length, unsigned char * target)
+{
+    unsigned int table[1<<PACKHASHBITS], sequence, hash;
+    unsigned char * in = source, * end = source+length, * literal = source, * out = target, * match, * token;
+    size_t run, matchlength;
+
+    memset(table,0,sizeof(table));
+    //each sequence is a token (literal count in the top four bits, match length in the bottom four, 15 meaning more follow in bytes),
+    //the literals, then where the match starts, counting back. The last few bytes are always literals, so the last sequence has no match
+    while (in+PACKMINMATCH+8<=end)
+    {
+        memcpy(&sequence,in,4);
+        hash = (sequence*2654435761u)>>(32-PACKHASHBITS);
+        match = source+table[hash];
+        table[hash] = in-source;
+        if (match>=in || in-match>65535 || memcmp(match,in,4)) {in++;continue;}
+        for (matchlength=PACKMINMATCH;in+matchlength<end && match[matchlength]==in[matchlength];matchlength++);
+        token = out++;
+        run = in-literal;
+        *token = (run<15 ? run : 15)<<4;
+        if (run>=15) {for (run-=15;run>=255;run-=255) *out++ = 255;*out++ = run;}
+        memcpy(out,literal,in-literal);
+        out += in-literal;
+        *out++ = (in-match)&255;
+        *out++ = (in-match)>>8;
+        run = matchlength-PACKMINMATCH;
+        *token |= run<15 ? run : 15;
+        if (run>=15) {for (run-=15;run>=255;run-=255) *out++ = 255;*out++ = run;}
+        in += matchlength;
+        literal = in;
+    }
+    token = out++;
+    run = end-literal;
+    *token = (run<15 ? run : 15)<<4;
+    if (run>=15) {for (run-=15;run>=255;run-=255) *out++ = 255;*out++ = run;}
+    memcpy(out,literal,end-literal);
+    return out+(end-literal)-target;
+}
+
+int unpackblock(unsigned char * source, size_t length, unsigned char * target, size_t rawsize)
+{
+    unsigned char * in = source, * end = source+length, * out = target, * outend = target+rawsize, * match;
+    size_t run, offset, i;
+    unsigned int token;
+    //every count and offset is checked against what's left, so a corrupt block can't write outside target
+    while (in<end)
+    {
+        token = *in++;
+        run = token>>4;
+        if (run==15) do {if (in>=end) return 0;run += *in;} while (*in++==255);
+        if (run>(size_t)(end-in) || run>(size_t)(outend-out)) return 0;
+        memcpy(out,in,run);
+        in += run;
+        out += run;
+        if (in==end) break;//the last sequence, with no match
+        if (end-in<2) return 0;
+        offset = in[0]|(in[1]<<8);
+        in += 2;
+        run = token&15;
+        if (run==15) do {if (in>=end) return 0;run += *in;} while (*in++==255);
+        run += PACKMINMATCH;
+        if (!offset || offset>(size_t)(out-target) || run>(size_t)(outend-out)) return 0;
+        match = out-offset;
+        if (offset>=run) memcpy(out,match,run);
+        else for (i=0;i<run;i++) out[i] = match[i];//overlapping, repeating the last offset bytes
+        out += run;
+    }
+    return out==outend;
+}
+
+FILE * openpacked(char * filename, struct packedfile ** result)
+{
+    struct packedfile * packed;
+    struct packheader header;
+    struct stat filestats;
+    cookie_io_functions_t functions = {readpacked,NULL,seekpacked,closepacked};
+    FILE * stream;
+    size_t offset;
+    int fd, i;
+
+    if ((fd = open(filename,O_RDONLY))<0) return NULL;
+    if (fstat(fd,&filestats)<0 || filestats.st_size<4) {close(fd);return NULL;}
+    if (!(packed = (struct packedfile *)calloc(1,sizeof(struct packedfile)))) outofmemory();
+    packed->memfd = -1;
+    packed->mapsize = filestats.st_size;
+    packed->map = (unsigned char *)mmap(NULL,packed->mapsize,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if (packed->map==MAP_FAILED || memcmp(packed->map,"VTZ1",4)) goto failed;
+    //one pass over the block headers to count them, and another to note where each one's text goes
+    for (offset=4;offset+sizeof(header)<=packed->mapsize;offset+=sizeof(header)+header.packedsize,packed->blocks++)
+    {
+        memcpy(&header,packed->map+offset,sizeof(header));
+        if (header.packedsize>header.rawsize || header.rawsize>PACKBLOCKSIZE) goto failed;
+    }
+    if (offset!=packed->mapsize) goto failed;
+    packed->rawstarts = (size_t *)malloc((packed->blocks+1)*sizeof(size_t));
+    packed->packedstarts = (size_t *)malloc((packed->blocks+1)*sizeof(size_t));
+    packed->done = (unsigned char *)calloc(packed->blocks+1,1);
+    if (!packed->rawstarts || !packed->packedstarts || !packed->done) outofmemory();
+    for (i=0,offset=4;i<packed->blocks;i++,offset+=sizeof(header)+header.packedsize)
+    {
+        memcpy(&header,packed->map+offset,sizeof(header));
+        packed->packedstarts[i] = offset;
+        packed->rawstarts[i] = packed->size;
+        packed->size += header.rawsize;
+    }
+    packed->rawstarts[i] = packed->size;
+    //the text goes in a file in memory, so that once it's all unpacked the deck can read it like any other source file.
+    //It has a fixed name, as memfd_create() fails with EINVAL for a name longer than 249 bytes
+    if ((packed->memfd = memfd_create("vtz",MFD_CLOEXEC))<0 || ftruncate(packed->memfd,packed->size)<0) goto failed;
+    if (packed->size && (packed->text = (char *)mmap(NULL,packed->size,PROT_READ|PROT_WRITE,MAP_SHARED,packed->memfd,0))==MAP_FAILED) {packed->text = NULL;goto failed;}
+    if (!(stream = fopencookie(packed,"r",functions))) goto failed;
+    setvbuf(stream,NULL,_IOFBF,CSVBLOCKSIZE);
+    pthread_mutex_init(&packed->lock,NULL);
+    pthread_cond_init(&packed->unpackedblock,NULL);
+    packed->numberofthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (packed->numberofthreads>MAXUNPACKTHREADS) packed->numberofthreads = MAXUNPACKTHREADS;
+    if (packed->numberofthreads>packed->blocks) packed->numberofthreads = packed->blocks;
+    for (i=0;i<packed->numberofthreads;i++) if (pthread_create(&packed->threads[i],NULL,unpackblocks,packed)) break;
+    packed->numberofthreads = i;
+    if (!i) unpackblocks(packed);//no threads to be had, so it's all unpacked before reading starts
+    *result = packed;
+    return stream;
+
+    failed:
+    if (packed->text) munmap(packed->text,packed->size);
+    if (packed->memfd>=0) close(packed->memfd);
+    if (packed->map!=MAP_FAILED) munmap(packed->map,packed->mapsize);
+    free(packed->rawstarts);
+    free(packed->packedstarts);
+    free(packed->done);
+    free(packed);
+    return NULL;
+}
+
+FILE * createpacked(FILE * file)
+{
+    struct packedfile * packed;
+    cookie_io_functions_t functions = {NULL,writepacked,NULL,closepacked};
+    FILE * stream;
+    if (!(packed = (struct packedfile *)calloc(1,sizeof(struct packedfile)))) outofmemory();
+    packed->file = file;
+    packed->block = (unsigned char *)malloc(PACKBLOCKSIZE);
+    packed->packed = (unsigned char *)malloc(PACKBLOCKSIZE+PACKBLOCKSIZE/255+16);
+    if (!packed->block || !packed->packed) outofmemory();
+    if (fwrite("VTZ1",4,1,file)!=1 || !(stream = fopencookie(packed,"w",functions)))
+    {
+        free(packed->block);
+        free(packed->packed);
+        free(packed);
+        fclose(file);//the stream would have owned it, so the caller has nothing left to close
+        return NULL;
+    }
+    return stream;
+}
+
+FILE * finishunpacking(FILE * stream, struct packedfile * packed)
+{
+    int fd = dup(packed->memfd);
+    FILE * file;
+    fclose(stream);
+    if (fd<0 || !(file = fdopen(fd,"r"))) outofmemory();
+    return file;
+}
+
+void * unpackblocks(void * arg)
+{
+    struct packedfile * packed = (struct packedfile *)arg;
+    struct packheader header;
+    unsigned char * data;
+    int i, unpacked;
+    while ((i = __atomic_fetch_add(&packed->nextblock,1,__ATOMIC_RELAXED))<packed->blocks)
+    {
+        memcpy(&header,packed->map+packed->packedstarts[i],sizeof(header));
+        data = packed->map+packed->packedstarts[i]+sizeof(header);
+        if (header.packedsize==header.rawsize) {memcpy(packed->text+packed->rawstarts[i],data,header.rawsize);unpacked = 1;}
+        else unpacked = unpackblock(data,header.packedsize,(unsigned char *)packed->text+packed->rawstarts[i],header.rawsize);
+        if (unpacked && (unsigned int)linehash(packed->text+packed->rawstarts[i],header.rawsize)!=header.check) unpacked = 0;
+        pthread_mutex_lock(&packed->lock);
+        packed->done[i] = unpacked ? 1 : 2;
+        while (packed->unpacked<packed->blocks && packed->done[packed->unpacked]==1) packed->unpacked++;
+        pthread_cond_broadcast(&packed->unpackedblock);
+        pthread_mutex_unlock(&packed->lock);
+    }
+    return NULL;
+}
+
+ssize_t readpacked(void * cookie, char * buffer, size_t size)
+{
+    struct packedfile * packed = (struct packedfile *)cookie;
+    size_t available;
+    pthread_mutex_lock(&packed->lock);
+    while (packed->unpacked<packed->blocks && packed->rawstarts[packed->unpacked]<=packed->position && packed->done[packed->unpacked]!=2) pthread_cond_wait(&packed->unpackedblock,&packed->lock);
+    available = packed->rawstarts[packed->unpacked]>packed->position ? packed->rawstarts[packed->unpacked]-packed->position : 0;//nothing at the end, or at a corrupt block
+    pthread_mutex_unlock(&packed->lock);
+    if (size>available) size = available;
+    memcpy(buffer,packed->text+packed->position,size);
+    packed->position += size;
+    return size;
+}
+
+ssize_t writepacked(void * cookie, const char * buffer, size_t size)
+{
+    struct packedfile * packed = (struct packedfile *)cookie;
+    size_t written = 0, run;
+    while (written<size)
+    {
+        run = PACKBLOCKSIZE-packed->length<size-written ? PACKBLOCKSIZE-packed->length : size-written;
+        memcpy(packed->block+packed->length,buffer+written,run);
+        packed->length += run;
+        written += run;
+        if (packed->length==PACKBLOCKSIZE && !flushpacked(packed)) return 0;
+    }
+    return size;
+}
+
+int seekpacked(void * cookie, off64_t * offset, int whence)
+{
+    struct packedfile * packed = (struct packedfile *)cookie;
+    off64_t position = *offset;
+    if (whence==SEEK_CUR) position += packed->position;
+    else if (whence==SEEK_END) position += packed->size;
+    if (position<0) return -1;
+    packed->position = *offset = position;
+    return 0;
+}
+
+int closepacked(void * cookie)
+{
+    struct packedfile * packed = (struct packedfile *)cookie;
+    char message[80];//not passingstring, which the caller may be in the middle of using
+    int i, failed = 0;
+    if (packed->file)
+    {
+        if (packed->length) failed = !flushpacked(packed);
+        failed |= fclose(packed->file)!=0;
+        free(packed->block);
+        free(packed->packed);
+        free(packed);
+        return failed ? EOF : 0;
+    }
+    __atomic_store_n(&packed->nextblock,packed->blocks,__ATOMIC_RELAXED);//blocks no thread has started on are left
+    for (i=0;i<packed->numberofthreads;i++) pthread_join(packed->threads[i],NULL);
+    if (packed->unpacked<packed->blocks && packed->done[packed->unpacked]==2)
+    {
+        sprintf(message,"Block %i of a compressed deck is corrupt, so nothing after it was read.",packed->unpacked);
+        popuperror(message);
+    }
+    pthread_mutex_destroy(&packed->lock);
+    pthread_cond_destroy(&packed->unpackedblock);
+    if (packed->text) munmap(packed->text,packed->size);
+    close(packed->memfd);
+    munmap(packed->map,packed->mapsize);
+    free(packed->rawstarts);
+    free(packed->packedstarts);
+    free(packed->done);
+    free(packed);
+    return 0;
+}
+
+int flushpacked(struct packedfile * packed)
+{
+    struct packheader header;
+    header.rawsize = packed->length;
+    header.check = linehash((char *)packed->block,packed->length);
+    header.packedsize = packblock(packed->block,packed->length,packed->packed);
+    if (header.packedsize>=header.rawsize) header.packedsize = header.rawsize;//stored as it is, as packing didn't help
+    fwrite(&header,sizeof(header),1,packed->file);
+    fwrite(header.packedsize==header.rawsize ? packed->block : packed->packed,1,header.packedsize,packed->file);
+    packed->length = 0;
+    return !ferror(packed->file);
+}
+
+void reloaddatabase()//optionally saves and unloads present database before loading another
+{
+    char * mergechoices[] =
+    {
+        "Keep the progress of whichever copy is known better",
+        "Keep the progress from the database being loaded",
+        "Add the streaks of both copies together",
+        "Keep both copies (no duplicate checking)"
+    };
+    int mergepolicies[] = {MERGEKEEPHIGHER,MERGEKEEPNEWER,MERGESUMSTREAKS,MERGENONE};
+    if (getyesorno("Do you want to save your current vocab before loading another database?\nWARNING: Selecting no could lose all data since last save!!")) savedatabase();
+    if (currentdeck->map)
+    {
+        popupinfo(4,"","The current deck is a read-only compiled deck, so nothing can be merged into it.\nIt will be unloaded (its progress is already saved).\nUse the Decks menu to load another deck alongside it.");
+        unloaddatabase();
+    }
+    else if (getyesorno("Do you want to unload the current database from memory before loading a new one?\nIf you do not, the current database and the one you are loading will be merged.")) unloaddatabase();
+    else mergepolicy = mergepolicies[getchoice("Entries with the same question and answer as one already loaded are duplicates.\nWhat should happen to their progress?",mergechoices,ARRAY_SIZE(mergechoices))];
+    loaddatabase();
+    mergepolicy = MERGENONE;
+}
+
+void watchdeck(struct deck * deck, char * filename)
+{
+    char directory[MAXTEXTLENGTH+1], * slash;
+    struct vocab * entry;
+    int i, low, high, middle;
+    unwatchdeck(deck);
+    if (watchfd<0 && (watchfd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC))<0) return;//not being able to watch only means changes aren't picked up
+    strncpy(directory,filename,MAXTEXTLENGTH);
+    directory[MAXTEXTLENGTH] = '\0';
+    if ((slash = strrchr(directory,'/'))) *(slash>directory ? slash : slash+1) = '\0';
+    else strcpy(directory,".");
+    //the directory is watched rather than the file, as editors often save by writing a new file and renaming it over the old one
+    if ((deck->watch = inotify_add_watch(watchfd,directory,IN_CLOSE_WRITE|IN_MOVED_TO))<0) {deck->watch = 0;return;}
+    strncpy(deck->watchedname,filename,MAXTEXTLENGTH);
+    watchedfilechanged(deck);
+    if (!readwatchedlines(deck->watchedname,&deck->lines,&deck->numberoflines)) {unwatchdeck(deck);return;}
+    //every entry was just read from the file, and its extra offset is somewhere in the line it came from
+    for (i=0;i<numberoftiers;i++) for (entry=levellist(deck,i)->head;entry;entry=entry->next)
+    {
+        for (low=0,high=deck->numberoflines-1;low<high;)
+        {
+            middle = (low+high+1)/2;
+            if (deck->lines[middle].start<=sourceoffset(entry)) low = middle;
+            else high = middle-1;
+        }
+        if (!deck->numberoflines) continue;
+        deck->lines[low].entry = entry;
+        deck->lines[low].id = entry->id;
+        deck->lines[low].status = (RIGHT(entry) ? RIGHTBIT : 0)|LIVEBIT|KNOWN(entry);
+        deck->lines[low].streak = COUNTER(entry);
+    }
+}
+
+void unwatchdeck(struct deck * deck)
+{
+    int d;
+    if (!deck->watch) return;
+    for (d=0;d<numberofdecks && (decks[d]==deck || decks[d]->watch!=deck->watch);d++);
+    if (d==numberofdecks) inotify_rm_watch(watchfd,deck->watch);//no other deck is in the same directory
+    deck->watch = 0;
+    free(deck->lines);
+    deck->lines = NULL;
+    deck->numberoflines = 0;
+}
+
+int watchedfilechanged(struct deck * deck)
+{
+    struct stat now;
+    if (stat(deck->watchedname,&now)) return 0;//gone, or being replaced, there'll be another event when it's back
+    if (now.st_ino==deck->watchedstat.st_ino && now.st_size==deck->watchedstat.st_size && now.st_mtim.tv_sec==deck->watchedstat.st_mtim.tv_sec && now.st_mtim.tv_nsec==deck->watchedstat.st_mtim.tv_nsec) return 0;
+    deck->watchedstat = now;
+    return 1;
+}
+
+void checkwatcheddecks()
+{
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event * event;
+    char * name;
+    ssize_t length;
+    int d, changed[MAXDECKS] = {0};
+    if (watchfd<0) return;
+    while ((length = read(watchfd,buffer,sizeof(buffer)))>0)//never blocks, it's opened with IN_NONBLOCK
+    {
+        for (event=(struct inotify_event *)buffer;(char *)event<buffer+length;event=(struct inotify_event *)((char *)(event+1)+event->len))
+        {
+            if (!event->len) continue;
+            for (d=0;d<numberofdecks;d++)
+            {
+                if (decks[d]->watch!=event->wd) continue;
+                name = strrchr(decks[d]->watchedname,'/');
+                if (!strcmp(name ? name+1 : decks[d]->watchedname,event->name)) changed[d] = 1;
+            }
+        }
+    }
+    for (d=0;d<numberofdecks;d++) if (changed[d] && watchedfilechanged(decks[d])) applydeckchanges(decks[d]);
+}
+
+int readwatchedlines(char * filename, struct watchedline ** lines, int * numberoflines)
+{
+    struct stat status;
+    char * text, * line, * end, * newline;
+    int fd, count = 0;
+
+    if ((fd = open(filename,O_RDONLY))<0) return 0;
+    if (fstat(fd,&status)) {close(fd);return 0;}
+    text = status.st_size ? (char *)mmap(NULL,status.st_size,PROT_READ,MAP_PRIVATE,fd,0) : NULL;
+    close(fd);
+    if (text==MAP_FAILED) return 0;
+    end = text+status.st_size;
+    for (line=text;line<end && (newline = memchr(line,'\n',end-line));line=newline+1) count++;//one pass to count, so the array is allocated once
+    if (line<end) count++;//last line, with no newline after it
+    if (!(*lines = (struct watchedline *)malloc((count+1)*sizeof(struct watchedline)))) outofmemory();
+    *numberoflines = count;
+    for (count=0,line=text;line<end;line=newline+1,count++)
+    {
+        if (!(newline = memchr(line,'\n',end-line))) newline = end;
+        (*lines)[count].hash = linehash(line,newline-line);
+        (*lines)[count].start = line-text;
+        (*lines)[count].entry = NULL;
+        (*lines)[count].id = -1;
+    }
+    if (text) munmap(text,status.st_size);
+    return 1;
+}
+
+int readchangedlines(struct deck * deck, struct watchedline ** lines, int * numberoflines, int * prefix, int * suffix, long * shift)
+{
+    struct watchedline * old = deck->lines;
+    struct stat status;
+    char * text, * line, * end, * newline, * middleend, * lineend;
+    int fd, count = 0, oldcount = deck->numberoflines;
+
+    if ((fd = open(deck->watchedname,O_RDONLY))<0) return 0;
+    if (fstat(fd,&status)) {close(fd);return 0;}
+    text = status.st_size ? (char *)mmap(NULL,status.st_size,PROT_READ,MAP_PRIVATE,fd,0) : NULL;
+    close(fd);
+    if (text==MAP_FAILED) return 0;
+    end = text+status.st_size;
+    //lines the same at the start are in the same place as before, so only their hashes are checked
+    for (*prefix=0,line=text;*prefix<oldcount && line<end;(*prefix)++,line=newline<end ? newline+1 : end)
+    {
+        if (!(newline = memchr(line,'\n',end-line))) newline = end;
+        if (linehash(line,newline-line)!=old[*prefix].hash) break;
+    }
+    //and lines the same at the end have all moved by the same amount, found working back from the end
+    for (*suffix=0,middleend=end;*suffix<oldcount-*prefix && middleend>line;(*suffix)++,middleend=newline)
+    {
+        lineend = middleend[-1]=='\n' ? middleend-1 : middleend;//the file's last line may have no newline after it
+        newline = (char *)memrchr(line,'\n',lineend-line);
+        newline = newline ? newline+1 : line;
+        if (linehash(newline,lineend-newline)!=old[oldcount-1-*suffix].hash) break;
+    }
+    *shift = *suffix ? (middleend-text)-old[oldcount-*suffix].start : 0;
+    //what's left between them is read as readwatchedlines would read the whole file
+    for (end=middleend,newline=line;newline<end && (newline = memchr(newline,'\n',end-newline));newline++) count++;
+    if (end>line && end[-1]!='\n') count++;
+    if (!(*lines = (struct watchedline *)malloc((count+1)*sizeof(struct watchedline)))) outofmemory();
+    *numberoflines = count;
+    for (count=0;line<end;line=newline+1,count++)
+    {
+        if (!(newline = memchr(line,'\n',end-line))) newline = end;
+        (*lines)[count].hash = linehash(line,newline-line);
+        (*lines)[count].start = line-text;
+        (*lines)[count].entry = NULL;
+        (*lines)[count].id = -1;
+    }
+    if (text) munmap(text,status.st_size);
+    return 1;
+}
+
+uint64_t linehash(char * text, size_t length)
+{
+    uint64_t hash = length, word;
+    //a word at a time, as every line of a big deck is hashed each time it changes
+    for (;length>=8;text+=8,length-=8)
+    {
+        memcpy(&word,text,8);
+        hash = (hash^word)*0x9e3779b97f4a7c15ull;
+        hash ^= hash>>29;
+    }
+    word = 0;
+    memcpy(&word,text,length);
+    hash = (hash^word)*0x9e3779b97f4a7c15ull;
+    return hash^(hash>>32);
+}
+
+void pairwatchedline(struct deck * deck, struct watchedline * line, struct watchedline * oldline, int shiftsapplied)
+{
+    if (oldline->id<0 || !(deck->status[oldline->id]&LIVEBIT)) return;//faulty, or its entry has been deleted since: ids are never handed out again, so a live one is the same entry
+    line->entry = oldline->entry;
+    line->id = oldline->id;
+    line->status = oldline->status;//the same text, so the same progress
+    line->streak = oldline->streak;
+    if (line->start!=oldline->start && line->entry->lazy)//the same text, moved
+    {
+        line->entry->extra = sourceoffset(line->entry)+line->start-oldline->start;
+        line->entry->shiftsapplied = shiftsapplied;
+    }
+}
+
+void applydeckchanges(struct deck * deck)
+{
+    FILE * file, * previousinputfile = inputfile;
+    struct deck * previousdeck = currentdeck;
+    struct vocabtable table = {NULL,NULL,0,0};
+    struct watchedline * lines, * old, * base;
+    struct vocab * entry;
+    struct timespec started, finished;
+    char question[MAXTEXTLENGTH+1], answer[MAXTEXTLENGTH+1], info[MAXTEXTLENGTH+1], hint[MAXTEXTLENGTH+1];
+    unsigned char * seen, * used, * matched;
+    int * slots, * oldline = NULL;
+    unsigned int hash, slot, size;
+    int i, j, d, unmatched, numberoflines, oldlines, prefix, suffix, shifts, oldslots = deck->slots, added = 0, removed = 0, changed = 0, relevelled = 0, hasquestion, hasanswer, hasinfo, hashint, right, counter, level, ourschanged, theirschanged;
+    long extra, shift;
+
+    clock_gettime(CLOCK_MONOTONIC,&started);
+    if (!(file = fopen(deck->watchedname,"r"))) return;
+    if (!readchangedlines(deck,&lines,&numberoflines,&prefix,&suffix,&shift)) {fclose(file);return;}
+    //only the lines between those unchanged at the start and end are diffed, so the work done is in proportion to the change, not the file
+    old = deck->lines+prefix;
+    oldlines = deck->numberoflines-prefix-suffix;
+    //the text after the change is noted as having moved rather than the offsets of the entries there being updated. Offsets taken in the new file allow for that move already
+    if (shift && deck->numberofshifts==MAXSHIFTS) settleshifts(deck);
+    shifts = deck->numberofshifts+(shift!=0);
+
+    //the files are walked together, pairing lines that haven't changed, and stepping over a few inserted, deleted or changed lines at a time
+    if (!(used = (unsigned char *)calloc(oldlines+1,1)) || !(matched = (unsigned char *)calloc(numberoflines+1,1))) outofmemory();
+    for (i=0,j=0;i<numberoflines && j<oldlines;)
+    {
+        if (lines[i].hash==old[j].hash)
+        {
+            pairwatchedline(deck,&lines[i],&old[j],shifts);
+            matched[i++] = used[j++] = 1;
+            continue;
+        }
+        for (d=1;d<=RESYNCLINES;d++)
+        {
+            if (i+d<numberoflines && lines[i+d].hash==old[j].hash) {i += d;break;}//inserted
+            if (j+d<oldlines && lines[i].hash==old[j+d].hash) {j += d;break;}//deleted
+            if (i+d<numberoflines && j+d<oldlines && lines[i+d].hash==old[j+d].hash) {i += d;j += d;break;}//changed
+        }
+        if (d>RESYNCLINES) break;//too different to follow here, so the rest is left to the hash table
+    }
+
+    //the lines left over on each side by hash, so lines that have only moved are still paired without being parsed
+    for (j=0,unmatched=0;j<oldlines;j++) unmatched += !used[j];
+    for (size=64;size<2*(unsigned int)unmatched;size*=2);
+    if (!(slots = (int *)malloc(size*sizeof(int)))) outofmemory();
+    memset(slots,-1,size*sizeof(int));
+    for (j=0;j<oldlines;j++)
+    {
+        if (used[j]) continue;
+        for (slot=(unsigned int)old[j].hash & (size-1);slots[slot]>=0;slot=(slot+1) & (size-1));
+        slots[slot] = j;
+    }
+    for (i=0;i<numberoflines && unmatched;i++)
+    {
+        if (matched[i]) continue;
+        for (slot=(unsigned int)lines[i].hash & (size-1);(j = slots[slot])>=0 && (used[j] || old[j].hash!=lines[i].hash);slot=(slot+1) & (size-1));
+        if (j<0) continue;//new or changed, dealt with below
+        pairwatchedline(deck,&lines[i],&old[j],shifts);
+        matched[i] = used[j] = 1;
+        unmatched--;
+    }
+    free(slots);
+
+    //entries whose lines have gone or changed, which are either updated from a changed line with the same question and answer, or removed
+    if (!(seen = (unsigned char *)malloc(oldslots+1))) outofmemory();
+    memset(seen,1,oldslots+1);
+    if (unmatched && !(oldline = (int *)malloc((oldslots+1)*sizeof(int)))) outofmemory();
+    for (j=0;j<oldlines;j++) if (!used[j] && old[j].id>=0 && (deck->status[old[j].id]&LIVEBIT)) {seen[old[j].id] = 0;oldline[old[j].id] = j;vocabtableinsert(&table,old[j].entry);}
+    currentdeck = deck;//the list functions work on the current deck
+    inputfile = file;//readnumberfromfile always reads from inputfile
+    for (i=0;i<numberoflines;i++)
+    {
+        if (matched[i] || fseek(file,lines[i].start,SEEK_SET)) continue;
+        hasquestion = scantextfromfile(file,question,MAXTEXTLENGTH,'~');
+        hasanswer = scantextfromfile(file,answer,MAXTEXTLENGTH,'~');
+        extra = ftell(file);
+        hasinfo = scantextfromfile(file,info,MAXTEXTLENGTH,'~');
+        hashint = scantextfromfile(file,hint,MAXTEXTLENGTH,'~');
+        right = readnumberfromfile(1,'~');
+        counter = readnumberfromfile(0,'~');
+        level = readnumberfromfile(numberoftiers-1,'~');
+        if (!hasquestion || !hasanswer) continue;//faulty, as it would be when loading
+        if (counter>MAXSTREAK) counter = MAXSTREAK;
+        hash = vocabhash(question,answer);
+        for (entry=NULL,slot=hash & (table.size-1);table.size && table.slots[slot];slot=(slot+1) & (table.size-1))
+        {
+            if (table.hashes[slot]==hash && !seen[table.slots[slot]->id] && !strcmp(table.slots[slot]->question,question) && !strcmp(table.slots[slot]->answer,answer)) {entry = table.slots[slot];break;}
+        }
+        if (entry)//the same question and answer: its text is brought up to date, and its progress too if that was changed in the file (by another tester saving it) and not here
+        {
+            seen[entry->id] = 1;
+            base = &old[oldline[entry->id]];
+            ourschanged = ((RIGHT(entry) ? RIGHTBIT : 0)|KNOWN(entry))!=(base->status&(RIGHTBIT|KNOWNMASK)) || COUNTER(entry)!=base->streak;
+            theirschanged = ((right ? RIGHTBIT : 0)|level)!=(base->status&(RIGHTBIT|KNOWNMASK)) || counter!=base->streak;
+            //if both were, the better known of the two wins, as with MERGEKEEPHIGHER
+            if (theirschanged && (!ourschanged || level>KNOWN(entry) || (level==KNOWN(entry) && right && (!RIGHT(entry) || counter>COUNTER(entry)))))
+            {
+                setprogress(entry,right,counter);
+                if (level!=KNOWN(entry)) {setlevel(entry,level);relevelled = 1;}
+            }
+            if (entry->lazy)//never read, so the new info and hint are just read from the new file when they're needed
+            {
+                entry->lazy = (hasinfo ? LAZYINFO : 0)|(hashint ? LAZYHINT : 0);
+                entry->extra = extra;
+                entry->shiftsapplied = shifts;
+            }
+            else
+            {
+                free(entry->info);
+                free(entry->hint);
+                entry->info = hasinfo ? copyfield(info) : NULL;
+                entry->hint = hashint ? copyfield(hint) : NULL;
+            }
+            deck->textversion++;
+            changed++;
+        }
+        else
+        {
+            if (!(entry = (struct vocab *)malloc(sizeof(struct vocab)))) outofmemory();
+            entry->matcher = NULL;
+            entry->questionwidth = entry->answerwidth = 0;
+            entry->latency = 0;
+            entry->deck = deck;
+            entry->question = copyfield(question);
+            entry->answer = copyfield(answer);
+            entry->info = entry->hint = NULL;
+            entry->lazy = (hasinfo ? LAZYINFO : 0)|(hashint ? LAZYHINT : 0);
+            entry->extra = extra;
+            entry->shiftsapplied = shifts;
+            entry->id = newprogressslot(deck);
+            setprogress(entry,right,counter);
+            addtolist(entry,levellist(deck,level));
+            added++;
+        }
+        lines[i].entry = entry;
+        lines[i].id = entry->id;
+        lines[i].status = (right ? RIGHTBIT : 0)|LIVEBIT|level;
+        lines[i].streak = counter;
+    }
+    inputfile = previousinputfile;
+    free(oldline);
+    if (relevelled) sortintolists(deck);
+
+    //what's left unseen has gone from the file, and is unlinked line by line, with the entry before it in its list found from the lines before it
+    for (j=0;j<oldlines && table.used>changed;j++)
+    {
+        if (used[j] || old[j].id<0 || seen[old[j].id] || !(deck->status[old[j].id]&LIVEBIT)) continue;
+        unlinkwatchedentry(deck,prefix+j);
+        removed++;
+    }
+    freevocabtable(&table);
+    free(seen);
+    free(used);
+    free(matched);
+    if (removed || relevelled) rolltotal = 0;//a tier may have emptied
+
+    //the changed lines are spliced in between the unchanged ones, and those after them moved along
+    j = deck->numberoflines;
+    deck->numberoflines = prefix+numberoflines+suffix;
+    if (deck->numberoflines>j && !(deck->lines = (struct watchedline *)realloc(deck->lines,(deck->numberoflines+1)*sizeof(struct watchedline)))) outofmemory();
+    memmove(deck->lines+prefix+numberoflines,deck->lines+j-suffix,suffix*sizeof(struct watchedline));
+    memcpy(deck->lines+prefix,lines,numberoflines*sizeof(struct watchedline));
+    free(lines);
+    //the old file stayed open as the source until now, so info and hints read since it was replaced came from where the entries' offsets point
+    if (shift)
+    {
+        deck->shifts[deck->numberofshifts].from = deck->lines[deck->numberoflines-suffix].start;
+        deck->shifts[deck->numberofshifts++].by = shift;
+    }
+    for (i=deck->numberoflines-suffix;i<deck->numberoflines && shift;i++) deck->lines[i].start += shift;
+    if (deck->source) fclose(deck->source);
+    deck->source = file;//every entry's lazy info and hint are now in the new file
+    deck->separator = '~';
+    currentdeck = previousdeck;
+    clock_gettime(CLOCK_MONOTONIC,&finished);
+    if (added || removed || changed)//the full-text index is left to be rebuilt when it's next searched, which it will be as textversion has moved on
+    {
+        sprintf(passingstring,"%.100s was changed: %d entries added, %d removed and %d updated in %.1f ms.",deck->watchedname,added,removed,changed,(finished.tv_sec-started.tv_sec)*1000.0+(finished.tv_nsec-started.tv_nsec)/1000000.0);
+        fprintf(stderr,"%s\n",passingstring);
+        popupinfo(4,"Deck reloaded",passingstring);
+    }
+}
+
+long sourceoffset(struct vocab * entry)
+{
+    long offset = entry->extra;
+    int i;
+    for (i=entry->shiftsapplied;i<entry->deck->numberofshifts;i++) if (offset>=entry->deck->shifts[i].from) offset += entry->deck->shifts[i].by;
+    return offset;
+}
+
+void settleshifts(struct deck * deck)
+{
+    int i;
+    struct vocab * entry;
+    for (i=0;i<numberoftiers;i++) for (entry=levellist(deck,i)->head;entry;entry=entry->next)
+    {
+        if (!entry->lazy) continue;
+        entry->extra = sourceoffset(entry);
+        entry->shiftsapplied = 0;
+    }
+    deck->numberofshifts = 0;
+}
+
+void unlinkwatchedentry(struct deck * deck, int line)
+{
+    struct vocab * entry = deck->lines[line].entry, * prev = NULL;
+    struct listinfo * list = levellist(deck,KNOWN(entry));
+    int k;
+    if (list->head!=entry)
+    {
+        //entries are read into their lists in file order, so the one before is usually on a line just before, unless a test or sort has moved them since
+        for (k=line-1;k>=0 && k>=line-UNLINKLINES && !prev;k--) if (deck->lines[k].id>=0 && (deck->status[deck->lines[k].id]&LIVEBIT) && deck->lines[k].entry->next==entry) prev = deck->lines[k].entry;
+        if (!prev) for (prev=list->head;prev && prev->next!=entry;prev=prev->next);
+        if (!prev) {popuperror("Trying to delete an entry from a list it's not in!!\n");return;}
+        prev->next = entry->next;
+    }
+    else list->head = entry->next;
+    if (list->tail==entry) list->tail = prev;
+    list->entries--;
+    COUNTMETRIC(tierentries[list-deck->lists],-1);
+    freevocab(entry);
+}
+
+void savedatabase()
+{
+    char * deffilename = DOUTPUTFILENAME;
+    char * outputfilename = (char *)malloc(MAXTEXTLENGTH+1);
+    char lastfilename[MAXTEXTLENGTH+1];
+    WINDOW * wbsavedatabase, * wsavedatabase;
+    PANEL * psavedatabase;
+
+    strcpy(lastfilename,currentdeck->filename);
+    if (currentdeck->map)//never write text over a compiled deck, it is mapped and in use
+    {
+        msync(currentdeck->progressmap,currentdeck->progressmapsize,MS_SYNC);
+        currentdeck->changed = 0;
+        if (!getyesorno("Progress in a compiled deck is saved as you go, and has been written to disk.\nDo you also want to export this deck as a .~sv file?")) {free(outputfilename);return;}
+        validfilename(lastfilename,".~sv");
+    }
+
+    wbsavedatabase = nicebigwindow();
+    psavedatabase = new_panel(wbsavedatabase);
+    windowtitle(wbsavedatabase,"Save Database");
+    wsavedatabase = innerwindow(wbsavedatabase);
+
+    wprintw(wsavedatabase,"Saving...\n");
+    update_panels();
+    doupdate();
+
+    if (!outputfilename) outofmemory();
+    strcpy(outputfilename,deffilename);
+    popupinfo(3,"WARNING:","If you provide a database filename that already exists, that database will be OVERWRITTEN!");
+    if (strcmp(outputfilename,lastfilename))
+    {
+        sprintf(passingstring,"Save to most recently loaded database: %s?",lastfilename);
+        if(getyesorno(passingstring))
+        {
+            strcpy(outputfilename,lastfilename);
+        }
+    }
+    sprintf(passingstring,"Save to default database: %s? (y/n)",outputfilename);
+    if (!getyesorno(passingstring))//user specifies filename for database output
+    {
+        wprintw(wsavedatabase,"A .~sv file will be saved to the filename you provide, or a compressed one if it ends in %s.\nPlease enter a name for the .~sv file:\n",PACKEDEXTENSION);
+        outputfilename=wgettextfromkeyboard(wsavedatabase,outputfilename,MAXTEXTLENGTH);
+        if (!hasextension(outputfilename,PACKEDEXTENSION)) validfilename(outputfilename,".~sv");
+    }
+    if (!wwriteliststofile(wsavedatabase,outputfilename)) popuperror("Error while saving!!"); //print error message if wwriteliststofile returned 0
+    else currentdeck->changed = 0;
+    free(outputfilename);
+    getmaxyx(wsavedatabase,nlines,ncols);
+    mvwprintw(wsavedatabase,nlines-1,0,"Press any key to continue...");
+    waitforkey(wsavedatabase,0);
+    delwin(wsavedatabase);
+    del_panel(psavedatabase);
+    delwin(wbsavedatabase);
+    return;
+}
+
+int wwriteliststofile(WINDOW * window,char * outputfilename)
+{
+    int i,counter=0,fd,lockfd;
+    struct listinfo * list;
+    struct vocab * entry;
+    struct stat locked, current;
+    struct timespec started;
+    char * temporaryname;
+    FILE * file = NULL;
+
+    clock_gettime(CLOCK_MONOTONIC,&started);
+    //another tester may be saving the same file, so the file is locked while it's written, and if it was replaced while waiting for the lock, the new one is locked instead
+    for (;;)
+    {
+        if ((lockfd = open(outputfilename,O_RDONLY|O_CREAT,0644))<0 || flock(lockfd,LOCK_EX)<0 || fstat(lockfd,&locked)<0)
+        {
+            if (lockfd>=0) close(lockfd);
+            popuperror("Error accessing output file!");
+            return 0;
+        }
+        if (!stat(outputfilename,&current) && current.st_ino==locked.st_ino && current.st_dev==locked.st_dev) break;
+        close(lockfd);
+    }
+    //whatever the other tester saved is folded in first, rather than written over
+    if (currentdeck->watch && !strcmp(currentdeck->watchedname,outputfilename) && watchedfilechanged(currentdeck)) applydeckchanges(currentdeck);
+    //info and hints still waiting in a file must be read in before that file can be overwritten
+    materializedeck(currentdeck);
+    for (i=0;i<numberofdecks;i++) if (decks[i]->source && !strcmp(decks[i]->filename,outputfilename)) materializedeck(decks[i]);
+    //written to a new file which then replaces the old one, so nobody reading the old one ever sees it half written
+    if (!(temporaryname = (char *)malloc(strlen(outputfilename)+8))) outofmemory();
+    sprintf(temporaryname,"%s.XXXXXX",outputfilename);
+    if ((fd = mkstemp(temporaryname))<0 || fchmod(fd,locked.st_mode&07777)<0 || !(file = fdopen(fd,"w")) || !(outputfile = hasextension(outputfilename,PACKEDEXTENSION) ? createpacked(file) : file))
+    {
+        if (fd>=0 && !file) close(fd);//once it's been opened as a FILE, createpacked() has closed it
+        if (fd>=0) unlink(temporaryname);
+        close(lockfd);
+        free(temporaryname);
         popuperror("Error accessing output file!");
         return 0;
     }
     else
     {
         wprintw(window,"Saving...\n");
-        for (i=0;i<=3;i++)
+        for (i=0;i<numberoftiers;i++)
         {
-            switch (i)
-            {
-                case 0: list = &n2l;break;
-                case 1: list = &norm;break;
-                case 2: list = &known;break;
-                case 3: list = &old;break;
-                default: popuperror("Loop Error!");break;
-            }
+            list = levellist(currentdeck,i);
             entry=list->head;
             while (entry!=NULL)
             {
@@ -510,24 +2831,51 @@ int wwriteliststofile(WINDOW * window,char * outputfilename)
                 if (entry->info) fprintf(outputfile,"%s",entry->info);
                 fprintf(outputfile,"~");
                 if (entry->hint) fprintf(outputfile,"%s",entry->hint);
-                fprintf(outputfile,"~%i~%i~%i",entry->right,entry->counter,i);
+                fprintf(outputfile,"~%i~%i~%i",RIGHT(entry),COUNTER(entry),i);
                 entry=entry->next;
                 counter++;
             }
         }
-        fclose(outputfile);
+        if ((ferror(outputfile) | fclose(outputfile)) || rename(temporaryname,outputfilename)<0)
+        {
+            unlink(temporaryname);
+            close(lockfd);
+            free(temporaryname);
+            return 0;
+        }
+        free(temporaryname);
+        if (currentdeck->watch && !strcmp(currentdeck->watchedname,outputfilename)) rewatchdeck(currentdeck);//the file now matches the deck, so there's nothing to apply
+        close(lockfd);//only now, so the next tester to save sees this one's save as a change
         wprintw(window,"...finished. %i entries saved to file: %s\n",counter,outputfilename);
+        countduration(&metrics.saves,&metrics.savemicroseconds,&started);
         return 1;
     }
 }
 
+void rewatchdeck(struct deck * deck)
+{
+    int i, line = 0;
+    struct vocab * entry;
+    watchedfilechanged(deck);
+    free(deck->lines);
+    deck->lines = NULL;
+    if (!readwatchedlines(deck->watchedname,&deck->lines,&deck->numberoflines)) {unwatchdeck(deck);return;}
+    for (i=0;i<numberoftiers;i++) for (entry=levellist(deck,i)->head;entry && line<deck->numberoflines;entry=entry->next,line++)
+    {
+        deck->lines[line].entry = entry;
+        deck->lines[line].id = entry->id;
+        deck->lines[line].status = (RIGHT(entry) ? RIGHTBIT : 0)|LIVEBIT|i;
+        deck->lines[line].streak = COUNTER(entry);
+    }
+}
+
 void databasemenu()//provides ability to add entries to database, and edit entries from outside testing mode
 {
     WINDOW * wbdatabasemenu, * wdatabasemenu;
     PANEL * pdatabasemenu;
     ITEM ** databasemenuitems;
     MENU * databasemenu;
-    struct vocab * entry;
+    struct vocab * entry, ** matches = NULL;
     int menuchoice = '\n';
     int menuresult=1;
     char * searchstring = (char *)malloc(MAXTEXTLENGTH+1);
@@ -537,12 +2885,18 @@ void databasemenu()//provides ability to add entries to database, and edit entri
     {
         {"a:","Add Vocab"},
         {"e:","Edit or delete vocab"},
+        {"s:","Search as you type, to edit or delete vocab"},
+        {"f:","Find text anywhere in the question, answer, info or hint"},
+        {"b:","Browse every entry, sorted by question, answer, level or streak"},
         {"x:","Exit to main menu"}
     };
     char databasemenupointers[] =
     {
         'a',
         'e',
+        's',
+        'f',
+        'b',
         'x'
     };
     
@@ -573,7 +2927,7 @@ void databasemenu()//provides ability to add entries to database, and edit entri
     while (menuchoice!='x')
     {
         entry = NULL;
-        menuchoice = wgetch(wdatabasemenu);
+        menuchoice = waitforkey(wdatabasemenu,0);
         if (menuchoice == 10)
         {
             ITEMselected = current_item(databasemenu);
@@ -586,10 +2940,10 @@ void databasemenu()//provides ability to add entries to database, and edit entri
                         break;
             case KEY_DOWN: menu_driver(databasemenu,REQ_DOWN_ITEM);
                         break;
-            case 'a': if (createnewvocab()) {changedflag = 1;popupinfo(4,"Success!","Vocab successfully added.");}
+            case 'a': if (createnewvocab()) {currentdeck->changed = 1;popupinfo(4,"Success!","Vocab successfully added.");}
                       else popuperror("Vocab creation failed!");
                       break;
-            case 'e': changedflag = 1;wmove(wdatabasemenu,4,0);wprintw(wdatabasemenu,"Entry to edit or delete:\n");clrtoeol();
+            case 'e': wmove(wdatabasemenu,4,0);wprintw(wdatabasemenu,"Entry to edit or delete:\n");clrtoeol();
                 searchstring=wgettextfromkeyboard(wdatabasemenu,searchstring,MAXTEXTLENGTH);
                 if (searchstring) entry = vocabsearch(searchstring);
                 if (entry)
@@ -603,6 +2957,38 @@ void databasemenu()//provides ability to add entries to database, and edit entri
                 }
                 else popupinfo(2,"","No entry selected");
                 break;
+            case 'f': wmove(wdatabasemenu,numberofchoices+1,0);wprintw(wdatabasemenu,"Text to find:\n");wclrtobot(wdatabasemenu);
+                if (!(searchstring=wgettextfromkeyboard(wdatabasemenu,searchstring,MAXTEXTLENGTH))) {popuperror("Unable to allocate memory! for search string.");break;}
+                i = findtext(currentdeck,searchstring,&matches);
+                if (!i) {sprintf(passingstring,"No entries contain '%s'.",searchstring);popupinfo(2,"",passingstring);}
+                else entry = pickentry("Find text",matches,i);
+                free(matches);
+                matches = NULL;
+                i = 0;
+                wmove(wdatabasemenu,numberofchoices+1,0);wclrtobot(wdatabasemenu);
+                if (entry)
+                {
+                    menuresult=1;
+                    while (menuresult==1)
+                    {
+                        menuresult = editormenu(entry,0);
+                    }
+                    if (menuresult==-1) goto cleanup;
+                }
+                break;
+            case 's': entry = searchasyoutype();
+                if (entry)
+                {
+                    menuresult=1;
+                    while (menuresult==1)
+                    {
+                        menuresult = editormenu(entry,0);
+                    }
+                    if (menuresult==-1) goto cleanup;
+                }
+                break;
+            case 'b': if (browsedeck()==-1) goto cleanup;
+                break;
             case 'x': break;
         }
     }
@@ -618,75 +3004,763 @@ void databasemenu()//provides ability to add entries to database, and edit entri
     delwin(wbdatabasemenu);
 }
 
-struct vocab * createnewvocab()//allows user to create now vocab record within the program
+void deckmenu()//lets the user open more decks, choose the current deck and which decks are tested together
+{
+    WINDOW * wbdeckmenu, * wdeckmenu, * wdeckmenusub;
+    PANEL * pdeckmenu;
+    ITEM ** deckmenuitems;
+    MENU * deckmenu;
+    struct deck * selected;
+    char deckdescriptions[MAXDECKS][60];
+    char * filename;
+    int i, entries, anyintest, menuchoice = 0, selectedindex = 0;
+
+    if(!(deckmenuitems = (ITEM**)calloc(MAXDECKS+1,sizeof(ITEM*)))) outofmemory();
+    if(!(filename = (char *)malloc(MAXTEXTLENGTH+1))) outofmemory();
+    wbdeckmenu = nicebigwindow();
+    pdeckmenu = new_panel(wbdeckmenu);
+    wdeckmenu = innerwindow(wbdeckmenu);
+    windowtitle(wbdeckmenu,"Decks");
+    wdeckmenusub = derwin(wdeckmenu,MAXDECKS,0,0,0);
+
+    while (menuchoice!='x')
+    {
+        //the menu is rebuilt each time round, as decks come and go
+        werase(wdeckmenu);
+        for (i=0,anyintest=0;i<numberofdecks;i++)
+        {
+            entries = deckentries(decks[i]);
+            sprintf(deckdescriptions[i],"%8i entries %s%s%s",entries,decks[i]==currentdeck?" [current]":"",deckintest(decks[i])?" [testing]":"",decks[i]->map?" [compiled]":"");
+            deckmenuitems[i] = new_item(decks[i]->filename,deckdescriptions[i]);
+            set_item_userptr(deckmenuitems[i],decks[i]);
+            if (decks[i]->intest) anyintest = 1;
+        }
+        deckmenuitems[numberofdecks] = NULL;
+        deckmenu = new_menu(deckmenuitems);
+        set_menu_win(deckmenu,wdeckmenu);
+        set_menu_sub(deckmenu,wdeckmenusub);
+        set_menu_back(deckmenu,COLOR_PAIR(1));
+        set_menu_format(deckmenu,MAXDECKS,1);
+        menu_opts_off(deckmenu,O_NONCYCLIC);
+        post_menu(deckmenu);
+        if (selectedindex>=numberofdecks) selectedindex = numberofdecks-1;
+        set_current_item(deckmenu,deckmenuitems[selectedindex]);
+        getmaxyx(wdeckmenu,nlines,ncols);
+        if (!anyintest) mvwprintw(wdeckmenu,nlines-4,0,"Testing draws from the current deck. Press 't' to choose decks to be tested together.");
+        mvwprintw(wdeckmenu,nlines-3,0,"Enter: make current   t: test from this deck (or not)   u: unload this deck");
+        mvwprintw(wdeckmenu,nlines-2,0,"o: open another deck   c: compile current deck (.vtd)   x: exit to main menu");
+        update_panels();
+        doupdate();
+
+        menuchoice = waitforkey(wdeckmenu,0);
+        selected = (struct deck *)item_userptr(current_item(deckmenu));
+        selectedindex = item_index(current_item(deckmenu));
+        switch (menuchoice)
+        {
+            case KEY_UP: selectedindex = selectedindex ? selectedindex-1 : numberofdecks-1;break;
+            case KEY_DOWN: selectedindex = (selectedindex+1)%numberofdecks;break;
+            case 10: currentdeck = selected;break;
+            case 't': selected->intest = !selected->intest;break;
+            case 'u': if (getyesorno("Unload this deck? Unsaved changes to it will be lost."))
+                      {
+                          if (!selected->map && getyesorno("Save it first?")) {currentdeck = selected;savedatabase();}
+                          closedeck(selected);
+                      }
+                      break;
+            case 'o': werase(wdeckmenu);
+                      wprintw(wdeckmenu,"Enter the name of the deck to open (.~sv, .csv or compiled .vtd):\n");
+                      strcpy(filename,"");
+                      filename = wgettextfromkeyboard(wdeckmenu,filename,MAXTEXTLENGTH);
+                      if (!strlen(filename) || !newdeck(filename)) break;
+                      if (hasextension(filename,".vtd"))
+                      {
+                          if (!wmapdeck(wdeckmenu,filename)) closedeck(currentdeck);
+                      }
+                      else
+                      {
+                          if (hasextension(filename,".csv")) wimportcsv(wdeckmenu,filename);
+                          else wgetrecordsfromfile(wdeckmenu,filename,'~');
+                          if (!hasextension(currentdeck->filename,PACKEDEXTENSION)) validfilename(currentdeck->filename,".~sv");
+                      }
+                      selectedindex = numberofdecks-1;
+                      mvwprintw(wdeckmenu,nlines-1,0,"Press any key to continue...");
+                      waitforkey(wdeckmenu,0);
+                      break;
+            case 'c': werase(wdeckmenu);
+                      strcpy(filename,currentdeck->filename);
+                      validfilename(filename,".vtd");
+                      sprintf(passingstring,"Compile the current deck to %s?",filename);
+                      if (!getyesorno(passingstring))
+                      {
+                          wprintw(wdeckmenu,"Enter a name for the compiled deck:\n");
+                          filename = validfilename(wgettextfromkeyboard(wdeckmenu,filename,MAXTEXTLENGTH),".vtd");
+                      }
+                      if (currentdeck->map && !strcmp(filename,currentdeck->filename)) popuperror("That compiled deck is the one in use!");
+                      else wcompiledeck(wdeckmenu,filename);
+                      mvwprintw(wdeckmenu,nlines-1,0,"Press any key to continue...");
+                      waitforkey(wdeckmenu,0);
+                      break;
+        }
+        unpost_menu(deckmenu);
+        free_menu(deckmenu);
+        for (i=0;deckmenuitems[i];i++) {free_item(deckmenuitems[i]);deckmenuitems[i] = NULL;}
+    }
+    free(deckmenuitems);
+    free(filename);
+    del_panel(pdeckmenu);
+    delwin(wdeckmenusub);
+    delwin(wdeckmenu);
+    delwin(wbdeckmenu);
+}
+
+struct vocab * createnewvocab()//allows user to create now vocab record within the program
+{
+    WINDOW * wbcreatevocab, * wcreatevocab;
+    PANEL * pcreatevocab;
+    struct vocab * newvocab;
+    struct listinfo * newvocablist = levellist(currentdeck,newtier);
+
+    if (currentdeck->map) {popupinfo(3,"Compiled deck:","The current deck is a read-only compiled deck.\nExport it as a .~sv file and load that to add entries.");return NULL;}
+    
+    wbcreatevocab = nicebigwindow();
+    pcreatevocab = new_panel(wbcreatevocab);
+    wcreatevocab = innerwindow(wbcreatevocab);
+    windowtitle(wbcreatevocab,"Create new vocab");
+    
+    newvocab = (struct vocab *)malloc(sizeof(struct vocab));
+    if (!newvocab) outofmemory();
+    else
+    {
+        newvocab->question=newvocab->answer=newvocab->info=newvocab->hint=NULL;
+        newvocab->deck=currentdeck;
+        newvocab->id=-1;
+        newvocab->lazy=0;
+        newvocab->matcher=NULL;
+        newvocab->questionwidth=newvocab->answerwidth=0;
+        newvocab->latency=0;
+        wprintw(wcreatevocab,"Enter question text for this entry (max %i chars):\n",maxtextlength);
+        newvocab->question=wgettextfromkeyboard(wcreatevocab,newvocab->question,MAXTEXTLENGTH);
+        wprintw(wcreatevocab,"Enter answer text for this entry (max %i chars):\n",maxtextlength);
+        newvocab->answer=wgettextfromkeyboard(wcreatevocab,newvocab->answer,MAXTEXTLENGTH);
+        if (getyesorno("Would you like to add additional info for this entry?"))
+        {
+            wprintw(wcreatevocab,"Enter info for this entry (max %i chars):\n",maxtextlength);
+            newvocab->info=wgettextfromkeyboard(wcreatevocab,newvocab->info,MAXTEXTLENGTH);
+        }
+        else
+        {
+            newvocab->info=NULL;
+            wprintw(wcreatevocab,"No info added\n");
+        }
+        if (getyesorno("Would you like to add a hint to help you remember this entry?"))
+        {
+            wprintw(wcreatevocab,"Enter hint for this entry (max %i chars):\n",maxtextlength);
+            newvocab->hint=wgettextfromkeyboard(wcreatevocab,newvocab->hint,MAXTEXTLENGTH);
+        }
+        else
+        {
+            newvocab->hint=NULL;
+            wprintw(wcreatevocab,"No hint added\n");
+        }
+
+        if (newvocab->question==NULL||newvocab->answer==NULL) //minimal validation for valid record
+        {
+            popuperror("Question and/or answer are blank!");
+            del_panel(pcreatevocab);
+            delwin(wcreatevocab);
+            delwin(wbcreatevocab);
+            return NULL;
+        }
+
+        newvocab->id=newprogressslot(currentdeck);
+        if (addtolist(newvocab,newvocablist))
+        {
+            del_panel(pcreatevocab);
+            delwin(wcreatevocab);
+            delwin(wbcreatevocab);
+            return newvocab;
+        }
+        else
+        {
+            del_panel(pcreatevocab);
+            delwin(wcreatevocab);
+            delwin(wbcreatevocab);
+            return NULL;
+        }
+    }
+}
+
+struct vocab * searchasyoutype()//lets the user pick an entry of the current deck from a list that narrows with every key typed
+{
+    WINDOW * wbsearch, * wsearch;
+    PANEL * psearch;
+    struct vocab * entry, * returnvalue = NULL;
+    char prefix[MAXTEXTLENGTH+1] = "";
+    int ch = 0, length = 0, first, last, selected = 0, top = 0, rows, i;
+
+    if (!currentdeck->searchindex || currentdeck->searchversion!=currentdeck->textversion) buildsearchindex(currentdeck);
+    wbsearch = nicebigwindow();
+    windowtitle(wbsearch,"Search as you type");
+    psearch = new_panel(wbsearch);
+    wsearch = innerwindow(wbsearch);
+    getmaxyx(wsearch,nlines,ncols);
+    rows = nlines-4;
+
+    while (ch!=10 && ch!=27)
+    {
+        //two binary searches give the whole range of keys starting with what's been typed, however big the deck
+        first = searchbound(currentdeck,prefix,0);
+        last = searchbound(currentdeck,prefix,1);
+        if (selected >= last-first) selected = last-first-1;
+        if (selected < 0) selected = 0;
+        if (selected < top) top = selected;
+        if (selected >= top+rows) top = selected-rows+1;
+
+        werase(wsearch);
+        mvwprintw(wsearch,0,0,"Search: %s",prefix);
+        mvwprintw(wsearch,1,0,"%i match%s. Up/down to choose, Enter to edit, Esc to go back.",last-first,last-first==1?"":"es");
+        for (i = 0;i < rows && first+top+i < last;i++)
+        {
+            entry = currentdeck->searchindex[first+top+i].entry;
+            if (top+i==selected) wattron(wsearch,A_REVERSE);
+            mvwprintw(wsearch,3+i,0,"%.*s = %.*s",fieldprefix(entry->question,&entry->questionwidth,ncols/2-2),entry->question,fieldprefix(entry->answer,&entry->answerwidth,ncols/2-2),entry->answer);
+            if (top+i==selected) wattroff(wsearch,A_REVERSE);
+        }
+        wmove(wsearch,0,8+length);
+        update_panels();
+        doupdate();
+
+        ch = waitforkey(wsearch,0);
+        switch (ch)
+        {
+            case KEY_UP: selected--;break;
+            case KEY_DOWN: selected++;break;
+            case KEY_PPAGE: selected -= rows;break;
+            case KEY_NPAGE: selected += rows;break;
+            case KEY_BACKSPACE: case 127: case 8: if (length) prefix[--length] = '\0';selected = top = 0;break;
+            case 10: if (last>first) returnvalue = currentdeck->searchindex[first+selected].entry;break;
+            default: if (ch>=' ' && ch<256 && length<MAXTEXTLENGTH) {prefix[length++] = ch;prefix[length] = '\0';selected = top = 0;}
+        }
+    }
+    del_panel(psearch);
+    delwin(wsearch);
+    delwin(wbsearch);
+    update_panels();
+    doupdate();
+    return returnvalue;
+}
+
+void buildsearchindex(struct deck * deck)//sorts every question and answer in the deck (ignoring case) so a prefix can be found by binary search
+{
+    int i;
+    struct vocab * entry;
+    deck->searchkeys = 0;
+    for (i=0;i<numberoftiers;i++) deck->searchkeys += 2*levellist(deck,i)->entries;
+    free(deck->searchindex);
+    if (!(deck->searchindex = (struct searchkey *)malloc((deck->searchkeys+1)*sizeof(struct searchkey)))) outofmemory();
+    deck->searchkeys = 0;
+    for (i=0;i<numberoftiers;i++)
+    {
+        for (entry=levellist(deck,i)->head;entry;entry=entry->next)
+        {
+            deck->searchindex[deck->searchkeys].text = entry->question;
+            deck->searchindex[deck->searchkeys++].entry = entry;
+            deck->searchindex[deck->searchkeys].text = entry->answer;
+            deck->searchindex[deck->searchkeys++].entry = entry;
+        }
+    }
+    qsort(deck->searchindex,deck->searchkeys,sizeof(struct searchkey),comparesearchkeys);
+    deck->searchversion = deck->textversion;
+}
+
+int comparesearchkeys(const void * a, const void * b)
+{
+    return strcasecmp(((struct searchkey *)a)->text,((struct searchkey *)b)->text);
+}
+
+int searchbound(struct deck * deck, char * prefix, int after)//returns the first key starting with prefix, or if after is set the first key after all of those
+{
+    int low = 0, high = deck->searchkeys, middle, comparison, length = strlen(prefix);
+    while (low < high)
+    {
+        middle = low+(high-low)/2;
+        comparison = strncasecmp(deck->searchindex[middle].text,prefix,length);//only the first length characters, so every key starting with prefix compares equal
+        if (comparison < 0 || (after && !comparison)) low = middle+1;
+        else high = middle;
+    }
+    return low;
+}
+
+void buildbrowseorders(struct deck * deck)//sorts the deck's entries by question and answer if they've changed since it was last done, and by level and streak every time
+{
+    int i, k, n = 0, counts[2*MAXSTREAK+2];
+    struct vocab * entry, ** byquestion;
+
+    if (!deck->browseorders[BROWSEQUESTION] || deck->browseversion!=deck->textversion)
+    {
+        for (i=0;i<numberoftiers;i++) n += levellist(deck,i)->entries;
+        for (k=0;k<BROWSEORDERS;k++)
+        {
+            free(deck->browseorders[k]);
+            if (!(deck->browseorders[k] = (struct vocab **)malloc((n+1)*sizeof(struct vocab *)))) outofmemory();
+        }
+        for (i=0,n=0;i<numberoftiers;i++) for (entry=levellist(deck,i)->head;entry;entry=entry->next) deck->browseorders[BROWSEQUESTION][n++] = entry;
+        memcpy(deck->browseorders[BROWSEANSWER],deck->browseorders[BROWSEQUESTION],n*sizeof(struct vocab *));
+        qsort(deck->browseorders[BROWSEQUESTION],n,sizeof(struct vocab *),comparebrowsequestions);
+        qsort(deck->browseorders[BROWSEANSWER],n,sizeof(struct vocab *),comparebrowseanswers);
+        deck->browseentries = n;
+        deck->browseversion = deck->textversion;
+    }
+    //levels and streaks change with every answer, but there are few of either, so a counting sort of the question order
+    //puts them in order in two passes, with entries on the same level or streak still in order of question
+    byquestion = deck->browseorders[BROWSEQUESTION];
+    n = deck->browseentries;
+    for (k=BROWSELEVEL;k<=BROWSESTREAK;k++)
+    {
+        memset(counts,0,sizeof(counts));
+        for (i=0;i<n;i++) counts[(k==BROWSELEVEL ? KNOWN(byquestion[i]) : STREAKKEY(byquestion[i]))+1]++;
+        for (i=1;i<2*MAXSTREAK+2;i++) counts[i] += counts[i-1];
+        for (i=0;i<n;i++) deck->browseorders[k][counts[k==BROWSELEVEL ? KNOWN(byquestion[i]) : STREAKKEY(byquestion[i])]++] = byquestion[i];
+    }
+}
+
+int comparebrowsequestions(const void * a, const void * b)
+{
+    struct vocab * x = *(struct vocab **)a, * y = *(struct vocab **)b;
+    int comparison = strcasecmp(x->question,y->question);
+    return comparison ? comparison : strcasecmp(x->answer,y->answer);
+}
+
+int comparebrowseanswers(const void * a, const void * b)
+{
+    struct vocab * x = *(struct vocab **)a, * y = *(struct vocab **)b;
+    int comparison = strcasecmp(x->answer,y->answer);
+    return comparison ? comparison : strcasecmp(x->question,y->question);
+}
+
+void startindexing(struct deck * deck)//copies the text of every entry of a deck and starts a thread building a full-text index over it
+{
+    struct textindex * index;
+    struct vocab * entry;
+    int i, k;
+
+    freetextindex(deck);
+    if (!(index = (struct textindex *)calloc(1,sizeof(struct textindex)))) outofmemory();
+    deck->textindex = index;
+    index->version = deck->textversion;
+    for (i=0;i<numberoftiers;i++) index->numberofentries += levellist(deck,i)->entries;
+    index->entries = (struct vocab **)malloc((index->numberofentries+1)*sizeof(struct vocab *));
+    index->extras = (long *)malloc((index->numberofentries+1)*sizeof(long));
+    if (!index->entries || !index->extras) outofmemory();
+    index->sourcefd = deck->source ? dup(fileno(deck->source)) : -1;//a descriptor of its own, so the deck can close or replace its source while the thread reads
+    index->separator = deck->separator;
+
+    //the text is copied here, so the thread never touches entries that might be edited or freed while it runs.
+    //Info and hints still in the source file are left for the thread to read, which is most of the work of loading them
+    for (i=0,k=0;i<numberoftiers;i++)
+    {
+        for (entry=levellist(deck,i)->head;entry;entry=entry->next,k++)
+        {
+            index->entries[k] = entry;
+            index->extras[k] = entry->lazy ? sourceoffset(entry) : -1;
+            addindexsegment(index,k);
+            appendindextext(index,entry->question);
+            appendindextext(index,entry->answer);
+            if (!entry->lazy)
+            {
+                if (entry->info) appendindextext(index,entry->info);
+                if (entry->hint) appendindextext(index,entry->hint);
+            }
+        }
+    }
+    if (pthread_create(&index->thread,NULL,indexdeck,index))
+    {
+        index->joined = 1;//no thread to wait for, so do the work now
+        indexdeck(index);
+    }
+}
+
+void finishindexing(struct deck * deck)//waits for a deck's indexing thread, if there is one
+{
+    if (!deck->textindex || deck->textindex->joined) return;
+    pthread_join(deck->textindex->thread,NULL);
+    deck->textindex->joined = 1;
+}
+
+void indexbuilt(void * unused)
+{
+    int d;
+    if (startdeckpending) return;//the decks are the loading thread's until it's done, finishstartdeck() calls this then
+    for (d=0;d<numberofdecks;d++) if (decks[d]->textindex && decks[d]->textindex->ready) finishindexing(decks[d]);
+}
+
+void waitforindex(struct textindex * index)
+{
+    WINDOW * wbwait, * wwait;
+    PANEL * pwait;
+    char * message = "The full-text index is being built, it won't be long...";
+    int width, height;
+
+    width=textwidth(message);
+    getmaxyx(stdscr,nlines,ncols);
+    if (width>ncols-16)width=ncols-16;
+    height=textheight(message,width)+4;
+    width+=8;
+    if (!(wbwait = newwin(height,width,(nlines-height)/2,(ncols-width)/2))) outofmemory();
+    pwait = new_panel(wbwait);
+    wattrset(wbwait,COLOR_PAIR(2));
+    werase(wbwait);
+    wbkgd(wbwait,COLOR_PAIR(2));
+    box(wbwait,0,0);
+    wwait = innerwindow(wbwait);
+    keypad(wwait,TRUE);
+    wprintw(wwait,"%s",message);
+    update_panels();
+    doupdate();
+    while (!index->ready) waitforkey(wwait,EVENTWAKE);//keys are ignored, the search can't go on without it
+    delwin(wwait);
+    del_panel(pwait);
+    delwin(wbwait);
+    update_panels();
+    doupdate();
+}
+
+void freetextindex(struct deck * deck)
+{
+    if (!deck->textindex) return;
+    finishindexing(deck);
+    free(deck->textindex->entries);
+    free(deck->textindex->extras);
+    free(deck->textindex->text);
+    free(deck->textindex->segmentstarts);
+    free(deck->textindex->segmententries);
+    free(deck->textindex->suffixes);
+    if (deck->textindex->sourcefd>=0) close(deck->textindex->sourcefd);
+    free(deck->textindex);
+    deck->textindex = NULL;
+}
+
+void * indexdeck(void * arg)//body of the indexing thread: reads lazy info and hints, then sorts the suffixes
+{
+    struct textindex * index = (struct textindex *)arg;
+    char buffer[4*(MAXTEXTLENGTH+1)], field[MAXTEXTLENGTH+1];
+    ssize_t length;
+    unsigned int * buckets, i;
+    struct sortjob jobs[MAXSORTTHREADS];
+    pthread_t threads[MAXSORTTHREADS];
+    FILE * extra;
+    int k, c, numberofjobs;
+
+    //pread doesn't move the file position, so this can't upset the main thread reading from the same file
+    for (k=0;k<index->numberofentries && index->sourcefd>=0;k++)
+    {
+        if (index->extras[k]<0) continue;
+        length = pread(index->sourcefd,buffer,sizeof(buffer),index->extras[k]);
+        if (length<=0 || !(extra = fmemopen(buffer,length,"r"))) continue;
+        addindexsegment(index,k);
+        if (scantextfromfile(extra,field,MAXTEXTLENGTH,index->separator)) appendindextext(index,field);
+        if (scantextfromfile(extra,field,MAXTEXTLENGTH,index->separator)) appendindextext(index,field);
+        fclose(extra);
+    }
+    appendindextext(index,"");//makes sure there is a text to point into, even for an empty deck
+
+    //bucket the suffixes by their first two characters, then sort each bucket. The buckets are shared out
+    //between a few threads, each taking a run of them holding about the same number of suffixes
+    if (!(buckets = (unsigned int *)calloc(65536+1,sizeof(unsigned int)))) outofmemory();
+    for (i=0;i<index->length;i++) if (index->text[i]!=FIELDEND) buckets[SUFFIXBUCKET(index->text,i)+1]++;
+    for (c=1;c<=65536;c++) buckets[c] += buckets[c-1];
+    index->numberofsuffixes = buckets[65536];
+    if (!(index->suffixes = (unsigned int *)malloc((index->numberofsuffixes+1)*sizeof(unsigned int)))) outofmemory();
+    for (i=0;i<index->length;i++) if (index->text[i]!=FIELDEND) index->suffixes[buckets[SUFFIXBUCKET(index->text,i)]++] = i;
+    memmove(buckets+1,buckets,65536*sizeof(unsigned int));//each bucket's count was used up as its end, shift them back to starts
+    buckets[0] = 0;
+    numberofjobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (numberofjobs < 1) numberofjobs = 1;
+    if (numberofjobs > MAXSORTTHREADS) numberofjobs = MAXSORTTHREADS;
+    for (k=0,c=0;k<numberofjobs;k++)
+    {
+        jobs[k].index = index;
+        jobs[k].buckets = buckets;
+        jobs[k].firstbucket = c;
+        while (c<65536 && buckets[c] < (unsigned long long)index->numberofsuffixes*(k+1)/numberofjobs) c++;
+        jobs[k].lastbucket = k==numberofjobs-1 ? 65536 : c;
+        c = jobs[k].lastbucket;
+        if (k && pthread_create(&threads[k],NULL,sortbuckets,&jobs[k])) {sortbuckets(&jobs[k]);jobs[k].lastbucket = -1;}
+    }
+    sortbuckets(&jobs[0]);//this thread does the first share itself
+    for (k=1;k<numberofjobs;k++) if (jobs[k].lastbucket>=0) pthread_join(threads[k],NULL);
+    free(buckets);
+    index->ready = 1;
+    postwork(indexbuilt,NULL);
+    return NULL;
+}
+
+void * sortbuckets(void * arg)
+{
+    struct sortjob * job = (struct sortjob *)arg;
+    int c;
+    for (c=job->firstbucket;c<job->lastbucket;c++)
+    {
+        if ((c&0xff)==FIELDEND) continue;//one character fields are already in order
+        sortsuffixes(job->index->suffixes+job->buckets[c],(c<65535 ? job->buckets[c+1] : job->index->numberofsuffixes)-job->buckets[c],job->index->text,2);
+    }
+    return NULL;
+}
+
+void appendindextext(struct textindex * index, char * text)
+{
+    int length = strlen(text);
+    while (index->length+length+1 > index->capacity)
+    {
+        index->capacity = index->capacity ? 2*index->capacity : 65536;
+        if (!(index->text = (char *)realloc(index->text,index->capacity))) outofmemory();
+    }
+    while (*text) index->text[index->length++] = tolower((unsigned char)*text++);
+    index->text[index->length++] = FIELDEND;
+}
+
+void addindexsegment(struct textindex * index, int entry)
+{
+    if (index->numberofsegments==index->segmentcapacity)
+    {
+        index->segmentcapacity = index->segmentcapacity ? 2*index->segmentcapacity : 1024;
+        index->segmentstarts = (unsigned int *)realloc(index->segmentstarts,index->segmentcapacity*sizeof(unsigned int));
+        index->segmententries = (int *)realloc(index->segmententries,index->segmentcapacity*sizeof(int));
+        if (!index->segmentstarts || !index->segmententries) outofmemory();
+    }
+    index->segmentstarts[index->numberofsegments] = index->length;
+    index->segmententries[index->numberofsegments++] = entry;
+}
+
+void sortsuffixes(unsigned int * suffixes, int n, char * text, int depth)
+{
+    unsigned int swap;
+    int less, greater, i, pivot, c, a, b, m;
+    while (n > 1)
+    {
+        if (n < 12)//insertion sort for the little ones
+        {
+            for (i = 1;i < n;i++)
+            {
+                for (less = i;less > 0;less--)
+                {
+                    for (a = suffixes[less-1]+depth,b = suffixes[less]+depth;text[a]==text[b] && text[a]!=FIELDEND;a++,b++);
+                    if ((unsigned char)text[a] <= (unsigned char)text[b]) break;
+                    swap = suffixes[less];suffixes[less] = suffixes[less-1];suffixes[less-1] = swap;
+                }
+            }
+            return;
+        }
+        //median of three characters for the pivot, so already sorted runs don't make it quadratic
+        a = (unsigned char)text[suffixes[0]+depth];
+        b = (unsigned char)text[suffixes[n/2]+depth];
+        m = (unsigned char)text[suffixes[n-1]+depth];
+        pivot = a<b ? (b<m ? b : (a<m ? m : a)) : (a<m ? a : (b<m ? m : b));
+        for (less = 0,greater = n,i = 0;i < greater;)
+        {
+            c = (unsigned char)text[suffixes[i]+depth];
+            if (c < pivot) {swap = suffixes[i];suffixes[i++] = suffixes[less];suffixes[less++] = swap;}
+            else if (c > pivot) {swap = suffixes[i];suffixes[i] = suffixes[--greater];suffixes[greater] = swap;}
+            else i++;
+        }
+        sortsuffixes(suffixes,less,text,depth);
+        if (pivot!=FIELDEND) sortsuffixes(suffixes+less,greater-less,text,depth+1);//suffixes that reach the end of their field together are as good as equal
+        suffixes += greater;
+        n -= greater;
+    }
+}
+
+int findtext(struct deck * deck, char * query, struct vocab *** results)//finds every entry of a deck with the query in any field, best matches first, returning how many
 {
-    WINDOW * wbcreatevocab, * wcreatevocab;
-    PANEL * pcreatevocab;
-    struct vocab * newvocab;
-    struct listinfo * newvocablist = &norm;
-    
-    wbcreatevocab = nicebigwindow();
-    pcreatevocab = new_panel(wbcreatevocab);
-    wcreatevocab = innerwindow(wbcreatevocab);
-    windowtitle(wbcreatevocab,"Create new vocab");
-    
-    newvocab = (struct vocab *)malloc(sizeof(struct vocab));
-    if (!newvocab) outofmemory();
-    else
+    struct textindex * index;
+    char lowered[MAXTEXTLENGTH+1];
+    unsigned char * found;
+    unsigned int position, j;
+    int i, k, m, low, high, middle, first, last, rank, fields, numberofresults = 0;
+
+    *results = NULL;
+    if (!deck->textindex || deck->textindex->version!=deck->textversion) startindexing(deck);//edited since it was built
+    index = deck->textindex;
+    if (!index->ready) waitforindex(index);
+    finishindexing(deck);
+    for (m=0;query[m] && m<MAXTEXTLENGTH;m++) lowered[m] = tolower((unsigned char)query[m]);
+    lowered[m] = '\0';
+    if (!m) return 0;
+
+    //the suffixes starting with the query are all together, found with two binary searches
+    for (low=0,high=index->numberofsuffixes;low<high;)
     {
-        newvocab->question=newvocab->answer=newvocab->info=newvocab->hint=NULL;
-        wprintw(wcreatevocab,"Enter question text for this entry (max %i chars):\n",maxtextlength);
-        newvocab->question=wgettextfromkeyboard(wcreatevocab,newvocab->question,MAXTEXTLENGTH);
-        wprintw(wcreatevocab,"Enter answer text for this entry (max %i chars):\n",maxtextlength);
-        newvocab->answer=wgettextfromkeyboard(wcreatevocab,newvocab->answer,MAXTEXTLENGTH);
-        if (getyesorno("Would you like to add additional info for this entry?"))
-        {
-            wprintw(wcreatevocab,"Enter info for this entry (max %i chars):\n",maxtextlength);
-            newvocab->info=wgettextfromkeyboard(wcreatevocab,newvocab->info,MAXTEXTLENGTH);
-        }
-        else
+        middle = low+(high-low)/2;
+        if (strncmp(index->text+index->suffixes[middle],lowered,m)<0) low = middle+1;
+        else high = middle;
+    }
+    first = low;
+    for (high=index->numberofsuffixes;low<high;)
+    {
+        middle = low+(high-low)/2;
+        if (strncmp(index->text+index->suffixes[middle],lowered,m)<=0) low = middle+1;
+        else high = middle;
+    }
+    last = low;
+
+    //an entry can match more than once, in more than one field, so each is listed once, by its best match and then in deck order.
+    //Whole fields come before fields starting with the query, which come before the rest, with the question ahead of the answer in each, and info and hints last
+    if (!(found = (unsigned char *)calloc(index->numberofentries+1,1))) outofmemory();
+    for (i=first;i<last;i++)
+    {
+        position = index->suffixes[i];
+        for (low=0,high=index->numberofsegments-1;low<high;)//the last segment starting at or before the match
         {
-            newvocab->info=NULL;
-            wprintw(wcreatevocab,"No info added\n");
+            middle = low+(high-low+1)/2;
+            if (index->segmentstarts[middle]<=position) low = middle;
+            else high = middle-1;
         }
-        if (getyesorno("Would you like to add a hint to help you remember this entry?"))
+        k = index->segmententries[low];
+        for (fields=0,j=index->segmentstarts[low];j<position && fields<2;j++) fields += index->text[j]==FIELDEND;//0 for the question, 1 for the answer
+        if (low>=index->numberofentries || fields>1) rank = FINDRANKS;//info or a hint, the thread's runs of lazy ones coming after every entry's first run
+        else rank = fields+((position==index->segmentstarts[low] || index->text[position-1]==FIELDEND) ? (index->text[position+m]==FIELDEND ? 1 : 3) : 5);
+        if (!found[k]) numberofresults++;
+        if (!found[k] || rank<found[k]) found[k] = rank;
+    }
+    if (numberofresults)
+    {
+        if (!(*results = (struct vocab **)malloc(numberofresults*sizeof(struct vocab *)))) outofmemory();
+        for (rank=1,i=0;rank<=FINDRANKS;rank++) for (k=0;k<index->numberofentries;k++) if (found[k]==rank) (*results)[i++] = index->entries[k];
+    }
+    free(found);
+    return numberofresults;
+}
+
+struct vocab * pickentry(char * title, struct vocab ** entries, int numberofentries)//lets the user choose one of a list of entries, returns NULL if they don't
+{
+    WINDOW * wbpick, * wpick;
+    PANEL * ppick;
+    struct vocab * returnvalue = NULL;
+    int ch = 0, selected = 0, top = 0, rows, i;
+
+    wbpick = nicebigwindow();
+    windowtitle(wbpick,title);
+    ppick = new_panel(wbpick);
+    wpick = innerwindow(wbpick);
+    getmaxyx(wpick,nlines,ncols);
+    rows = nlines-3;
+    while (ch!=10 && ch!=27)
+    {
+        if (selected >= numberofentries) selected = numberofentries-1;
+        if (selected < 0) selected = 0;
+        if (selected < top) top = selected;
+        if (selected >= top+rows) top = selected-rows+1;
+        werase(wpick);
+        mvwprintw(wpick,0,0,"%i entr%s found. Up/down to choose, Enter to edit, Esc to go back.",numberofentries,numberofentries==1?"y":"ies");
+        for (i = 0;i < rows && top+i < numberofentries;i++)
         {
-            wprintw(wcreatevocab,"Enter hint for this entry (max %i chars):\n",maxtextlength);
-            newvocab->hint=wgettextfromkeyboard(wcreatevocab,newvocab->hint,MAXTEXTLENGTH);
+            if (top+i==selected) wattron(wpick,A_REVERSE);
+            mvwprintw(wpick,2+i,0,"%.*s = %.*s",fieldprefix(entries[top+i]->question,&entries[top+i]->questionwidth,ncols/2-2),entries[top+i]->question,fieldprefix(entries[top+i]->answer,&entries[top+i]->answerwidth,ncols/2-2),entries[top+i]->answer);
+            if (top+i==selected) wattroff(wpick,A_REVERSE);
         }
-        else
+        update_panels();
+        doupdate();
+        ch = waitforkey(wpick,0);
+        switch (ch)
         {
-            newvocab->hint=NULL;
-            wprintw(wcreatevocab,"No hint added\n");
+            case KEY_UP: selected--;break;
+            case KEY_DOWN: selected++;break;
+            case KEY_PPAGE: selected -= rows;break;
+            case KEY_NPAGE: selected += rows;break;
+            case 10: returnvalue = entries[selected];break;
         }
-        newvocab->right=0;
-        newvocab->counter=0;
-        newvocab->known=1;
+    }
+    del_panel(ppick);
+    delwin(wpick);
+    delwin(wbpick);
+    update_panels();
+    doupdate();
+    return returnvalue;
+}
 
-        if (newvocab->question==NULL||newvocab->answer==NULL) //minimal validation for valid record
+int browsedeck()//lists every entry of the current deck, sorted by question, answer, level or streak, for one to be picked to edit. Returns -1 if the editor asked for the main menu
+{
+    WINDOW * wbbrowse, * wbrowse;
+    PANEL * pbrowse;
+    struct vocab * entry, * selectedentry = NULL, ** order;
+    char * ordernames[BROWSEORDERS] = {"question","answer","level","streak"};
+    int ch = 0, sortedby = BROWSEQUESTION, reverse = 0, selected = 0, top = 0, rows, columns, streak, i, n, menuresult = 0;
+
+    buildbrowseorders(currentdeck);
+    wbbrowse = nicebigwindow();
+    windowtitle(wbbrowse,"Browse Deck");
+    pbrowse = new_panel(wbbrowse);
+    wbrowse = innerwindow(wbbrowse);
+
+    while (ch!=27 && menuresult!=-1)
+    {
+        getmaxyx(wbrowse,nlines,ncols);//every time round, as the editor uses them too
+        rows = nlines-3;
+        columns = (ncols-BROWSETIERCOLUMNS-BROWSESTREAKCOLUMNS-2)/2;//for the question and for the answer, each with a gap after it
+        //only the rows on screen are drawn, so a page costs the same however big the deck is
+        n = currentdeck->browseentries;
+        order = currentdeck->browseorders[sortedby];
+        if (selectedentry)//keeps the entry that was selected in view after a re-sort or an edit, if it's still there
         {
-            popuperror("Question and/or answer are blank!");
-            del_panel(pcreatevocab);
-            delwin(wcreatevocab);
-            delwin(wbcreatevocab);
-            return NULL;
+            for (i=0;i<n && order[reverse ? n-1-i : i]!=selectedentry;i++);
+            if (i<n) selected = i;
+            selectedentry = NULL;
         }
+        if (selected >= n) selected = n-1;
+        if (selected < 0) selected = 0;
+        if (selected < top) top = selected;
+        if (selected >= top+rows) top = selected-rows+1;
 
-        if (addtolist(newvocab,newvocablist))
+        werase(wbrowse);
+        mvwprintw(wbrowse,0,0,"%i entr%s by %s%s. q/a/l/s: sort (again: reverse), Enter: edit, Esc: back.",n,n==1?"y":"ies",ordernames[sortedby],reverse?", reversed":"");
+        wattron(wbrowse,A_BOLD);
+        mvwprintw(wbrowse,2,0,"Question");
+        mvwprintw(wbrowse,2,columns,"Answer");
+        mvwprintw(wbrowse,2,2*columns,"Level");
+        mvwprintw(wbrowse,2,ncols-BROWSESTREAKCOLUMNS,"Streak");
+        wattroff(wbrowse,A_BOLD);
+        for (i = 0;i < rows && top+i < n;i++)
         {
-            del_panel(pcreatevocab);
-            delwin(wcreatevocab);
-            delwin(wbcreatevocab);
-            return newvocab;
+            entry = order[reverse ? n-1-(top+i) : top+i];
+            streak = RIGHT(entry) ? COUNTER(entry) : -COUNTER(entry);
+            if (top+i==selected) {wattron(wbrowse,A_REVERSE);mvwprintw(wbrowse,3+i,0,"%*s",ncols,"");}
+            mvwprintw(wbrowse,3+i,0,"%.*s",fieldprefix(entry->question,&entry->questionwidth,columns-2),entry->question);
+            mvwprintw(wbrowse,3+i,columns,"%.*s",fieldprefix(entry->answer,&entry->answerwidth,columns-2),entry->answer);
+            mvwprintw(wbrowse,3+i,2*columns,"%.*s",textprefix(tiers[KNOWN(entry)].name,BROWSETIERCOLUMNS),tiers[KNOWN(entry)].name);
+            mvwprintw(wbrowse,3+i,ncols-BROWSESTREAKCOLUMNS,streak>0 ? "%+*d" : "%*d",BROWSESTREAKCOLUMNS,streak);
+            if (top+i==selected) wattroff(wbrowse,A_REVERSE);
         }
-        else
+        update_panels();
+        doupdate();
+
+        ch = waitforkey(wbrowse,0);
+        switch (ch)
         {
-            del_panel(pcreatevocab);
-            delwin(wcreatevocab);
-            delwin(wbcreatevocab);
-            return NULL;
+            case KEY_UP: selected--;break;
+            case KEY_DOWN: selected++;break;
+            case KEY_PPAGE: selected -= rows;break;
+            case KEY_NPAGE: selected += rows;break;
+            case KEY_HOME: selected = 0;break;
+            case KEY_END: selected = n-1;break;
+            case 'q': case 'Q': case 'a': case 'A': case 'l': case 'L': case 's': case 'S':
+                i = strchr("qals",ch|0x20)-"qals";
+                if (n) selectedentry = order[reverse ? n-1-selected : selected];
+                reverse = i==sortedby ? !reverse : 0;
+                sortedby = i;
+                break;
+            case 10: if (!n) break;
+                selectedentry = order[reverse ? n-1-selected : selected];
+                for (menuresult=1;menuresult==1;) menuresult = editormenu(selectedentry,0);
+                buildbrowseorders(currentdeck);//the entry may have been changed, moved or deleted
+                break;
         }
     }
+    del_panel(pbrowse);
+    delwin(wbrowse);
+    delwin(wbbrowse);
+    update_panels();
+    doupdate();
+    return menuresult==-1 ? -1 : 0;
 }
 
 struct vocab * vocabsearch(char * searchstring)//returns a pointer to vocab entry if the question or answer matches given search string
@@ -694,16 +3768,9 @@ struct vocab * vocabsearch(char * searchstring)//returns a pointer to vocab entr
     struct vocab * entry = NULL, * match = NULL;
     struct listinfo * list = NULL;
     int i,numberofmatches=0;
-    for (i=0;i<=3;i++)
+    for (i=0;i<numberoftiers;i++)
     {
-        switch (i)
-        {
-            case 0: list = &n2l;break;
-            case 1: list = &norm;break;
-            case 2: list = &known;break;
-            case 3: list = &old;break;
-            default: popuperror("Loop Error!");break;
-        }
+        list = levellist(currentdeck,i);
         entry=list->head;
         while (entry!=NULL)
         {
@@ -715,16 +3782,9 @@ struct vocab * vocabsearch(char * searchstring)//returns a pointer to vocab entr
             entry=entry->next;
         }
     }
-    for (i=0;i<=3;i++)
+    for (i=0;i<numberoftiers;i++)
     {
-        switch (i)
-        {
-            case 0: list = &n2l;break;
-            case 1: list = &norm;break;
-            case 2: list = &known;break;
-            case 3: list = &old;break;
-            default: popuperror("Loop Error!");break;
-        }
+        list = levellist(currentdeck,i);
         entry=list->head;
         while (entry!=NULL)
         {
@@ -767,16 +3827,9 @@ struct vocab * vocabfuzzysearch(char * searchstring)//returns a pointer to vocab
     for(i=0;i<10;i++) {matches[i].entry = NULL;matches[i].score = 0;}
 
     //cycle through all entries...
-    for (i=0;i<=3;i++)
+    for (i=0;i<numberoftiers;i++)
     {
-        switch (i)
-        {
-            case 0: list = &n2l;break;
-            case 1: list = &norm;break;
-            case 2: list = &known;break;
-            case 3: list = &old;break;
-            default: popuperror("Loop Error!");break;
-        }
+        list = levellist(currentdeck,i);
         entry=list->head;
         while (entry!=NULL)
         {
@@ -842,7 +3895,7 @@ struct vocab * vocabfuzzysearch(char * searchstring)//returns a pointer to vocab
     doupdate();
     while (1)
     {
-        i=wgetch(wfuzzysearch);
+        i=waitforkey(wfuzzysearch,0);
         switch (i)
         {
             case 10: ITEMselected = current_item(fuzzysearchmenu);
@@ -905,12 +3958,9 @@ int editormenu(struct vocab * entry, int fromtest)//shows menu to edit current e
     struct listinfo * list;
     int optionsmenuchoice = '\n';
     int i,j, returnvalue = 1, numberofchoices = ARRAY_SIZE(editormenuchoices);
-    changedflag = 1;
     if (entry==NULL) {popuperror("Somehow received blank entry! Fix me.");return 0;}
-    if (entry->known==0) list = &n2l;
-    else if (entry->known==1) list = &norm;
-    else if (entry->known==2) list = &known;
-    else if (entry->known==3) list = &old;
+    entry->deck->changed = 1;
+    if (KNOWN(entry)<numberoftiers) list = levellist(entry->deck,KNOWN(entry));
     else {popuperror("Unable to deduce list!!");exit(1);}
 
     if(!(editormenuitems = (ITEM**)calloc(numberofchoices-1,sizeof(ITEM*)))) outofmemory(); //the -1 is because 2 entries are context specific
@@ -931,8 +3981,8 @@ int editormenu(struct vocab * entry, int fromtest)//shows menu to edit current e
     weditormenu=innerwindow(wbeditormenu);
 
     wprintw(weditormenu,"Current Entry:\n\nQuestion: %s\nAnswer: '%s'\n",entry->question,entry->answer);
-    if (entry->info) wprintw(weditormenu,"Info: %s\n",entry->info);else wprintw(weditormenu,"No info.\n");
-    if (entry->hint) wprintw(weditormenu,"Hint: %s\n\n",entry->hint);else wprintw(weditormenu,"No hint.\n\n");
+    if (vocabinfo(entry)) wprintw(weditormenu,"Info: %s\n",entry->info);else wprintw(weditormenu,"No info.\n");
+    if (vocabhint(entry)) wprintw(weditormenu,"Hint: %s\n\n",entry->hint);else wprintw(weditormenu,"No hint.\n\n");
     editormenu = new_menu(editormenuitems);
     set_menu_win(editormenu,weditormenu);
     set_menu_sub(editormenu,derwin(weditormenu,0,0,7,0));
@@ -942,12 +3992,12 @@ int editormenu(struct vocab * entry, int fromtest)//shows menu to edit current e
     update_panels();
     doupdate();
 
-    optionsmenuchoice=wgetch(weditormenu);
+    optionsmenuchoice=waitforkey(weditormenu,0);
     while (optionsmenuchoice==KEY_UP || optionsmenuchoice==KEY_DOWN)
     {
         if (optionsmenuchoice==KEY_UP) menu_driver(editormenu,REQ_UP_ITEM);
         else menu_driver(editormenu,REQ_DOWN_ITEM);
-        optionsmenuchoice=wgetch(weditormenu);
+        optionsmenuchoice=waitforkey(weditormenu,0);
     }
     if (optionsmenuchoice==10)
     {
@@ -955,26 +4005,39 @@ int editormenu(struct vocab * entry, int fromtest)//shows menu to edit current e
         pselected=item_userptr(ITEMselected);
         optionsmenuchoice=*pselected;
     }
+    if (entry->deck->map && strchr("qaihd",optionsmenuchoice))//text of a compiled deck is mapped read-only
+    {
+        popupinfo(3,"Compiled deck:","This entry belongs to a read-only compiled deck, so it can't be changed or deleted.\nExport the deck as a .~sv file and load that to edit it.");
+        optionsmenuchoice = 0;
+    }
     switch (optionsmenuchoice)
     {
         case 'q': mvwprintw(weditormenu,8+j,0,"Enter new question text for this entry (max %i chars):\n",maxtextlength);
         entry->question=wgettextfromkeyboard(weditormenu,entry->question,MAXTEXTLENGTH);
+        entry->questionwidth=0;
+        entry->deck->textversion++;
         break;
         case 'a': mvwprintw(weditormenu,8+j,0,"Enter new answer text for this entry (max %i chars):\n",maxtextlength);
         entry->answer=wgettextfromkeyboard(weditormenu,entry->answer,MAXTEXTLENGTH);
+        free(entry->matcher);//compiled from the old answer
+        entry->matcher=NULL;
+        entry->answerwidth=0;
+        entry->deck->textversion++;
         break;
         case 'i': mvwprintw(weditormenu,8+j,0,"Enter new info for this entry (max %i chars):\n",maxtextlength);
         entry->info=wgettextfromkeyboard(weditormenu,entry->info,MAXTEXTLENGTH);
+        entry->deck->textversion++;
         break;
         case 'h': mvwprintw(weditormenu,8+j,0,"Enter new hint for this entry (max %i chars):\n",maxtextlength);
         entry->hint=wgettextfromkeyboard(weditormenu,entry->hint,MAXTEXTLENGTH);
+        entry->deck->textversion++;
         break;
-        case 'p': if(list==&n2l)popupinfo(3,"","Already marked as priority!"); //was using = instead of == in if condition, thank you very much gcc compiler output :-)
+        case 'p': if(list==levellist(entry->deck,0))popupinfo(3,"","Already marked as priority!"); //was using = instead of == in if condition, thank you very much gcc compiler output :-)
                   else
                   {
                       removefromlist(entry,list,0);
-                      entry->counter = 0;
-                      list=&n2l;
+                      setprogress(entry,RIGHT(entry),0);
+                      list=levellist(entry->deck,0);
                       addtolist(entry,list);
                       popupinfo(4,"","This entry will be brought up more often");
                   }
@@ -997,6 +4060,7 @@ int editormenu(struct vocab * entry, int fromtest)//shows menu to edit current e
         case 'r': if (fromtest) popupinfo(3,"Testing Mode:","Database management is not available from testing mode.\nReturn to the main menu and select 'Manage database'.");
                   else {returnvalue = 0;goto cleanup;}
         break;
+        case 0: break;
         default: popupinfo(2,"Sorry:","Invalid choice");
     }
     if (getyesorno("Select again from the options menu?")) returnvalue = 1;
@@ -1024,14 +4088,22 @@ void testme()
 {
     WINDOW * wbtestme = NULL, * wtestme = NULL;
     PANEL * ptestme = NULL;
-    int list_selector=0, entry_selector=0, bringupmenu = 0, testagain=1, menuresult=0, usedhint=0;
-    int n2l_flag=0; //Prevents 'need to learn's coming up twice in a row
-    struct listinfo * currentlist = NULL;
+    int entry_selector=0, bringupmenu = 0, testagain=1, menuresult=0, usedhint=0, grade=GRADEWRONG;
+    struct timespec shown, answered;//for timing the answer
+    int i, lastlevel=-1; //tier drawn from last time, -1 before the first question
+    int blockedtiers = 0;//norepeat tiers drawn from since the new entries' tier last was, which aren't drawn from again until it has been
+    int slow=0, counted=GRADEWRONG;//whether a right answer was slow, and the grade it counts as for streaks and tiers
+    unsigned int latency, usual = 0;//this answer's time in ms, and the entry's average before it
+    int currentlevel=1, newlevel; //'known' level of the list being drawn from, in every deck being tested
     struct vocab * currententry = NULL;
     int testmenuchoice = '\n';
+    char feedback[2*MAXTEXTLENGTH+1] = "";//how the last answer of a rapid drill went, shown until the next is given
+    struct drillsummary summary = {0};
     char * youranswer = (char *)malloc(MAXTEXTLENGTH+1);
     if (!youranswer) outofmemory();
+    clock_gettime(CLOCK_MONOTONIC,&summary.started);
 
+    for (i=0;i<numberofdecks;i++) if (deckintest(decks[i])) readlatencies(decks[i]);
     wbtestme=nicebigwindow();
     windowtitle(wbtestme,"Testing mode:");
     ptestme=new_panel(wbtestme);
@@ -1040,55 +4112,39 @@ void testme()
     while (testagain)
     {
         werase(wtestme);
+        checkwatcheddecks();//between questions, so no entry is held on to while the deck changes
+        checksharedprogress();
 
-        //select a list at random, using the percentage probabilities in the if statements.
-        list_selector = (rand() % 100)+1;
-        if (list_selector>100) {popuperror("Problem with random number generator. Fix it!");exit(1);}
-        else if (list_selector==100) currentlist = &old;
-        else if (list_selector>94) currentlist = &known;
-        else if (list_selector>32) {n2l_flag=0;currentlist=&norm;} //use norm list and cancel n2l flag (not cancelled with other lists)
-        else if (list_selector<33) currentlist = &n2l;
-
-        //do a little control over random selection
-        if (currentlist==&n2l && n2l_flag)
-        {
-	    currentlist=&norm;
-	    n2l_flag=0; //if n2l list was used last time as well (flag is set), use entry from the norm list instead
-	}
-        if (currentlist==&n2l) n2l_flag = 1; //is using n2l this time, set flag so it won't be used next time as well
-
-        if (currentlist->entries==0) currentlist = &norm;//if current list is empty, default to normal list
-        if (currentlist->entries==0 && !n2l_flag) currentlist = &n2l;//if normal list is empty, try n2l list if it wasn't used last time
-        if (currentlist->entries==0 && list_selector%10==5) currentlist = &old;//if list is still empty, in 10% of cases try old list
-        if (currentlist->entries==0) currentlist = &known;//in the other 90% of cases, or if old is empty, use the known list
-        if (currentlist->entries==0) currentlist = &old;//if known list is empty, try the old list
-        if (currentlist->entries==0) {currentlist = &n2l;n2l_flag=1;}//if old list is empty, use n2l list EVEN if it was used last time
-        if (currentlist->entries==0) {popupinfo(3,"","No vocab loaded!");free(youranswer);clearinputbuffer();return;} //if list is STILL empty, abort
+        //select a tier at random, weighted by the roll table. Empty tiers have no rolls, so there's no falling back from one list to another
+        if (!rolltotal || lastlevel<0) buildrolltable();//rebuilt on the way in, as the decks being tested may have changed, and whenever a tier empties or fills
+        if (!rolltotal) {popupinfo(3,"","No vocab loaded!");if (summary.answers) showdrillsummary(&summary);free(youranswer);clearinputbuffer();return;} //if every list is empty, abort
+        currentlevel = lastlevel = choosetier(randomstate,rolltable,rolltotal,&blockedtiers,levelentries(newtier));
 
-        //we now have the desired list of words with at least one entry, let's select an entry at random from this list
-        entry_selector = (rand() % currentlist->entries)+1;
-        currententry = currentlist->head;
-        while (currententry->index!=entry_selector)
-        {
-            currententry = currententry->next;//move through list until index matches the random number
-            if (currententry==NULL) {sprintf(passingstring,"Indexing error!\nCurrent list selector: %i, entries: %i, entry selector: %i\n",list_selector,currentlist->entries,entry_selector);popuperror(passingstring);free(youranswer);return;}//in case not found in list
-        }
+        //we now have the desired level with at least one entry, let's select an entry at random from that level of every deck being tested
+        entry_selector = randombelow(randomstate,levelentries(currentlevel))+1;
+        currententry = selectentry(currentlevel,entry_selector);
+        if (currententry==NULL) {sprintf(passingstring,"Indexing error!\nCurrent level: %i, entries: %i, entry selector: %i\n",currentlevel,levelentries(currentlevel),entry_selector);popuperror(passingstring);free(youranswer);return;}//in case not found in list
 
-        changedflag = 1;
+        currententry->deck->changed = 1;
+        COUNTMETRIC(questions,1);
         getmaxyx(wtestme,nlines,ncols);
+        if (feedback[0]) mvwprintw(wtestme,nlines-1,0,"%.*s",textprefix(feedback,ncols),feedback);
         mvwprintw(wtestme,0,0,"Translate the following:\n\n\t");
         wattron(wtestme, A_BOLD);
         wprintw(wtestme,"%s\n\n",currententry->question);
         wattroff(wtestme, A_BOLD);
         mvwprintw(wtestme,0,ncols-14,"Score: %.1f%%",calculatescore(0));
         wmove(wtestme,4,0);
-        if (!currententry->info) wprintw(wtestme,"There is no additional information for this entry.\n");
+        if (!vocabinfo(currententry)) wprintw(wtestme,"There is no additional information for this entry.\n");
         else wprintw(wtestme,"Useful Info: %s\n\n",currententry->info);
-        if (!currententry->hint) wprintw(wtestme,"There is no hint available for this entry.\n");
+        if (!vocabhint(currententry)) wprintw(wtestme,"There is no hint available for this entry.\n");
         else wprintw(wtestme,"There is a hint available for this entry. Enter 'h' to view it.\nIf you view the hint, correct answers will not improve your score.\n");
         wprintw(wtestme,"\nYour Translation");
         if (currententry->hint) wprintw(wtestme," (or 'h' for hint)");
+        if (rapiddrill) wprintw(wtestme,", Enter alone for options");
         wprintw(wtestme,":\n\n\t");
+        clock_gettime(CLOCK_MONOTONIC,&shown);
+        marktime(TIMEQUESTION);
         wgettextfromkeyboard(wtestme,youranswer,MAXTEXTLENGTH);
 
         if (currententry->hint) //if there's a hint available...
@@ -1103,122 +4159,650 @@ void testme()
         }
 
         wprintw(wtestme,"\n");
+        clock_gettime(CLOCK_MONOTONIC,&answered);
+
+        feedback[0] = '\0';
+        if (rapiddrill && !youranswer[0]) bringupmenu = 1;//nothing typed is the way out of a rapid drill, as a right answer goes straight on to the next question
+        else
+        {
+            latency = (answered.tv_sec-shown.tv_sec)*1000+(answered.tv_nsec-shown.tv_nsec)/1000000;
+            grade = gradeanswer(currententry,youranswer);
+            slow = slowanswers && grade==GRADERIGHT && !usedhint && currententry->latency && latency>SLOWANSWERFACTOR*currententry->latency;
+            counted = slow ? GRADENEARMISS : grade;//a slow right answer doesn't add to the streak, or move the entry up
+            recordanswer(currententry,counted,usedhint);
+            recordhistory(currententry,grade,usedhint,latency);
+            COUNTMETRIC(answers[grade],1);
+            if (usedhint) COUNTMETRIC(hints,1);
+            usual = currententry->latency;
+            if (!usedhint) currententry->latency = averagelatency(currententry->latency,latency);//the time with the hint includes reading it
+        }
+        if (rapiddrill && !bringupmenu)
+        {
+            i = COUNTER(currententry);//before moving tier starts the streak again
+            newlevel = levelafteranswer(currententry,currentlevel,counted,usedhint);
+            notedrillanswer(currententry,grade,usedhint,slow,i,currentlevel,newlevel,feedback,sizeof(feedback),&summary);
+            if (grade!=GRADERIGHT)//a wrong answer waits, so the right one can be taken in
+            {
+                getmaxyx(wtestme,nlines,ncols);
+                mvwprintw(wtestme,0,ncols-14,"Score: %.1f%%",calculatescore(0));
+                wattron(wtestme,A_BOLD);
+                mvwprintw(wtestme,nlines-2,0,"%.*s",textprefix(feedback,ncols),feedback);
+                wattroff(wtestme,A_BOLD);
+                mvwprintw(wtestme,nlines-1,0,"Press 'o' for options or any other key for another question...");
+                feedback[0] = '\0';
+                testmenuchoice = waitforkey(wtestme,0);
+                if (tolower(testmenuchoice)=='o') bringupmenu = 1;
+            }
+        }
+        else if (!bringupmenu)
+        {
+            if (grade==GRADERIGHT)//if you're right
+            {
+                if (usedhint) popupinfo(2,"Well done","See if you can remember without the hint next time...");
+                else if (slow)
+                {
+                    sprintf(passingstring,"You're right, but it took %.1f seconds against your usual %.1f for this one.\nIt won't count towards moving up until it comes more quickly.",latency/1000.0,usual/1000.0);
+                    popupinfo(2,"Right, but slow",passingstring);
+                }
+                else
+                {
+                    popupinfo(4,"Yay!","You're right!");
+                    if (COUNTER(currententry)>2) {sprintf(passingstring,"You answered correctly the last %i times in a row!\n",COUNTER(currententry));popupinfo(4,"",passingstring);}
+                }
+            }
+            else if (grade==GRADENEARMISS)//if it's only a typo away
+            {
+                snprintf(passingstring,sizeof(passingstring),"Nearly! The correct answer is:\n\n%s\n\nCheck your spelling. This one won't count for or against you.",currententry->answer);
+                popupinfo(3,"Almost...",passingstring);
+            }
+            else //if you're wrong
+            {
+                snprintf(passingstring,sizeof(passingstring),"The correct answer is:\n\n%s\n",currententry->answer);
+                popupinfo(3,"Sorry!",passingstring);
+                if (COUNTER(currententry)>1) {sprintf(passingstring,"You've got this one wrong the last %i times.",COUNTER(currententry));popupinfo(3,"",passingstring);}
+            }
+
+            //make comments based on how well it's known, if it has moved to another list
+            newlevel = levelafteranswer(currententry,currentlevel,counted,usedhint);
+            if (newlevel<currentlevel && grade==GRADERIGHT) popupinfo(2,"","It will be brought up a couple more times to help you remember it.");
+            else if (newlevel>currentlevel && tiers[currentlevel].upmessage) popupinfo(4,"",tiers[currentlevel].upmessage);
+            else if (newlevel<currentlevel && tiers[currentlevel].downmessage) popupinfo(3,"",tiers[currentlevel].downmessage);
+            else if (newlevel>currentlevel)
+            {
+                sprintf(passingstring,"Looks like you know this one %s now! It's moved up to '%s'.",newlevel==numberoftiers-1?"really well":"better",tiers[newlevel].name);
+                popupinfo(4,"",passingstring);
+            }
+            else if (newlevel<currentlevel)
+            {
+                sprintf(passingstring,"This one could do with some more learning, so it's moved back to '%s'.",tiers[newlevel].name);
+                popupinfo(3,"",passingstring);
+            }
+
+            getmaxyx(wtestme,nlines,ncols);
+            mvwprintw(wtestme,0,ncols-14,"Score: %.1f%%",calculatescore(0));
+            mvwprintw(wtestme,nlines-1,0,"Press 'o' for options or any other key for another question...");
+            testmenuchoice = waitforkey(wtestme,0);
+            if (tolower(testmenuchoice)=='o') bringupmenu = 1;
+        }
+        while (bringupmenu)
+        {
+            menuresult = editormenu(currententry,1);
+            switch (menuresult)
+            {
+                case -1: bringupmenu=testagain=0;break;
+                case  0: bringupmenu=0;break;
+                default: continue;
+            }
+        }
+    }
+    for (i=0;i<numberofdecks;i++) flushhistory(decks[i]);
+    if (summary.answers) showdrillsummary(&summary);
+    del_panel(ptestme);
+    delwin(wtestme);
+    delwin(wbtestme);
+    free(youranswer);
+    return;
+}
+
+int foldcodepoint(int codepoint)
+{
+    //base letters of U+00C0 to U+017F (Latin-1 Supplement and Latin Extended-A), '-' where there isn't one
+    static const char baseletters[] =
+        "AAAAAA-CEEEEIIII" "DNOOOOO-OUUUUY--" "aaaaaa-ceeeeiiii" "dnooooo-ouuuuy-y"
+        "AaAaAaCcCcCcCcDd" "DdEeEeEeEeEeGgGg" "GgGgHhHhIiIiIiIi" "Ii--JjKk-LlLlLlL"
+        "lLlNnNnNn---OoOo" "Oo--RrRrRrSsSsSs" "SsTtTtTtUuUuUuUu" "UuUuWwYyYZzZzZzs";
+    if (folddiacritics && codepoint>=0xc0 && codepoint<=0x17f && baseletters[codepoint-0xc0]!='-') codepoint = baseletters[codepoint-0xc0];
+    if (!foldcase) return codepoint;
+    if (codepoint<0x80) return tolower(codepoint);
+    if (codepoint>=0xc0 && codepoint<=0xde && codepoint!=0xd7) return codepoint+0x20;//Latin-1
+    if (codepoint==0x178) return 0xff;
+    if ((codepoint>=0x100 && codepoint<=0x137) || (codepoint>=0x14a && codepoint<=0x177)) return codepoint|1;//Latin Extended-A, capitals are even...
+    if ((codepoint>=0x139 && codepoint<=0x148) || (codepoint>=0x179 && codepoint<=0x17e)) return codepoint+(codepoint&1);//...or odd
+    if (codepoint>=0x391 && codepoint<=0x3a9 && codepoint!=0x3a2) return codepoint+0x20;//Greek
+    if (codepoint>=0x410 && codepoint<=0x42f) return codepoint+0x20;//Cyrillic
+    if (codepoint>=0x400 && codepoint<=0x40f) return codepoint+0x50;
+    return codepoint;
+}
+
+void normaliseanswer(char * source, char * target)
+{
+    unsigned char * s = (unsigned char *)source;
+    int codepoint, j = 0, space = 0;
+    while (*s)
+    {
+        if (*s=='(' || *s==')') {s++;continue;}//brackets only mark optional parts, so they don't have to be typed
+        if (isspace(*s)) {space = 1;s++;continue;}//runs of spaces count as one, and none at either end
+        if (space && j) target[j++] = ' ';
+        space = 0;
+        if (*s<0x80) codepoint = *s++;
+        else if ((s[0]&0xe0)==0xc0 && (s[1]&0xc0)==0x80)//two byte UTF-8 covers the accented latin, greek and cyrillic letters that can be folded
+        {
+            codepoint = ((s[0]&0x1f)<<6)|(s[1]&0x3f);
+            s += 2;
+        }
+        else {target[j++] = *s++;continue;}//anything else is copied as it is
+        codepoint = foldcodepoint(codepoint);//folding never makes a character longer, so target can be the same size as source
+        if (codepoint<0x80) target[j++] = codepoint;
+        else
+        {
+            target[j++] = 0xc0|(codepoint>>6);
+            target[j++] = 0x80|(codepoint&0x3f);
+        }
+    }
+    target[j] = '\0';
+}
+
+unsigned int texthash(char * text)
+{
+    unsigned int hash = 2166136261u;
+    while (*text) {hash ^= (unsigned char)*text++;hash *= 16777619u;}
+    return hash;
+}
+
+struct answermatcher * compileanswer(char * answer)
+{
+    struct answermatcher * matcher;
+    char * forms, * expanded, * normalised, * start, * end, * c, * text;
+    char * optionalparts[MAXOPTIONALPARTS];
+    int i, depth, mask, pass, alternatives, numberofparts, numberofforms = 0, formslength = 0, formscapacity;
+    unsigned int size, slot, hash;
+
+    //every accepted form goes into forms, one after another, before the table is sized to fit them
+    formscapacity = 4*(strlen(answer)+1)+MAXTEXTLENGTH;
+    if (!(forms = (char *)malloc(formscapacity))) outofmemory();
+    if (!(expanded = (char *)malloc(strlen(answer)+1))) outofmemory();
+    if (!(normalised = (char *)malloc(strlen(answer)+1))) outofmemory();
+    for (c = answer,depth = 0,alternatives = 0;*c;c++)//are there any alternatives outside brackets?
+    {
+        if (*c=='(') depth++;
+        else if (*c==')' && depth) depth--;
+        else if (*c=='/' && !depth) alternatives = 1;
+    }
+    for (pass = 0,start = answer;;)
+    {
+        if (!pass) end = answer+strlen(answer);//the first time round, the whole answer is one form
+        else
+        {
+            for (end = start,depth = 0;*end && !(*end=='/' && !depth);end++)//then each alternative, not splitting inside brackets
+            {
+                if (*end=='(') depth++;
+                else if (*end==')' && depth) depth--;
+            }
+        }
+        for (c = start,numberofparts = 0,depth = 0;c<end;c++)
+        {
+            if (*c=='(' && !depth++ && numberofparts<MAXOPTIONALPARTS) optionalparts[numberofparts++] = c;
+            else if (*c==')' && depth) depth--;
+        }
+        for (mask = 0;mask < (1<<numberofparts);mask++)//each combination of bracketed parts left in or out
+        {
+            for (c = start,i = 0,text = expanded;c<end;c++)
+            {
+                if (i<numberofparts && c==optionalparts[i] && (mask & (1<<i++)))
+                {
+                    for (depth = 0;c<end;c++)//leave this part out, up to its closing bracket
+                    {
+                        if (*c=='(') depth++;
+                        else if (*c==')' && !--depth) break;
+                    }
+                    if (c==end) break;
+                    continue;
+                }
+                *text++ = *c;
+            }
+            *text = '\0';
+            normaliseanswer(expanded,normalised);
+            if (!*normalised) continue;
+            if (formslength+strlen(normalised)+1 > formscapacity)
+            {
+                formscapacity = 2*formscapacity+strlen(normalised)+1;
+                if (!(forms = (char *)realloc(forms,formscapacity))) outofmemory();
+            }
+            strcpy(forms+formslength,normalised);
+            formslength += strlen(normalised)+1;
+            numberofforms++;
+        }
+        if (pass++ ? !*end : !alternatives) break;
+        if (pass>1) start = end+1;
+    }
+    free(expanded);
+    free(normalised);
+
+    //one block holds the table and the text of every form
+    for (size = 4;size < 2*numberofforms;size *= 2);
+    if (!(matcher = (struct answermatcher *)malloc(sizeof(struct answermatcher)+size*(sizeof(unsigned int)+sizeof(char *))+formslength))) outofmemory();
+    matcher->version = matcherversion;
+    matcher->size = size;
+    matcher->forms = (char **)(matcher+1);
+    matcher->hashes = (unsigned int *)(matcher->forms+size);
+    text = (char *)(matcher->hashes+size);
+    memcpy(text,forms,formslength);
+    free(forms);
+    for (i = 0;i < size;i++) matcher->forms[i] = NULL;
+    for (i = 0;i < numberofforms;i++,text += strlen(text)+1)
+    {
+        hash = texthash(text);
+        for (slot = hash & (size-1);matcher->forms[slot];slot = (slot+1) & (size-1)) if (matcher->hashes[slot]==hash && !strcmp(matcher->forms[slot],text)) break;
+        if (matcher->forms[slot]) continue;//same form reached another way
+        matcher->forms[slot] = text;
+        matcher->hashes[slot] = hash;
+    }
+    return matcher;
+}
+
+int editdistance(char * pattern, char * text, int limit)
+{
+    unsigned long long peq[256], vp = ~0ULL, vn = 0, d0 = 0, hp, hn, eq, lasteq = 0, transposed, high;
+    int row[3][MAXTEXTLENGTH+2], * twoback = row[0], * previous = row[1], * current = row[2], * swap;
+    int m = strlen(pattern), n = strlen(text), i, j, lo, hi, best, cost, score = m;
+    unsigned char * a = (unsigned char *)pattern, * b = (unsigned char *)text;
+
+    if (m-n > limit || n-m > limit) return limit+1;//the length difference alone is too much
+    if (!m || !n) return m+n;
+    if (m<=64)
+    {
+        //Myers' bit-parallel algorithm, with Hyyro's extension for transpositions: bit i of each vector is the
+        //difference between rows i and i+1 of the current column, so a whole column is done in a few word operations
+        for (j = 0;j < n;j++) peq[b[j]] = 0;
+        for (i = 0;i < m;i++) peq[a[i]] = 0;
+        for (i = 0;i < m;i++) peq[a[i]] |= 1ULL<<i;
+        high = 1ULL<<(m-1);
+        for (j = 0;j < n;j++)
+        {
+            eq = peq[b[j]];
+            transposed = (((~d0) & eq) << 1) & lasteq;
+            d0 = (((eq & vp) + vp) ^ vp) | eq | vn | transposed;
+            hp = vn | ~(d0 | vp);
+            hn = d0 & vp;
+            if (hp & high) score++;
+            else if (hn & high) score--;
+            if (score-(n-1-j) > limit) return limit+1;//even if every remaining character matched, it couldn't get back under the limit
+            hp = (hp<<1) | 1;
+            hn <<= 1;
+            vp = hn | ~(d0 | hp);
+            vn = hp & d0;
+            lasteq = eq;
+        }
+        return score<=limit ? score : limit+1;
+    }
+
+    //patterns too long for one word: ordinary dynamic programming, but only along the diagonal band that can stay within limit
+    if (n > MAXTEXTLENGTH) return limit+1;
+    for (j = 0;j <= n;j++) previous[j] = j<=limit ? j : limit+1;
+    for (i = 1;i <= m;i++)
+    {
+        lo = i-limit>1 ? i-limit : 1;
+        hi = i+limit<n ? i+limit : n;
+        current[0] = i<=limit ? i : limit+1;
+        current[lo-1] = lo>1 ? limit+1 : current[0];
+        best = current[lo-1];
+        for (j = lo;j <= hi;j++)
+        {
+            cost = previous[j-1]+(a[i-1]!=b[j-1]);
+            if (previous[j]+1 < cost) cost = previous[j]+1;
+            if (current[j-1]+1 < cost) cost = current[j-1]+1;
+            if (i>1 && j>1 && a[i-1]==b[j-2] && a[i-2]==b[j-1] && twoback[j-2]+1 < cost) cost = twoback[j-2]+1;
+            current[j] = cost<=limit ? cost : limit+1;
+            if (current[j] < best) best = current[j];
+        }
+        if (hi < n) current[hi+1] = limit+1;
+        if (best > limit) return limit+1;
+        swap = twoback;twoback = previous;previous = current;current = swap;
+    }
+    return previous[n];
+}
+
+int gradeanswer(struct vocab * entry, char * response)
+{
+    char normalised[MAXTEXTLENGTH+1];
+    unsigned int hash, slot;
+    int limit;
+    struct answermatcher * matcher = entry->matcher;
+    if (!matcher || matcher->version!=matcherversion)//compiled the first time it's needed, and again if the options have changed
+    {
+        free(matcher);
+        matcher = entry->matcher = compileanswer(entry->answer);
+    }
+    if (strlen(response)>MAXTEXTLENGTH) return GRADEWRONG;
+    normaliseanswer(response,normalised);
+    hash = texthash(normalised);
+    for (slot = hash & (matcher->size-1);matcher->forms[slot];slot = (slot+1) & (matcher->size-1))
+    {
+        if (matcher->hashes[slot]==hash && !strcmp(matcher->forms[slot],normalised)) return GRADERIGHT;
+    }
+    if (!nearmissgrading || !*normalised) return GRADEWRONG;
+    for (slot = 0;slot < matcher->size;slot++)//not an exact match, so see if it's within a typo or two of any accepted form
+    {
+        if (!matcher->forms[slot]) continue;
+        limit = strlen(matcher->forms[slot])/5;//none for answers under 5 characters, one for up to 9, then two
+        if (limit > MAXNEARMISS) limit = MAXNEARMISS;
+        if (limit && editdistance(matcher->forms[slot],normalised,limit)<=limit) return GRADENEARMISS;
+    }
+    return GRADEWRONG;
+}
+
+void recordanswer(struct vocab * entry, int grade, int usedhint)
+{
+    int right = RIGHT(entry), counter = COUNTER(entry);
+    updatestreak(&right,&counter,grade,usedhint);
+    setprogress(entry,right,counter);
+}
+
+void updatestreak(int * right, int * counter, int grade, int usedhint)
+{
+    if (grade==GRADERIGHT)
+    {
+        if (usedhint || !*right) *counter = 1;//using the hint starts the streak again
+        else ++*counter;
+        *right = 1;
+    }
+    else if (grade==GRADEWRONG)
+    {
+        if (*right) *counter = 1;
+        else ++*counter;
+        *right = 0;
+    }
+    //a near miss leaves the streak as it was
+}
+
+int levelafteranswer(struct vocab * entry, int level, int grade, int usedhint)
+{
+    int newlevel = tierafteranswer(level,COUNTER(entry),grade,usedhint);
+    if (newlevel!=level)
+    {
+        if (newlevel>level) COUNTMETRIC(promotions[newlevel],1);
+        else COUNTMETRIC(demotions[newlevel],1);
+        if (!(usedhint && level==numberoftiers-1)) setprogress(entry,RIGHT(entry),1);//the streak starts again on the new list
+        movetolevel(entry,level,newlevel);
+    }
+    return newlevel;
+}
+
+int tierafteranswer(int level, int counter, int grade, int usedhint)
+{
+    int top = (level==numberoftiers-1);
+    if (grade==GRADERIGHT)
+    {
+        if (usedhint && top) return level-1;//a top tier one that needed the hint gets brought up a couple more times
+        if (!top && tiers[level].promoteafter && counter>=tiers[level].promoteafter) return level+1;
+    }
+    else if (grade==GRADEWRONG)
+    {
+        if (tiers[level].demoteafter && counter>=tiers[level].demoteafter) return tiers[level].demoteto;
+    }
+    return level;
+}
+
+void notedrillanswer(struct vocab * entry, int grade, int usedhint, int slow, int streak, int level, int newlevel, char * feedback, int size, struct drillsummary * summary)
+{
+    int used;
+    summary->answers++;
+    if (grade==GRADERIGHT)
+    {
+        summary->right++;
+        used = snprintf(feedback,size,"Right%s: %s = %s.",usedhint ? ", with the hint" : slow ? " but slow, so it won't count towards moving up" : "",entry->question,entry->answer);
+        if (streak>2 && !usedhint && !slow && used<size) used += snprintf(feedback+used,size-used," %i in a row!",streak);
+    }
+    else if (grade==GRADENEARMISS)
+    {
+        summary->nearmisses++;
+        used = snprintf(feedback,size,"Nearly! The correct answer is %s. Check your spelling, this one won't count.",entry->answer);
+    }
+    else
+    {
+        summary->wrong++;
+        used = snprintf(feedback,size,"Sorry! The correct answer is %s.",entry->answer);
+        if (streak>1 && used<size) used += snprintf(feedback+used,size-used," Wrong the last %i times.",streak);
+    }
+    if (newlevel==level) return;
+    if (used<size) snprintf(feedback+used,size-used," Now in '%s'.",tiers[newlevel].name);
+    if (newlevel>level) summary->movedup++;
+    else summary->moveddown++;
+    if (summary->moves<MAXDRILLMOVES)
+    {
+        snprintf(summary->move[summary->moves++],MAXDRILLNOTE+1,"  %.*s: '%s' to '%s'",textprefix(entry->question,40),entry->question,tiers[level].name,tiers[newlevel].name);
+    }
+}
+
+void showdrillsummary(struct drillsummary * summary)
+{
+    char text[MAXDRILLMOVES*(MAXDRILLNOTE+1)+400];
+    struct timespec now;
+    double minutes;
+    int i, used;
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    minutes = ((now.tv_sec-summary->started.tv_sec)+(now.tv_nsec-summary->started.tv_nsec)/1e9)/60.0;
+    used = snprintf(text,sizeof(text),"You answered %i question%s in %.1f minutes, %.1f a minute:\n%i right, %i nearly and %i wrong.\n",
+        summary->answers,summary->answers==1 ? "" : "s",minutes,minutes>0 ? summary->answers/minutes : 0.0,summary->right,summary->nearmisses,summary->wrong);
+    if (summary->movedup || summary->moveddown)
+    {
+        used += snprintf(text+used,sizeof(text)-used,"\n%i entr%s moved up a tier and %i moved down:\n",summary->movedup,summary->movedup==1 ? "y" : "ies",summary->moveddown);
+        for (i=0;i<summary->moves;i++) used += snprintf(text+used,sizeof(text)-used,"%s\n",summary->move[i]);
+        if (summary->movedup+summary->moveddown>summary->moves) snprintf(text+used,sizeof(text)-used,"  and %i more.\n",summary->movedup+summary->moveddown-summary->moves);
+    }
+    popupinfo(4,"Drill finished",text);
+}
+
+void optionsmenu()
+{
+    char casechoice[60], accentchoice[60], nearmisschoice[60], slowchoice[60], rapidchoice[60];
+    char * optionschoices[] = {casechoice,accentchoice,nearmisschoice,slowchoice,rapidchoice,"Done"};
+    int choice = 0;
+    while (choice!=5)
+    {
+        sprintf(casechoice,"Ignore upper/lower case in answers: %s",foldcase?"yes":"no");
+        sprintf(accentchoice,"Accept answers typed without accents: %s",folddiacritics?"yes":"no");
+        sprintf(nearmisschoice,"Let off answers with a small typo: %s",nearmissgrading?"yes":"no");
+        sprintf(slowchoice,"Hold back slow right answers from moving up: %s",slowanswers?"yes":"no");
+        sprintf(rapidchoice,"Rapid drill, with no popups between questions: %s",rapiddrill?"yes":"no");
+        choice = getchoice("Grading options.\nAnswers with alternatives separated by '/' accept any of them,\nand parts in brackets may be left out.\nA small typo can be let off as a near miss, which counts neither for nor against you,\nand so can a right answer that took over twice as long as usual.",optionschoices,ARRAY_SIZE(optionschoices));
+        switch (choice)
+        {
+            case 0: foldcase = !foldcase;matcherversion++;break;
+            case 1: folddiacritics = !folddiacritics;matcherversion++;break;
+            case 2: nearmissgrading = !nearmissgrading;break;
+            case 3: slowanswers = !slowanswers;break;
+            case 4: rapiddrill = !rapiddrill;break;
+        }
+    }
+}
+
+void openeventloop()
+{
+    if (pipe2(wakefds,O_NONBLOCK|O_CLOEXEC)) wakefds[0] = wakefds[1] = -1;//posted work then waits for the next key, which is all that's lost
+    addtimer(SHAREDPROGRESSINTERVAL,checkprogressregularly,NULL);
+}
 
-        if (!strcmp(youranswer,currententry->answer))//if you're right
-        {
-            if(usedhint)
-            {
-                popupinfo(2,"Well done","See if you can remember without the hint next time...");
+void postwork(void (*function)(void *), void * argument)
+{
+    struct event * work;
+    char wake = 0;
+    if (!(work = (struct event *)malloc(sizeof(struct event)))) outofmemory();
+    work->function = function;
+    work->argument = argument;
+    work->next = NULL;
+    pthread_mutex_lock(&postedworklock);
+    if (lastpostedwork) lastpostedwork->next = work;
+    else postedwork = work;
+    lastpostedwork = work;
+    pthread_mutex_unlock(&postedworklock);
+    if (wakefds[1]>=0) while (write(wakefds[1],&wake,1)<0 && errno==EINTR);//if the pipe is full, a wake-up is waiting already
+}
 
-                currententry->right = currententry->counter = 1;
-                if (currentlist==&old)
-                {
-                    removefromlist(currententry,currentlist,0);
-                    popupinfo(2,"","It will be brought up a couple more times to help you remember it.");
-                    addtolist(currententry,&known);
-                }
-            }
-            else
-            {
-                popupinfo(4,"Yay!","You're right!");
+void addtimer(int milliseconds, void (*function)(void *), void * argument)
+{
+    struct event * timer, ** place;
+    if (!(timer = (struct event *)malloc(sizeof(struct event)))) outofmemory();
+    timer->function = function;
+    timer->argument = argument;
+    clock_gettime(CLOCK_MONOTONIC,&timer->due);
+    timer->due.tv_sec += milliseconds/1000;
+    timer->due.tv_nsec += (milliseconds%1000)*1000000L;
+    if (timer->due.tv_nsec>=1000000000L) {timer->due.tv_sec++;timer->due.tv_nsec -= 1000000000L;}
+    for (place=&timers;*place && ((*place)->due.tv_sec<timer->due.tv_sec || ((*place)->due.tv_sec==timer->due.tv_sec && (*place)->due.tv_nsec<=timer->due.tv_nsec));place=&(*place)->next);
+    timer->next = *place;
+    *place = timer;
+}
 
-                if(currententry->right) currententry->counter++;
-                else currententry->right = currententry->counter = 1;
-                if (currententry->counter>2) {sprintf(passingstring,"You answered correctly the last %i times in a row!\n",currententry->counter);popupinfo(4,"",passingstring);}
-            }
+int runevents()
+{
+    struct event * work, * next;
+    struct timespec now;
+    char buffer[64];
+    int run = 0;
+    if (runningevents) return 0;
+    runningevents = 1;
+    if (wakefds[0]>=0) while (read(wakefds[0],buffer,sizeof(buffer))>0);//emptied before the queue is taken, so work posted from now on wakes the next poll
+    pthread_mutex_lock(&postedworklock);
+    work = postedwork;
+    postedwork = lastpostedwork = NULL;
+    pthread_mutex_unlock(&postedworklock);
+    for (;work;work=next,run++)
+    {
+        next = work->next;
+        work->function(work->argument);
+        free(work);
+    }
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    while (timers && (timers->due.tv_sec<now.tv_sec || (timers->due.tv_sec==now.tv_sec && timers->due.tv_nsec<=now.tv_nsec)))
+    {
+        work = timers;
+        timers = work->next;//off the list before it runs, so it can set itself again
+        work->function(work->argument);
+        free(work);
+        run++;
+    }
+    runningevents = 0;
+    return run;
+}
 
-            //make comments based on how well it's known, and move to a higher list if appropriate
-            if (currentlist==&n2l && currententry->counter>=N2LTONORM)
-            {
-                removefromlist(currententry,currentlist,0);
-                popupinfo(4,"","Looks like you know this one a little better now!\nIt will be brought up less frequently.");
-                currententry->counter = 1;
-                addtolist(currententry,&norm);
-            }
-            if (currentlist==&norm && currententry->counter>=NORMTOKNOWN)
-            {
-                removefromlist(currententry,currentlist,0);
-                popupinfo(4,"","Looks like you know this one now!\nIt will be brought up much less frequently.");
-                currententry->counter = 1;
-                addtolist(currententry,&known);
-            }
-            if (currentlist==&known && currententry->counter>=KNOWNTOOLD)
-            {
-                removefromlist(currententry,currentlist,0);
-                popupinfo(4,"","OK! So this one's well-learnt.\nIt probably won't be brought up much any more.");
-                currententry->counter = 1;
-                addtolist(currententry,&old);
-            }
-        }
-    
-        else //if you're wrong
-        {
-            sprintf(passingstring,"The correct answer is:\n\n%s\n",currententry->answer);
-            popupinfo(3,"Sorry!",passingstring);
-        
-            if(!currententry->right) currententry->counter++;
-            else {currententry->right = 0; currententry->counter = 1;}
-            if (currententry->counter>1) {sprintf(passingstring,"You've got this one wrong the last %i times.",currententry->counter);popupinfo(3,"",passingstring);}
-            if (currentlist==&norm && currententry->counter>=NORMTON2L)
-            {
-                removefromlist(currententry,currentlist,0);
-                popupinfo(3,"","This one could do with some learning...");
-                currententry->counter = 1;
-                addtolist(currententry,&n2l);
-            }
-            if (currentlist==&known && currententry->counter>=KNOWNTONORM)
-            {
-                removefromlist(currententry,currentlist,0);
-                popupinfo(3,"","OK, perhaps you don't know this one as well as you once did...");
-                currententry->counter = 1;
-                addtolist(currententry,&norm);
-            }
-            if (currentlist==&old && currententry->counter>=OLDTONORM)
-            {
-                removefromlist(currententry,currentlist,0);
-                popupinfo(3,"","This old one caught you out, huh? It will be brought up a few more times to help you remember it.");
-                currententry->counter = 1;
-                addtolist(currententry,&norm);
-            }
-        }
+int waitforkey(WINDOW * window, int flags)
+{
+    struct pollfd fds[3];
+    struct timespec now;
+    int key, n, timeout, watching;
 
-        getmaxyx(wtestme,nlines,ncols);
-        mvwprintw(wtestme,0,ncols-14,"Score: %.1f%%",calculatescore(0));
-        mvwprintw(wtestme,nlines-1,0,"Press 'o' for options or any other key for another question...");
-        testmenuchoice = wgetch(wtestme);
-        if (tolower(testmenuchoice)=='o') bringupmenu = 1;
-        while (bringupmenu)
+    wtimeout(window,0);//keys are only read once poll() says there are some, or curses already has some read ahead
+    for (;;)
+    {
+        eventsidle = (flags&EVENTIDLE) && !startdeckpending;
+        if (runevents() && (flags&EVENTWAKE)) {key = ERR;break;}
+        if ((key = wgetch(window))==KEY_RESIZE) {resizescreen();continue;}
+        if (key!=ERR) break;
+        n = 0;
+        fds[n].fd = STDIN_FILENO;
+        fds[n++].events = POLLIN;
+        if (!runningevents && wakefds[0]>=0) {fds[n].fd = wakefds[0];fds[n++].events = POLLIN;}
+        if ((watching = eventsidle && watchfd>=0)) {fds[n].fd = watchfd;fds[n++].events = POLLIN;}//otherwise changes wait in the kernel until the screen is idle
+        timeout = -1;
+        if (timers && !runningevents)
         {
-            menuresult = editormenu(currententry,1);
-            switch (menuresult)
-            {
-                case -1: bringupmenu=testagain=0;break;
-                case  0: bringupmenu=0;break;
-                default: continue;
-            }
+            clock_gettime(CLOCK_MONOTONIC,&now);
+            timeout = (timers->due.tv_sec-now.tv_sec)*1000+(timers->due.tv_nsec-now.tv_nsec)/1000000+1;//rounded up, so it doesn't wake just short of the time
+            if (timeout<0) timeout = 0;
         }
+        if (poll(fds,n,timeout)<0 && errno!=EINTR) break;//a resize interrupts it, and wgetch() reports it next time round
+        if (watching && (fds[n-1].revents&POLLIN)) checkwatcheddecks();
     }
-    del_panel(ptestme);
-    delwin(wtestme);
-    delwin(wbtestme);
-    free(youranswer);
-    return;
+    eventsidle = 0;
+    wtimeout(window,-1);
+    return key;
+}
+
+void resizescreen()
+{
+    //curses has resized stdscr by the time KEY_RESIZE is read. Windows already open keep their size, cut off if the terminal has shrunk, and screens opened from now on fit the new size
+    drawbackground();
+    clearok(curscr,TRUE);
+    update_panels();
+    doupdate();
+}
+
+void drawbackground()
+{
+    werase(stdscr);
+    windowtitle(stdscr,PROGRAMTITLE);
+    if (startdeckpending) mvwprintw(stdscr,LINES-1,4,"Loading %.*s...",COLS>20 ? textprefix(startdeckname,COLS-20) : 0,startdeckname);
+}
+
+void checkprogressregularly(void * unused)
+{
+    if (eventsidle) checksharedprogress();
+    addtimer(SHAREDPROGRESSINTERVAL,checkprogressregularly,NULL);
 }
 
 char * wgettextfromkeyboard(WINDOW * window, char * target,int maxchars)
 {
-    int i =0;
-    int memoryallocated_flag =0; //to avoid freeing memory allocated outside function, pointed out by stackoverflow.com/users/688213/mrab
-    char ch;
+    int length = 0, start = 0, key, width, y, x, maxx, needed = 0;
+    unsigned char * character;
     if (!target)//if no memory already allocated (pointer is NULL), do it now
     {
-        memoryallocated_flag=1;
         target=(char *)malloc(maxchars+1);
         if (!target) {popuperror("Memory allocation failed!");return NULL;}//return null if failed
     }
-    echo();
-    wgetnstr(window,target,maxchars);
-    noecho();
+    //read a key at a time through the event loop, rather than with wgetnstr(), so background work goes on while an answer is typed
+    maxx = getmaxx(window);
+    while ((key = waitforkey(window,0))!='\n' && key!='\r' && key!=KEY_ENTER)
+    {
+        if (key==KEY_BACKSPACE || key==KEY_LEFT || key==127 || key=='\b' || key==21)//^U, as in wgetnstr(), rubs out the whole line
+        {
+            length = start;//any bytes of a character still being typed go first
+            needed = 0;
+            do
+            {
+                if (!length) break;
+                for (start=length-1;start>0 && (target[start]&0xC0)==0x80;start--);//back to the first byte of the last character
+                target[length] = '\0';
+                character = (unsigned char *)target+start;
+                width = codepointwidth(decodeutf8(&character));
+                length = start;
+                while (width--)
+                {
+                    getyx(window,y,x);
+                    if (x) x--;
+                    else if (y) {y--;x = maxx-1;}
+                    mvwaddch(window,y,x,' ');
+                    wmove(window,y,x);
+                }
+            } while (key==21);
+        }
+        else if (key>=' ' && key<256)//the bytes of a UTF-8 character arrive one at a time, and it's echoed once they're all in
+        {
+            if ((key&0xC0)!=0x80)
+            {
+                length = start;//a character cut short by the next one is dropped
+                needed = key>=0xF0 ? 4 : key>=0xE0 ? 3 : key>=0xC0 ? 2 : 1;
+                if (length+needed>maxchars) needed = 0;//a character is kept whole or not at all
+            }
+            if (!needed) continue;
+            target[length++] = key;
+            if (--needed) continue;
+            waddnstr(window,target+start,length-start);
+            start = length;
+        }
+    }
+    target[start] = '\0';//a character left unfinished isn't kept
+    if (getcury(window)==getmaxy(window)-1 && is_scrollok(window)) waddch(window,'\n');//as wgetnstr() does
     return target;
 }
 
@@ -1287,95 +4871,618 @@ int getyesorno(char * question)
     int yesorno = '\n';
     while (loopflag)
     {
-        yesorno=wgetch(wgetyesorno);
+        yesorno=waitforkey(wgetyesorno,0);
         switch (tolower(yesorno))
         {
-            case 'y': returnvalue = 1;loopflag = 0;break;
-            case 'n': returnvalue = 0;loopflag = 0;break;
-            case KEY_RIGHT: menu_driver(getyesornomenu,REQ_RIGHT_ITEM); break;
-            case KEY_LEFT: menu_driver(getyesornomenu,REQ_LEFT_ITEM); break;
-            case 10:    ITEMselected = current_item(getyesornomenu);
-                        pselected = (int *)item_userptr(ITEMselected);
-                        returnvalue = *pselected;
-                        loopflag = 0;
-                        break;
+            case 'y': returnvalue = 1;loopflag = 0;break;
+            case 'n': returnvalue = 0;loopflag = 0;break;
+            case KEY_RIGHT: menu_driver(getyesornomenu,REQ_RIGHT_ITEM); break;
+            case KEY_LEFT: menu_driver(getyesornomenu,REQ_LEFT_ITEM); break;
+            case 10:    ITEMselected = current_item(getyesornomenu);
+                        pselected = (int *)item_userptr(ITEMselected);
+                        returnvalue = *pselected;
+                        loopflag = 0;
+                        break;
+        }
+    }
+    unpost_menu(getyesornomenu);
+    free_menu(getyesornomenu);
+    for (i=0;i<=numberofchoices;i++) free_item(getyesornoitems[i]);
+    free(getyesornoitems);
+    delwin(wgetyesorno);
+    del_panel(pgetyesorno);
+    delwin(wbgetyesorno);
+    update_panels();
+    doupdate();
+    return returnvalue;
+}
+
+int getchoice(char * question, char * choices[], int numberofchoices)
+{
+    WINDOW * wbgetchoice, * wgetchoice;
+    PANEL * pgetchoice;
+    MENU * getchoicemenu;
+    ITEM ** getchoiceitems;
+    int * getchoicereturnvalues;
+    int i, choicewidth, questionwidth, questionheight, returnvalue = 0, loopflag, key;
+
+    questionwidth=textwidth(question);
+    for (i=0;i<numberofchoices;i++)//make sure the longest choice fits as well as the question
+    {
+        choicewidth=textwidth(choices[i])+2;
+        if (choicewidth>questionwidth) questionwidth=choicewidth;
+    }
+    getmaxyx(stdscr,nlines,ncols);
+    if (questionwidth>ncols-16)questionwidth=ncols-16;
+    questionheight=textheight(question,questionwidth);
+    wbgetchoice = newwin(questionheight+numberofchoices+6,questionwidth+8,(nlines-(questionheight+numberofchoices+6))/2,(ncols-(questionwidth+8))/2);
+    if(!wbgetchoice)outofmemory();
+    pgetchoice = new_panel(wbgetchoice);
+    wattrset(wbgetchoice,COLOR_PAIR(2));
+    werase(wbgetchoice);
+    wbkgd(wbgetchoice,COLOR_PAIR(2));
+    box(wbgetchoice,0,0);
+    windowtitle(wbgetchoice,"Please choose:");
+    getmaxyx(wbgetchoice,nlines,ncols);
+    wgetchoice = derwin(wbgetchoice,nlines-4,ncols-8,2,4);
+    if (!wgetchoice) outofmemory();
+    keypad(wgetchoice,TRUE);
+
+    if(!(getchoiceitems = (ITEM**)calloc(numberofchoices+1,sizeof(ITEM*)))) outofmemory();
+    if(!(getchoicereturnvalues = (int*)malloc(numberofchoices*sizeof(int)))) outofmemory();
+    for(i=0;i < numberofchoices;i++)
+    {
+        getchoicereturnvalues[i] = i;
+        getchoiceitems[i] = new_item(choices[i], "");
+        set_item_userptr (getchoiceitems[i],&getchoicereturnvalues[i]);
+    }
+    getchoiceitems[numberofchoices] = (ITEM *)NULL;
+
+    getchoicemenu = new_menu(getchoiceitems);
+    set_menu_win(getchoicemenu,wgetchoice);
+    getmaxyx(wgetchoice,nlines,ncols);
+    set_menu_sub(getchoicemenu,derwin(wgetchoice,numberofchoices,ncols,nlines-numberofchoices,0));
+    set_menu_back(getchoicemenu,COLOR_PAIR(2));
+    menu_opts_off(getchoicemenu, O_SHOWDESC);
+    menu_opts_off(getchoicemenu, O_NONCYCLIC);
+    set_menu_format(getchoicemenu, numberofchoices, 1);
+
+    wprintw(wgetchoice,"%s",question);
+    post_menu(getchoicemenu);
+    update_panels();
+    doupdate();
+
+    loopflag = 1;
+    while (loopflag)
+    {
+        key=waitforkey(wgetchoice,0);
+        switch (key)
+        {
+            case KEY_UP: menu_driver(getchoicemenu,REQ_UP_ITEM); break;
+            case KEY_DOWN: menu_driver(getchoicemenu,REQ_DOWN_ITEM); break;
+            case 10:    returnvalue = *(int *)item_userptr(current_item(getchoicemenu));
+                        loopflag = 0;
+                        break;
+            default:    if (key>='1' && key<'1'+numberofchoices) {returnvalue = key-'1';loopflag = 0;}//number keys pick a choice directly
+                        break;
+        }
+    }
+    unpost_menu(getchoicemenu);
+    free_menu(getchoicemenu);
+    for (i=0;i<numberofchoices;i++) free_item(getchoiceitems[i]);
+    free(getchoiceitems);
+    free(getchoicereturnvalues);
+    delwin(wgetchoice);
+    del_panel(pgetchoice);
+    delwin(wbgetchoice);
+    update_panels();
+    doupdate();
+    return returnvalue;
+}
+
+void clrscr()
+{
+    system(CLEARCOMMAND);
+}
+
+void clearinputbuffer()
+{
+    char tempchar;
+    if (getchar()=='\n') return;
+    else while (1)
+    {
+        tempchar = getchar();
+        if (tempchar=='\n') break;
+    }
+    return;
+}
+
+void recordhistory(struct vocab * entry, int grade, int usedhint, unsigned int latency)
+{
+    addhistoryrow(&entry->deck->history,vocabhash(entry->question,entry->answer),time(NULL),latency,grade|(usedhint?HISTORYHINT:0));
+    if (entry->deck->history.rows>=HISTORYBLOCKROWS) flushhistory(entry->deck);
+}
+
+void addhistoryrow(struct historycolumns * columns, unsigned int key, unsigned int time, unsigned int latency, unsigned char outcome)
+{
+    reservehistory(columns,columns->rows+1);
+    columns->keys[columns->rows] = key;
+    columns->times[columns->rows] = time;
+    columns->latencies[columns->rows] = latency;
+    columns->outcomes[columns->rows++] = outcome;
+}
+
+void reservehistory(struct historycolumns * columns, unsigned int rows)
+{
+    if (rows > columns->capacity)
+    {
+        if (!columns->capacity) columns->capacity = HISTORYBLOCKROWS;
+        while (columns->capacity < rows) columns->capacity *= 2;
+        columns->keys = (unsigned int *)realloc(columns->keys,columns->capacity*sizeof(unsigned int));
+        columns->times = (unsigned int *)realloc(columns->times,columns->capacity*sizeof(unsigned int));
+        columns->latencies = (unsigned int *)realloc(columns->latencies,columns->capacity*sizeof(unsigned int));
+        columns->outcomes = (unsigned char *)realloc(columns->outcomes,columns->capacity);
+        if (!columns->keys || !columns->times || !columns->latencies || !columns->outcomes) outofmemory();
+    }
+}
+
+void flushhistory(struct deck * deck)
+{
+    char filename[MAXTEXTLENGTH+1];
+    FILE * file;
+    if (!deck->history.rows) return;
+    historyfilename(deck,filename);
+    if (!(file = fopen(filename,"ab")) || !writehistoryblock(file,&deck->history))
+    {
+        sprintf(passingstring,"Unable to add to the review history file '%s'.",filename);
+        popuperror(passingstring);
+    }
+    if (file) fclose(file);
+    deck->history.rows = 0;//either way, so the same answers can't be written twice
+}
+
+int writehistoryblock(FILE * file, struct historycolumns * columns)
+{
+    struct historyheader header;
+    memcpy(header.magic,"VTH1",4);
+    header.rows = columns->rows;
+    return fwrite(&header,sizeof(header),1,file)==1
+        && fwrite(columns->keys,sizeof(unsigned int),columns->rows,file)==columns->rows
+        && fwrite(columns->times,sizeof(unsigned int),columns->rows,file)==columns->rows
+        && fwrite(columns->latencies,sizeof(unsigned int),columns->rows,file)==columns->rows
+        && fwrite(columns->outcomes,1,columns->rows,file)==columns->rows;
+}
+
+int readhistory(char * filename, struct historycolumns * columns)
+{
+    struct historyheader header;
+    struct stat filestats;
+    FILE * file;
+    char * compactname;
+    unsigned int first = columns->rows;
+    int blocks = 0, written;
+    if (!(file = fopen(filename,"rb"))) return 0;//no history yet
+    if (!fstat(fileno(file),&filestats)) reservehistory(columns,columns->rows+filestats.st_size/(3*sizeof(unsigned int)+1));//room for every row at once, rather than growing block by block
+    while (fread(&header,sizeof(header),1,file)==1)
+    {
+        if (memcmp(header.magic,"VTH1",4)) {fprintf(stderr,"Review history file %s is damaged, only the first %i blocks were read.\n",filename,blocks);break;}
+        reservehistory(columns,columns->rows+header.rows);
+        //each column is read straight into place after the rows already there
+        if (fread(columns->keys+columns->rows,sizeof(unsigned int),header.rows,file)!=header.rows
+            || fread(columns->times+columns->rows,sizeof(unsigned int),header.rows,file)!=header.rows
+            || fread(columns->latencies+columns->rows,sizeof(unsigned int),header.rows,file)!=header.rows
+            || fread(columns->outcomes+columns->rows,1,header.rows,file)!=header.rows) {fprintf(stderr,"Review history file %s ends part way through a block.\n",filename);break;}
+        columns->rows += header.rows;
+        blocks++;
+    }
+    fclose(file);
+    if (blocks > HISTORYCOMPACTBLOCKS)//lots of small blocks from short sessions, so write them out again as one
+    {
+        struct historycolumns read = {columns->rows-first,0,columns->keys+first,columns->times+first,columns->latencies+first,columns->outcomes+first};
+        if (!(compactname = (char *)malloc(strlen(filename)+2))) outofmemory();
+        sprintf(compactname,"%s~",filename);
+        if ((file = fopen(compactname,"wb")))
+        {
+            written = writehistoryblock(file,&read);
+            if (fclose(file)) written = 0;//closed either way, so it's never closed twice
+            if (!written || rename(compactname,filename)) remove(compactname);
+        }
+        free(compactname);
+    }
+    return blocks;
+}
+
+void freehistory(struct historycolumns * columns)
+{
+    free(columns->keys);
+    free(columns->times);
+    free(columns->latencies);
+    free(columns->outcomes);
+    columns->keys = columns->times = columns->latencies = NULL;
+    columns->outcomes = NULL;
+    columns->rows = columns->capacity = 0;
+}
+
+void historyfilename(struct deck * deck, char * filename)
+{
+    strcpy(filename,deck->filename);
+    validfilename(filename,".vth");
+}
+
+void readlatencies(struct deck * deck)
+{
+    struct historycolumns all = {0,0,NULL,NULL,NULL,NULL};
+    struct historytotals * table = NULL, * totals;
+    char filename[MAXTEXTLENGTH+1];
+    unsigned int size = 0, used = 0, key, i, j;
+    struct vocab * entry;
+    if (deck->latencyversion==deck->textversion+1) return;//the averages kept up as answers are given are still right
+    deck->latencyversion = deck->textversion+1;
+    historyfilename(deck,filename);
+    readhistory(filename,&all);
+    for (i=0;i<deck->history.rows;i++) addhistoryrow(&all,deck->history.keys[i],deck->history.times[i],deck->history.latencies[i],deck->history.outcomes[i]);
+    for (i=0;i<all.rows;i++)//rows are in the order answered, so the averages come out as they were when each answer was given
+    {
+        if (all.outcomes[i]&HISTORYHINT) continue;
+        totals = findhistorytotals(&table,&size,&used,all.keys[i]);
+        totals->latency = averagelatency(totals->latency,all.latencies[i]);
+    }
+    for (i=0;i<numberoftiers;i++) for (entry=levellist(deck,i)->head;entry;entry=entry->next)
+    {
+        entry->latency = 0;
+        if (!size) continue;//no history at all
+        key = (key = vocabhash(entry->question,entry->answer)) ? key : 1;
+        for (j = key & (size-1);table[j].key && table[j].key!=key;j = (j+1) & (size-1));//an empty slot, with no average, if the entry has no history
+        entry->latency = table[j].latency;
+    }
+    free(table);
+    freehistory(&all);
+}
+
+unsigned short averagelatency(unsigned short average, unsigned int latency)
+{
+    if (latency>MAXLATENCY) latency = MAXLATENCY;
+    if (!latency) latency = 1;//0 is kept for an entry with no answers
+    if (!average) return latency;
+    return average+((int)latency-(int)average)/LATENCYWEIGHT;
+}
+
+struct historytotals * findhistorytotals(struct historytotals ** table, unsigned int * size, unsigned int * used, unsigned int key)
+{
+    struct historytotals * old = *table;
+    unsigned int slot, i, oldsize = *size;
+    if (!key) key = 1;//0 marks an empty slot
+    if (4*(*used+1) > 3*oldsize)//entries no longer loaded still have history, so the table may need to grow
+    {
+        *size = oldsize ? 2*oldsize : 1024;
+        if (!(*table = (struct historytotals *)calloc(*size,sizeof(struct historytotals)))) outofmemory();
+        for (i=0;i<oldsize;i++)
+        {
+            if (!old[i].key) continue;
+            for (slot = old[i].key & (*size-1);(*table)[slot].key;slot = (slot+1) & (*size-1));
+            (*table)[slot] = old[i];
+        }
+        free(old);
+    }
+    for (slot = key & (*size-1);(*table)[slot].key && (*table)[slot].key!=key;slot = (slot+1) & (*size-1));
+    if (!(*table)[slot].key) {(*table)[slot].key = key;(*used)++;}
+    return &(*table)[slot];
+}
+
+void showhistory()//shows trends from the review history of every deck being tested
+{
+    WINDOW * wbhistory, * whistory;
+    PANEL * phistory;
+    struct historycolumns all = {0,0,NULL,NULL,NULL,NULL};
+    struct historytotals * table = NULL, * totals, * hardest[10];
+    char filename[MAXTEXTLENGTH+1];
+    unsigned int size = 0, used = 0, now = time(NULL), age, interval, right, busiest = 1, numberofhardest = 0, key, i, j, d, entries = 0;
+    unsigned int daily[15] = {0}, intervalreviews[7] = {0}, intervalrights[7] = {0};
+    static const unsigned int intervallimits[6] = {600,3600,86400,3*86400,7*86400,30*86400};
+    static const char * intervalnames[7] = {"under 10 minutes","under an hour","under a day","1 to 3 days","3 days to a week","a week to a month","over a month"};
+    static const char * daynames[7] = {"today","yesterday","2 days ago","3 days ago","4 days ago","5 days ago","6 days ago"};
+    struct timespec started, finished;
+    struct vocab * entry;
+
+    clock_gettime(CLOCK_MONOTONIC,&started);
+    for (d=0;d<numberofdecks;d++)
+    {
+        if (!deckintest(decks[d])) continue;
+        historyfilename(decks[d],filename);
+        readhistory(filename,&all);
+        for (i=0;i<decks[d]->history.rows;i++) addhistoryrow(&all,decks[d]->history.keys[i],decks[d]->history.times[i],decks[d]->history.latencies[i],decks[d]->history.outcomes[i]);
+        for (i=0;i<numberoftiers;i++) entries += levellist(decks[d],i)->entries;
+    }
+    if (!all.rows) {popupinfo(2,"Review history","There's no review history yet. It builds up as you answer questions in 'Test Me!'.");freehistory(&all);return;}
+
+    //answers per day for the last fortnight, in one pass over the times column
+    for (i=0;i<all.rows;i++)
+    {
+        age = (now-all.times[i])/86400;
+        daily[age<14 ? age : 14]++;
+    }
+    for (i=0;i<7;i++) if (daily[i]>busiest) busiest = daily[i];
+
+    //each answer's interval since the entry last came up, against whether it was right. Rows are in the order answered
+    for (size=1024;size < 2*entries;size *= 2);
+    if (!(table = (struct historytotals *)calloc(size,sizeof(struct historytotals)))) outofmemory();
+    for (i=0;i<all.rows;i++)
+    {
+        key = all.keys[i] ? all.keys[i] : 1;
+        for (j = key & (size-1);table[j].key && table[j].key!=key;j = (j+1) & (size-1));//nearly always found in a probe or two...
+        totals = table[j].key ? &table[j] : findhistorytotals(&table,&size,&used,key);//...adding it is rarer, and may grow the table
+        right = all.outcomes[i]==GRADERIGHT;//right, without the hint
+        if (totals->reviews)
+        {
+            interval = all.times[i]-totals->lastseen;
+            for (j=0;j<6 && interval>=intervallimits[j];j++);
+            intervalreviews[j]++;
+            intervalrights[j] += right;
+        }
+        totals->lastseen = all.times[i];
+        totals->reviews++;
+        totals->wrongs += !right;
+    }
+
+    //the ten entries most often wrong (as a share of their answers), out of those that have come up at least three times
+    for (i=0;i<size;i++)
+    {
+        if (table[i].reviews<3 || !table[i].wrongs) continue;
+        for (j=numberofhardest<10 ? numberofhardest++ : 10;j>0 && (unsigned long long)table[i].wrongs*hardest[j-1]->reviews > (unsigned long long)hardest[j-1]->wrongs*table[i].reviews;j--)
+        {
+            if (j<10) hardest[j] = hardest[j-1];
+        }
+        if (j<10) hardest[j] = &table[i];
+    }
+    clock_gettime(CLOCK_MONOTONIC,&finished);
+
+    wbhistory = nicebigwindow();
+    phistory = new_panel(wbhistory);
+    windowtitle(wbhistory,"Your review history:");
+    whistory = innerwindow(wbhistory);
+    getmaxyx(whistory,nlines,ncols);
+    wprintw(whistory,"%u answers analysed in %.1f ms.\n\nAnswers per day:\n",all.rows,(finished.tv_sec-started.tv_sec)*1000.0+(finished.tv_nsec-started.tv_nsec)/1000000.0);
+    for (i=0;i<7;i++)
+    {
+        wprintw(whistory,"  %-12s%6u ",daynames[i],daily[i]);
+        for (j=0;ncols>22 && j<(unsigned long long)daily[i]*(ncols-22)/busiest;j++) waddch(whistory,'#');
+        waddch(whistory,'\n');
+    }
+    wprintw(whistory,"  %u in the week before, %u before that.\n\nHow often you're right, by time since the entry last came up:\n",daily[7]+daily[8]+daily[9]+daily[10]+daily[11]+daily[12]+daily[13],daily[14]);
+    for (j=0;j<7;j++) if (intervalreviews[j]) wprintw(whistory,"  %-20s %5.1f%% of %u\n",intervalnames[j],100.0*intervalrights[j]/intervalreviews[j],intervalreviews[j]);
+    wprintw(whistory,"\nHardest entries:\n");
+    if (!numberofhardest) wprintw(whistory,"  none yet - entries need to come up at least three times to be counted\n");
+    for (j=0;j<numberofhardest && getcury(whistory)<nlines-1;j++)
+    {
+        for (entry=NULL,d=0;d<numberofdecks && !entry;d++) for (i=0;i<numberoftiers && !entry;i++) for (entry=levellist(decks[d],i)->head;entry;entry=entry->next) if (((key = vocabhash(entry->question,entry->answer)) ? key : 1)==hardest[j]->key) break;
+        wprintw(whistory,"  %3u%% wrong of %-4u %.*s\n",100*hardest[j]->wrongs/hardest[j]->reviews,hardest[j]->reviews,entry ? fieldprefix(entry->question,&entry->questionwidth,ncols-22) : ncols-22,entry ? entry->question : "(no longer loaded)");
+    }
+    update_panels();
+    doupdate();
+    waitforkey(whistory,0);
+    del_panel(phistory);
+    delwin(whistory);
+    delwin(wbhistory);
+    update_panels();
+    doupdate();
+    free(table);
+    freehistory(&all);
+}
+
+void * countedmalloc(size_t size)
+{
+    void * block = (malloc)(size);
+    if (block) countallocation(0,malloc_usable_size(block));
+    return block;
+}
+
+void * countedcalloc(size_t count, size_t size)
+{
+    void * block = (calloc)(count,size);
+    if (block) countallocation(0,malloc_usable_size(block));
+    return block;
+}
+
+void * countedrealloc(void * pointer, size_t size)
+{
+    size_t oldsize = malloc_usable_size(pointer);
+    void * block = (realloc)(pointer,size);
+    if (block) countallocation(pointer ? oldsize : 0,malloc_usable_size(block));
+    else if (pointer && !size) countallocation(oldsize,0);//realloc to nothing frees the block
+    return block;
+}
+
+void countedfree(void * pointer)
+{
+    if (!pointer) return;
+    countallocation(malloc_usable_size(pointer),0);
+    (free)(pointer);
+}
+
+void countallocation(size_t oldsize, size_t newsize)
+{
+    size_t live, peak;
+    if (!oldsize) __atomic_add_fetch(&memorycounters.allocations,1,__ATOMIC_RELAXED);
+    if (!newsize) __atomic_add_fetch(&memorycounters.frees,1,__ATOMIC_RELAXED);
+    live = __atomic_add_fetch(&memorycounters.live,newsize-oldsize,__ATOMIC_RELAXED);//wraps round correctly when the block shrinks
+    peak = __atomic_load_n(&memorycounters.peak,__ATOMIC_RELAXED);
+    while (live>peak && !__atomic_compare_exchange_n(&memorycounters.peak,&peak,live,0,__ATOMIC_RELAXED,__ATOMIC_RELAXED));//peak is reloaded on failure
+}
+
+void countblock(struct footprint * footprint, void * block, size_t used)
+{
+    size_t size;
+    if (!block) return;
+    size = malloc_usable_size(block);
+    footprint->bytes += size;
+    footprint->blocks++;
+    if (size>used) footprint->slack += size-used;
+}
+
+size_t measurememory(struct footprint * footprints, size_t * unpacked)
+{
+    struct deck * deck;
+    struct vocab * entry;
+    struct textindex * index;
+    struct historycolumns * history;
+    char ** field, ** fields[4];
+    size_t mapped = 0;
+    int d, i, f;
+
+    memset(footprints,0,FOOTCATEGORIES*sizeof(struct footprint));
+    *unpacked = 0;
+    for (d=0;d<numberofdecks;d++)
+    {
+        deck = decks[d];
+        countblock(&footprints[FOOTRECORDS],deck,sizeof(struct deck));
+        for (i=0;i<numberoftiers;i++) for (entry=levellist(deck,i)->head;entry;entry=entry->next)
+        {
+            countblock(&footprints[FOOTRECORDS],entry,sizeof(struct vocab));
+            fields[0] = &entry->question;
+            fields[1] = &entry->answer;
+            fields[2] = &entry->info;
+            fields[3] = &entry->hint;
+            for (f=0;f<4;f++)
+            {
+                field = fields[f];
+                if (!*field || (deck->map && *field>=deck->map && *field<deck->map+deck->mapsize)) continue;//text of a compiled deck is in its mapping
+                countblock(&footprints[FOOTTEXT],*field,strlen(*field)+1);//a field read from a file is given a buffer of MAXTEXTLENGTH+1, whatever its length
+            }
+            if (entry->matcher) countblock(&footprints[FOOTMATCHERS],entry->matcher,malloc_usable_size(entry->matcher));
+        }
+        if (deck->capacity)//else they're part of the progress mapping
+        {
+            countblock(&footprints[FOOTPROGRESS],deck->status,deck->slots);
+            countblock(&footprints[FOOTPROGRESS],deck->streak,deck->slots);
+        }
+        countblock(&footprints[FOOTINDEXES],deck->searchindex,(deck->searchkeys+1)*sizeof(struct searchkey));
+        for (i=0;i<BROWSEORDERS;i++) countblock(&footprints[FOOTINDEXES],deck->browseorders[i],(deck->browseentries+1)*sizeof(struct vocab *));
+        countblock(&footprints[FOOTINDEXES],deck->lines,(deck->numberoflines+1)*sizeof(struct watchedline));
+        if ((index = deck->textindex))
+        {
+            countblock(&footprints[FOOTINDEXES],index,sizeof(struct textindex));
+            if (index->ready)//the indexing thread is still filling in the rest
+            {
+                countblock(&footprints[FOOTINDEXES],index->entries,index->numberofentries*sizeof(struct vocab *));
+                countblock(&footprints[FOOTINDEXES],index->extras,index->numberofentries*sizeof(long));
+                countblock(&footprints[FOOTINDEXES],index->text,index->length);
+                countblock(&footprints[FOOTINDEXES],index->segmentstarts,index->numberofsegments*sizeof(unsigned int));
+                countblock(&footprints[FOOTINDEXES],index->segmententries,index->numberofsegments*sizeof(int));
+                countblock(&footprints[FOOTINDEXES],index->suffixes,index->numberofsuffixes*sizeof(unsigned int));
+            }
         }
+        history = &deck->history;
+        countblock(&footprints[FOOTHISTORY],history->keys,history->rows*sizeof(unsigned int));
+        countblock(&footprints[FOOTHISTORY],history->times,history->rows*sizeof(unsigned int));
+        countblock(&footprints[FOOTHISTORY],history->latencies,history->rows*sizeof(unsigned int));
+        countblock(&footprints[FOOTHISTORY],history->outcomes,history->rows);
+        if (deck->map) mapped += deck->mapsize+deck->progressmapsize;
+        *unpacked += deck->unpackedsize;
     }
-    unpost_menu(getyesornomenu);
-    free_menu(getyesornomenu);
-    for (i=0;i<=numberofchoices;i++) free_item(getyesornoitems[i]);
-    free(getyesornoitems);
-    delwin(wgetyesorno);
-    del_panel(pgetyesorno);
-    delwin(wbgetyesorno);
-    update_panels();
-    doupdate();
-    return returnvalue;
+    return mapped;
 }
 
-void clrscr()
+char * memoryreport(char * target, size_t size)
 {
-    system(CLEARCOMMAND);
-}
+    struct footprint footprints[FOOTCATEGORIES];
+    struct mallinfo2 heap = mallinfo2();
+    size_t mapped, unpacked, live, total = 0, used = 0;
+    int i;
 
-void clearinputbuffer()
-{
-    char tempchar;
-    if (getchar()=='\n') return;
-    else while (1)
+    mapped = measurememory(footprints,&unpacked);
+    live = __atomic_load_n(&memorycounters.live,__ATOMIC_RELAXED);
+    //snprintf returns what it would have written, so once the report has been cut short used is past size and nothing more is written
+    if (used<size) used += snprintf(target+used,size-used,"%-24s%12s%10s%12s\n","","in use (KB)","blocks","slack (KB)");
+    for (i=0;i<FOOTCATEGORIES;i++)
     {
-        tempchar = getchar();
-        if (tempchar=='\n') break;
+        if (used<size) used += snprintf(target+used,size-used,"%-24s%12.1f%10zu%12.1f\n",footprintnames[i],footprints[i].bytes/1024.0,footprints[i].blocks,footprints[i].slack/1024.0);
+        total += footprints[i].bytes;
     }
-    return;
+    if (used<size) used += snprintf(target+used,size-used,"%-24s%12.1f\n","other tables and buffers",live>total ? (live-total)/1024.0 : 0.0);
+    if (used<size) used += snprintf(target+used,size-used,"%-24s%12.1f\n","curses windows, stdio",heap.uordblks>live ? (heap.uordblks-live)/1024.0 : 0.0);//everything malloced by the libraries rather than this file
+    if (used<size) snprintf(target+used,size-used,"\nTester's own heap: %.1f KB now, %.1f KB at peak, %llu allocations, %llu frees.\nCompiled decks mapped: %.1f KB.\nCompressed decks' text held unpacked in memory: %.1f KB.\n",live/1024.0,__atomic_load_n(&memorycounters.peak,__ATOMIC_RELAXED)/1024.0,__atomic_load_n(&memorycounters.allocations,__ATOMIC_RELAXED),__atomic_load_n(&memorycounters.frees,__ATOMIC_RELAXED),mapped/1024.0,unpacked/1024.0);
+    return target;
+}
+
+void showmemory()//shows how much memory the decks and the rest of the tester are using
+{
+    WINDOW * wbmemory, * wmemory;
+    PANEL * pmemory;
+    char report[2048];
+
+    wbmemory = nicebigwindow();
+    pmemory = new_panel(wbmemory);
+    windowtitle(wbmemory,"Memory in use:");
+    wmemory = innerwindow(wbmemory);
+    wprintw(wmemory,"%s\nSlack is memory allocated but never used, mostly the unfilled end of each text field's buffer.\n",memoryreport(report,sizeof(report)));
+    update_panels();
+    doupdate();
+    waitforkey(wmemory,0);
+    del_panel(pmemory);
+    delwin(wmemory);
+    delwin(wbmemory);
+    update_panels();
+    doupdate();
 }
 
 float calculatescore(int showstats)//returns overall idea of progress as percentage, displays screenful of stats if 'showstats' is true
 {
     WINDOW * wbscore = NULL, * wscore = NULL;
     PANEL * pscore = NULL;
-    struct vocab * entry,* bestrunentry = NULL,* worstrunentry = NULL;
-    struct listinfo * list;
-    int i,count=0,knowntotal=0,infos=0,hints=0,untested=0,rights=0,wrongs=0,bestrun=0,worstrun=0;
+    struct vocab * entry,* bestrunentry = NULL,* worstrunentry = NULL,* slowest[SLOWESTSHOWN];
+    struct deck * deck,* bestrundeck = NULL,* worstrundeck = NULL;
+    unsigned char * status,* streak;
+    int d,i,j,slots,numberofslowest=0,bestrunid = 0,worstrunid = 0,count=0,knowntotal=0,infos=0,hints=0,untested=0,rights=0,wrongs=0,bestrun=0,worstrun=0;
     float score;
-    for (i = 0;i<=3;i++)
+    for (d = 0;d<numberofdecks;d++)//score covers every deck being tested
     {
-        switch (i)
+        deck = decks[d];
+        if (!deckintest(deck)) continue;
+        status = deck->status;
+        slots = deck->slots;
+        //unused slots have a status of 0, so they add nothing. No branches, so the compiler can vectorise this
+        for (i = 0;i<slots;i++)
         {
-            case 0: list = &n2l;break;
-            case 1: list = &norm;break;
-            case 2: list = &known;break;
-            case 3: list = &old;break;
-            default: fprintf(stderr,"Loop Error!\n");break;
+            count += (status[i]&LIVEBIT) ? 1 : 0;
+            knowntotal += status[i]&KNOWNMASK;
         }
-        entry = list->head;
-        while (entry!=NULL)
+        if (showstats)
         {
-            count++;
-            knowntotal += entry->known;
-            if (showstats)
+            streak = deck->streak;
+            for (i = 0;i<slots;i++)
             {
-                if (entry->info) infos++;
-                if (entry->hint) hints++;
-                if (entry->counter==0) untested++;
-                else if (entry->right) rights++;
+                if (!(status[i]&LIVEBIT)) continue;
+                if (streak[i]==0) untested++;
+                else if (status[i]&RIGHTBIT) rights++;
                 else wrongs++;
-                if (entry->right && entry->counter > bestrun)
+                if ((status[i]&RIGHTBIT) && streak[i] > bestrun)
                 {
-                    bestrun = entry->counter;
-                    bestrunentry = entry;
+                    bestrun = streak[i];
+                    bestrundeck = deck;
+                    bestrunid = i;
                 }
-                if ((!(entry->right)) && entry->counter > worstrun)
+                if (!(status[i]&RIGHTBIT) && streak[i] > worstrun)
                 {
-                    worstrun = entry->counter;
-                    worstrunentry = entry;
+                    worstrun = streak[i];
+                    worstrundeck = deck;
+                    worstrunid = i;
                 }
             }
-            entry=entry->next;
+            readlatencies(deck);
+            for (i = 0;i<numberoftiers;i++) for (entry = levellist(deck,i)->head;entry;entry = entry->next)//text is only in the entries
+            {
+                if (entry->info || (entry->lazy&LAZYINFO)) infos++;//counted without reading them in
+                if (entry->hint || (entry->lazy&LAZYHINT)) hints++;
+                if (!entry->latency || (numberofslowest==SLOWESTSHOWN && entry->latency<=slowest[SLOWESTSHOWN-1]->latency)) continue;
+                for (j = numberofslowest<SLOWESTSHOWN ? numberofslowest++ : SLOWESTSHOWN-1;j>0 && entry->latency>slowest[j-1]->latency;j--) slowest[j] = slowest[j-1];
+                slowest[j] = entry;
+            }
         }
     }
+    if (bestrun) bestrunentry = findentrybyid(bestrundeck,bestrunid);
+    if (worstrun) worstrunentry = findentrybyid(worstrundeck,worstrunid);
     if (!count) {popuperror("No entries in list!");return 0;}
-    score = ((float)knowntotal / (3*(float)count))*100;
+    score = ((float)knowntotal / ((numberoftiers-1)*(float)count))*100;//an entry on the top tier counts in full
     if (showstats)
     {
         wbscore = nicebigwindow();
@@ -1390,11 +5497,23 @@ float calculatescore(int showstats)//returns overall idea of progress as percent
         wprintw(wscore,"%i of these you got WRONG the last time they came up.\n\n",wrongs);
         wprintw(wscore,"%i loaded entries have additional info.\n",infos);
         wprintw(wscore,"%i loaded entries have an associated hint.\n\n",hints);
-        if (bestrun) wprintw(wscore,"Your longest run of consecutive right answers is currently '%s', which you got right the last %i times.\n\n",bestrunentry->question,bestrun);
-        if (worstrun) wprintw(wscore,"Your longest run of consecutive wrong answers is currently '%s', which you got wrong the last %i times.\n\n",worstrunentry->question,worstrun);
+        if (bestrunentry) wprintw(wscore,"Your longest run of consecutive right answers is currently '%s', which you got right the last %i times.\n\n",bestrunentry->question,bestrun);
+        if (worstrunentry) wprintw(wscore,"Your longest run of consecutive wrong answers is currently '%s', which you got wrong the last %i times.\n\n",worstrunentry->question,worstrun);
+        if (numberofslowest)
+        {
+            wprintw(wscore,"The entries you take longest to answer, on average:\n");
+            for (j = 0;j<numberofslowest;j++) wprintw(wscore,"  %5.1f s  %s\n",slowest[j]->latency/1000.0,slowest[j]->question);
+            wprintw(wscore,"\n");
+        }
+        wprintw(wscore,"This session's questions come from random seed %llu.\n\n",(unsigned long long)randomseed);
+        wprintw(wscore,"Press 'h' to see trends from your review history, 'm' to see the memory in use, or any other key to return.");
         update_panels();
         doupdate();
-        wgetch(wscore);
+        switch (waitforkey(wscore,0))//not through tolower(), which is only defined for byte values and curses keys are bigger
+        {
+            case 'h': case 'H': showhistory();break;
+            case 'm': case 'M': showmemory();break;
+        }
         del_panel(pscore);
         delwin(wscore);
         delwin(wbscore);
@@ -1404,8 +5523,129 @@ float calculatescore(int showstats)//returns overall idea of progress as percent
     return score;
 }
 
+void startmetrics()
+{
+    struct sockaddr_in inet;
+    struct sockaddr_un local;
+    struct stat existing;
+    int one = 1, bound;
+    if (isdigit((unsigned char)metricsaddress[0]))//a port, served on localhost only
+    {
+        memset(&inet,0,sizeof(inet));
+        inet.sin_family = AF_INET;
+        inet.sin_port = htons(atoi(metricsaddress));
+        inet.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if ((metricsfd = socket(AF_INET,SOCK_STREAM,0))>=0) setsockopt(metricsfd,SOL_SOCKET,SO_REUSEADDR,&one,sizeof(one));
+        bound = metricsfd>=0 && !bind(metricsfd,(struct sockaddr *)&inet,sizeof(inet));
+    }
+    else
+    {
+        memset(&local,0,sizeof(local));
+        local.sun_family = AF_UNIX;
+        strncpy(local.sun_path,metricsaddress,sizeof(local.sun_path)-1);
+        if (!stat(metricsaddress,&existing) && S_ISSOCK(existing.st_mode)) unlink(metricsaddress);//left by a tester that didn't exit cleanly
+        metricsfd = socket(AF_UNIX,SOCK_STREAM,0);
+        bound = metricsfd>=0 && strlen(metricsaddress)<sizeof(local.sun_path) && !bind(metricsfd,(struct sockaddr *)&local,sizeof(local));
+    }
+    if (!bound || listen(metricsfd,8)<0 || pthread_create(&metricsthread,NULL,servemetrics,NULL))
+    {
+        snprintf(passingstring,sizeof(passingstring),"Unable to serve metrics on '%.200s': %s.",metricsaddress,strerror(errno));
+        if (metricsfd>=0) close(metricsfd);
+        metricsfd = -1;
+        popuperror(passingstring);
+        return;
+    }
+    pthread_detach(metricsthread);
+}
+
+void * servemetrics(void * unused)
+{
+    static char body[METRICSBUFFERSIZE];
+    char request[1024], header[160];
+    struct timeval timeout = {1,0};
+    int client, length, headerlength;
+    for (;;)
+    {
+        if ((client = accept(metricsfd,NULL,NULL))<0)
+        {
+            if (errno==EINTR || errno==ECONNABORTED) continue;
+            fprintf(stderr,"Metrics are no longer served: %s.\n",strerror(errno));
+            return NULL;
+        }
+        //the request is read so closing doesn't reset the connection, but whatever is asked for, the answer is the metrics
+        setsockopt(client,SOL_SOCKET,SO_RCVTIMEO,&timeout,sizeof(timeout));
+        recv(client,request,sizeof(request),0);
+        COUNTMETRIC(scrapes,1);
+        length = writemetrics(body,sizeof(body));
+        headerlength = snprintf(header,sizeof(header),"HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\nConnection: close\r\n\r\n",length);
+        if (send(client,header,headerlength,MSG_NOSIGNAL)==headerlength) send(client,body,length,MSG_NOSIGNAL);//MSG_NOSIGNAL, as a scraper hanging up mustn't end the tester
+        close(client);
+    }
+}
+
+int writemetrics(char * target, int size)
+{
+    static const char * outcomes[3] = {"wrong","right","near_miss"};//by grade
+    char names[MAXTIERS][2*MAXTIERNAME+1], * c;
+    int i, j, used = 0;
+    #define METRIC(...) if (used<size) used += snprintf(target+used,size-used,__VA_ARGS__)
+    #define READMETRIC(counter) __atomic_load_n(&metrics.counter,__ATOMIC_RELAXED)
+    for (i=0;i<numberoftiers;i++)//tier names go in label values, so quotes and backslashes are escaped
+    {
+        for (c=tiers[i].name,j=0;*c;c++)
+        {
+            if (*c=='"' || *c=='\\') names[i][j++] = '\\';
+            names[i][j++] = *c;
+        }
+        names[i][j] = '\0';
+    }
+    METRIC("# HELP vtn_questions_total Questions shown for testing.\n# TYPE vtn_questions_total counter\nvtn_questions_total %llu\n",READMETRIC(questions));
+    METRIC("# HELP vtn_answers_total Answers graded, by outcome.\n# TYPE vtn_answers_total counter\n");
+    for (i=0;i<3;i++) METRIC("vtn_answers_total{outcome=\"%s\"} %llu\n",outcomes[i],READMETRIC(answers[i]));
+    METRIC("# HELP vtn_hinted_answers_total Answers given after viewing the hint.\n# TYPE vtn_hinted_answers_total counter\nvtn_hinted_answers_total %llu\n",READMETRIC(hints));
+    METRIC("# HELP vtn_promotions_total Entries moved up, by the tier moved to.\n# TYPE vtn_promotions_total counter\n");
+    for (i=1;i<numberoftiers;i++) METRIC("vtn_promotions_total{tier=\"%s\"} %llu\n",names[i],READMETRIC(promotions[i]));
+    METRIC("# HELP vtn_demotions_total Entries moved down, by the tier moved to.\n# TYPE vtn_demotions_total counter\n");
+    for (i=0;i<numberoftiers-1;i++) METRIC("vtn_demotions_total{tier=\"%s\"} %llu\n",names[i],READMETRIC(demotions[i]));
+    METRIC("# HELP vtn_entries Entries loaded, by tier.\n# TYPE vtn_entries gauge\n");
+    for (i=0;i<numberoftiers;i++) METRIC("vtn_entries{tier=\"%s\"} %lld\n",names[i],READMETRIC(tierentries[i]));
+    METRIC("# HELP vtn_load_duration_seconds Time taken loading decks.\n# TYPE vtn_load_duration_seconds summary\nvtn_load_duration_seconds_sum %.6f\nvtn_load_duration_seconds_count %llu\n",READMETRIC(loadmicroseconds)/1e6,READMETRIC(loads));
+    METRIC("# HELP vtn_save_duration_seconds Time taken saving and compiling decks.\n# TYPE vtn_save_duration_seconds summary\nvtn_save_duration_seconds_sum %.6f\nvtn_save_duration_seconds_count %llu\n",READMETRIC(savemicroseconds)/1e6,READMETRIC(saves));
+    METRIC("# HELP vtn_heap_bytes Heap in use by the tester's own allocations.\n# TYPE vtn_heap_bytes gauge\nvtn_heap_bytes %zu\n",__atomic_load_n(&memorycounters.live,__ATOMIC_RELAXED));
+    METRIC("# HELP vtn_heap_peak_bytes Most heap the tester's own allocations have used at once.\n# TYPE vtn_heap_peak_bytes gauge\nvtn_heap_peak_bytes %zu\n",__atomic_load_n(&memorycounters.peak,__ATOMIC_RELAXED));
+    METRIC("# HELP vtn_metrics_scrapes_total Times these metrics have been served.\n# TYPE vtn_metrics_scrapes_total counter\nvtn_metrics_scrapes_total %llu\n",READMETRIC(scrapes));
+    #undef METRIC
+    #undef READMETRIC
+    return used<size ? used : size-1;
+}
+
+void countduration(unsigned long long * count, unsigned long long * microseconds, struct timespec * started)
+{
+    struct timespec finished;
+    clock_gettime(CLOCK_MONOTONIC,&finished);
+    __atomic_add_fetch(microseconds,(finished.tv_sec-started->tv_sec)*1000000LL+(finished.tv_nsec-started->tv_nsec)/1000,__ATOMIC_RELAXED);
+    __atomic_add_fetch(count,1,__ATOMIC_RELAXED);
+}
+
 void startup()//sets up curses mode, erroring if no can do
 {
+    freopen ("errorlog.txt","a",stderr);
+    setlocale(LC_CTYPE,"");//so curses draws UTF-8 decks as the characters they are. Set before the start deck's loading thread starts, as it isn't thread safe
+
+    if (!seedgiven) randomseed = ((uint64_t)time(NULL)<<20) ^ (uint64_t)getpid();
+    seedrandom(randomstate,randomseed);
+    fprintf(stderr,"Session started with random seed %llu (use --seed %llu to replay it).\n",(unsigned long long)randomseed,(unsigned long long)randomseed);
+    fflush(stderr);//so the seed is on record even if the session doesn't end cleanly
+    loadtiers(TIERSFILENAME);
+
+    newdeck(DINPUTFILENAME);
+    openeventloop();
+    if (startdeckname)//loading is mostly waiting on the disk, which can be done while curses is set up
+    {
+        startdeckpending = 1;
+        if (pthread_create(&startdeckthread,NULL,loadstartdeck,NULL)) loadstartdeck(NULL);
+        else startdeckthreaded = 1;
+    }
     initscr();
     cbreak();
     noecho();
@@ -1416,26 +5656,89 @@ void startup()//sets up curses mode, erroring if no can do
     init_pair(2,COLOR_BLACK,COLOR_WHITE);
     init_pair(3,COLOR_WHITE,COLOR_RED);
     init_pair(4,COLOR_WHITE,COLOR_GREEN);
+    marktime(TIMECURSES);
+    if (metricsaddress) startmetrics();
+}
 
-    freopen ("errorlog.txt","a",stderr);
+void * loadstartdeck(void * unused)
+{
+    marktime(TIMELOADSTART);
+    switch (startdeckformat)
+    {
+        case FORMATCOMPILED: if (wmapdeck(NULL,startdeckname)) strncpy(currentdeck->filename,startdeckname,MAXTEXTLENGTH);break;
+        case FORMATCSV: wimportcsv(NULL,startdeckname);break;
+        default: wgetrecordsfromfile(NULL,startdeckname,'~');break;
+    }
+    if (startdeckformat!=FORMATCOMPILED && strlen(startdeckname)<MAXTEXTLENGTH-4)//saved as .~sv (or compressed, if it was), as loaddatabase() does
+    {
+        strcpy(currentdeck->filename,startdeckname);
+        if (!hasextension(currentdeck->filename,PACKEDEXTENSION)) validfilename(currentdeck->filename,".~sv");
+    }
+    marktime(TIMELOADED);
+    postwork(finishstartdeck,NULL);
+    return NULL;
+}
+
+void finishstartdeck(void * unused)
+{
+    if (!startdeckpending) return;
+    if (startdeckthreaded) pthread_join(startdeckthread,NULL);
+    startdeckpending = 0;
+    drawbackground();
+    update_panels();
+    doupdate();
+    indexbuilt(NULL);//any index finished while the deck was loading was left until now
+    if (unshownerrors)
+    {
+        sprintf(passingstring,"There %s %d problem%s loading %.200s, see errorlog.txt for details.",unshownerrors==1 ? "was" : "were",unshownerrors,unshownerrors==1 ? "" : "s",startdeckname);
+        popupinfo(3,"Error!",passingstring);
+        unshownerrors = 0;
+    }
+    if (!deckentries(currentdeck)) popupinfo(2,"No entries loaded","Nothing was loaded from the deck given with --deck. Use 'l' to load another.");
+}
 
-    srand((unsigned)time(NULL));
+void marktime(int point)
+{
+    if (!timings[point].tv_sec && !timings[point].tv_nsec) clock_gettime(CLOCK_MONOTONIC,&timings[point]);
+}
 
-    n2l.entries = norm.entries = known.entries = old.entries = 0;
+void reporttimings(FILE * file)
+{
+    int i;
+    fprintf(file,"Startup timings, in ms since the tester started:\n");
+    for (i=1;i<TIMEPOINTS;i++)
+    {
+        if (!timings[i].tv_sec && !timings[i].tv_nsec) continue;//not reached this session
+        fprintf(file,"  %-22s%10.1f",timingnames[i],(timings[i].tv_sec-timings[TIMESTARTED].tv_sec)*1000.0+(timings[i].tv_nsec-timings[TIMESTARTED].tv_nsec)/1000000.0);
+        if (i==TIMELOADED && (timings[TIMELOADSTART].tv_sec || timings[TIMELOADSTART].tv_nsec)) fprintf(file,"  (%.1f ms loading, alongside setting up curses)",(timings[i].tv_sec-timings[TIMELOADSTART].tv_sec)*1000.0+(timings[i].tv_nsec-timings[TIMELOADSTART].tv_nsec)/1000000.0);
+        fputc('\n',file);
+    }
 }
 
-void shutdown()//asks about saving if appropriate and exits
+void closedown()//asks about saving if appropriate and exits
 {
-    if (changedflag)
+    char report[2048];
+    struct deck * previousdeck = currentdeck;
+    int i;
+    for (i=0;i<numberofdecks;i++)//savedatabase() saves the current deck, so each changed one is made current in turn
     {
-        if (getyesorno("Your database has changed (or you have given more answers) since you last saved.\nIf you continue without saving, these changes will be lost!\n\nSave now?"))
-            savedatabase();
+        if (!decks[i]->changed) continue;
+        if (numberofdecks==1) strcpy(passingstring,"Your database has");
+        else snprintf(passingstring,sizeof(passingstring),"The deck loaded from %.200s has",decks[i]->filename);
+        strcat(passingstring," changed (or you have given more answers) since you last saved.\nIf you continue without saving, these changes will be lost!\n\nSave now?");
+        currentdeck = decks[i];
+        if (getyesorno(passingstring)) savedatabase();
     }
+    currentdeck = previousdeck;
+    fprintf(stderr,"Memory in use at exit:\n%s",memoryreport(report,sizeof(report)));
+    if (metricsfd>=0 && !isdigit((unsigned char)metricsaddress[0])) unlink(metricsaddress);//the socket file would otherwise be left behind
+    if (showtimings) reporttimings(stderr);
     erase();
     printw("Bye for now!\n\nPress any key to exit. (Where's the 'any' key?)");
     refresh();
     getch();
     endwin();
+    if (showtimings) reporttimings(stdout);
     exit(EXIT_SUCCESS);
 }
 
@@ -1487,7 +5790,7 @@ void popupinfo(int colour,char * title,char * message)//pops up a window with th
     wprintw(wpopup,message);
     update_panels();
     doupdate();
-    wgetch(wpopup);
+    waitforkey(wpopup,0);
     
     delwin(wpopup);
     del_panel(ppopup);
@@ -1504,6 +5807,8 @@ void popuperror(char * errormessage)//pops up an error and makes a note in the l
     int errorwidth, errorheight;
 
     fprintf(stderr,"%s\n",errormessage);
+    if (!pthread_equal(pthread_self(),uithread)) {__atomic_add_fetch(&unshownerrors,1,__ATOMIC_RELAXED);return;}//curses isn't safe to use from another thread
+    if (!stdscr) return;//a command-line subcommand, with no curses to pop up in
     errorwidth=textwidth(errormessage);
     getmaxyx(stdscr,nlines,ncols);
     if (errorwidth>ncols-16)errorwidth=ncols-16;
@@ -1520,7 +5825,7 @@ void popuperror(char * errormessage)//pops up an error and makes a note in the l
     wprintw(werror,errormessage);
     update_panels();
     doupdate();
-    wgetch(werror);
+    waitforkey(werror,0);
 
     delwin(werror);
     del_panel(perror);
@@ -1542,11 +5847,11 @@ WINDOW * innerwindow(WINDOW * outerwindow)//creates an area within another windo
 void windowtitle(WINDOW * window, char * title)//writes the given string to the given window (top centre)
 {
     int textlength;
-    textlength = strlen(title);
+    textlength = textwidth(title);
     getmaxyx(window,nlines,ncols);
     if (textlength>ncols-2)
     {
-        mvwaddnstr(window,0,1,title,ncols-5);
+        mvwaddnstr(window,0,1,title,textprefix(title,ncols-5));
         waddstr(window,"...");
     }
     else
@@ -1555,18 +5860,20 @@ void windowtitle(WINDOW * window, char * title)//writes the given string to the
     }
 }
 
-int textwidth (char * text)//returns the width of a given string (which may include newlines) in chars when displayed without wrapping (for purposes of determining optimum window width)
+int textwidth (char * text)//returns the width of a given string (which may include newlines) in columns when displayed without wrapping (for purposes of determining optimum window width)
 {
-    int i=0,j=0,k=0;
-    while (text[i]!='\0')
+    unsigned char * s = (unsigned char *)text;
+    int j=0,k=0,n;
+    while (*s!='\0')
     {
-        if (text[i]=='\n')
+        if ((n = asciirun(s))) {j+=n;s+=n;}//most text is plain ASCII, which is a column a byte
+        else if (*s=='\n')
         {
             k=j>k?j:k;
             j=0;
+            s++;
         }
-        else j++;
-        i++;
+        else j+=codepointwidth(decodeutf8(&s));
     }
     k=j>k?j:k;
     return k;
@@ -1574,32 +5881,612 @@ int textwidth (char * text)//returns the width of a given string (which may incl
 
 int textheight (char * text, int width)//returns the height of a given string (which may include newlines) in lines when displayed wrapped to the given width (for purposes of determining optimum window width)
 {
-    int i=0,j=0,k=1;
-    while (text[i]!='\0')
+    unsigned char * s = (unsigned char *)text;
+    int j=0,k=1,n,w;
+    if (width<1) width=1;
+    while (*s!='\0')
     {
-        if (text[i]=='\n')
+        if ((n = asciirun(s)))
+        {
+            j+=n;
+            s+=n;
+            if (j>width)//the run may wrap several times
+            {
+                k+=(j-1)/width;
+                j=(j-1)%width+1;
+            }
+        }
+        else if (*s=='\n')
         {
             k++;
             j=0;
+            s++;
         }
-        else j++;
-        if (j>width)
+        else
         {
-            k++;
-            j=1;
+            w=codepointwidth(decodeutf8(&s));
+            j+=w;
+            if (j>width)//a wide character that doesn't fit goes to the next line whole
+            {
+                k++;
+                j=w;
+            }
         }
-        i++;
     }
     return k;
 }
 
+int textprefix(char * text, int columns)//returns how many bytes of the first line of text fit in the given number of columns
+{
+    unsigned char * s = (unsigned char *)text, * next;
+    int n, w;
+    while (*s && *s!='\n' && columns>0)
+    {
+        if ((n = asciirun(s)))
+        {
+            if (n>=columns) return s-(unsigned char *)text+columns;
+            columns-=n;
+            s+=n;
+            continue;
+        }
+        next = s;
+        w = codepointwidth(decodeutf8(&next));
+        if (w>columns) break;
+        columns-=w;
+        s = next;
+    }
+    return s-(unsigned char *)text;
+}
+
+int fieldprefix(char * text, unsigned short * width, int columns)//as textprefix, for a question or answer whose width is cached in the entry
+{
+    int measured;
+    if (!*width)
+    {
+        measured = textwidth(text);
+        *width = measured<0xfffe ? measured+1 : 0xffff;
+    }
+    if (*width-1<=columns) return strlen(text);//the whole field fits, so there's no need to measure it again
+    return textprefix(text,columns);
+}
+
+int asciirun(unsigned char * text)//returns how many bytes at the start of text are plain ASCII other than a newline, checking a word at a time
+{
+    const uint64_t ones = 0x0101010101010101ull, highbits = 0x8080808080808080ull, newlines = 0x0a0a0a0a0a0a0a0aull;
+    uint64_t word, lines;
+    int n = 0;
+    while ((uintptr_t)(text+n)&7)//a byte at a time up to a word boundary, so no word read crosses into a page the string doesn't reach
+    {
+        if (!text[n] || text[n]=='\n' || text[n]>=0x80) return n;
+        n++;
+    }
+    for (;;)
+    {
+        memcpy(&word,text+n,8);
+        lines = word^newlines;
+        if ((word | ((word-ones)&~word) | ((lines-ones)&~lines)) & highbits) break;//a byte with its top bit set, a zero byte or a newline
+        n+=8;
+    }
+    while (text[n] && text[n]!='\n' && text[n]<0x80) n++;
+    return n;
+}
+
+int decodeutf8(unsigned char ** text)//returns the character text points to and moves past it, taking a malformed byte as a character of its own
+{
+    unsigned char * s = *text;
+    int i, length, codepoint;
+    if (s[0]<0x80) length = 1, codepoint = s[0];
+    else if ((s[0]&0xe0)==0xc0) length = 2, codepoint = s[0]&0x1f;
+    else if ((s[0]&0xf0)==0xe0) length = 3, codepoint = s[0]&0x0f;
+    else if ((s[0]&0xf8)==0xf0) length = 4, codepoint = s[0]&0x07;
+    else {(*text)++;return 0xfffd;}
+    for (i=1;i<length;i++)
+    {
+        if ((s[i]&0xc0)!=0x80) {(*text)++;return 0xfffd;}//also stops at the end of the string
+        codepoint = (codepoint<<6)|(s[i]&0x3f);
+    }
+    *text += length;
+    return codepoint;
+}
+
+int codepointwidth(int codepoint)//returns the columns a character takes up on screen: 2 for East Asian wide and fullwidth, 0 for combining marks, otherwise 1
+{
+    //ranges sorted by first character, with their width. Everything in between is 1 column wide
+    static const int ranges[][3] = {
+        {0x0300,0x036f,0},{0x0483,0x0489,0},{0x0591,0x05bd,0},{0x05bf,0x05c7,0},{0x0610,0x061a,0},{0x064b,0x065f,0},{0x0670,0x0670,0},
+        {0x06d6,0x06dc,0},{0x06df,0x06e4,0},{0x0e31,0x0e31,0},{0x0e34,0x0e3a,0},{0x0e47,0x0e4e,0},{0x1100,0x115f,2},{0x1ab0,0x1aff,0},
+        {0x1dc0,0x1dff,0},{0x200b,0x200f,0},{0x20d0,0x20ff,0},{0x231a,0x231b,2},{0x2329,0x232a,2},{0x23e9,0x23ec,2},{0x23f0,0x23f0,2},
+        {0x23f3,0x23f3,2},{0x25fd,0x25fe,2},{0x2614,0x2615,2},{0x2648,0x2653,2},{0x267f,0x267f,2},{0x2693,0x2693,2},{0x26a1,0x26a1,2},
+        {0x26aa,0x26ab,2},{0x26bd,0x26be,2},{0x26c4,0x26c5,2},{0x26ce,0x26ce,2},{0x26d4,0x26d4,2},{0x26ea,0x26ea,2},{0x26f2,0x26f3,2},
+        {0x26f5,0x26f5,2},{0x26fa,0x26fa,2},{0x26fd,0x26fd,2},{0x2705,0x2705,2},{0x270a,0x270b,2},{0x2728,0x2728,2},{0x274c,0x274c,2},
+        {0x274e,0x274e,2},{0x2753,0x2755,2},{0x2757,0x2757,2},{0x2795,0x2797,2},{0x27b0,0x27b0,2},{0x27bf,0x27bf,2},{0x2b1b,0x2b1c,2},
+        {0x2b50,0x2b50,2},{0x2b55,0x2b55,2},{0x2e80,0x3029,2},{0x302a,0x302d,0},{0x302e,0x303e,2},{0x3041,0x3098,2},{0x3099,0x309a,0},
+        {0x309b,0x33ff,2},{0x3400,0x4dbf,2},{0x4e00,0x9fff,2},{0xa000,0xa4cf,2},{0xa960,0xa97f,2},{0xac00,0xd7a3,2},{0xf900,0xfaff,2},
+        {0xfe00,0xfe0f,0},{0xfe10,0xfe19,2},{0xfe20,0xfe2f,0},{0xfe30,0xfe6f,2},{0xfeff,0xfeff,0},{0xff00,0xff60,2},{0xffe0,0xffe6,2},
+        {0x16fe0,0x16fe4,2},{0x17000,0x18cff,2},{0x1b000,0x1b2ff,2},{0x1f004,0x1f004,2},{0x1f0cf,0x1f0cf,2},{0x1f18e,0x1f18e,2},
+        {0x1f191,0x1f19a,2},{0x1f200,0x1f251,2},{0x1f300,0x1f64f,2},{0x1f680,0x1f6ff,2},{0x1f900,0x1f9ff,2},{0x1fa70,0x1faff,2},
+        {0x20000,0x2fffd,2},{0x30000,0x3fffd,2},{0xe0100,0xe01ef,0}
+    };
+    int low = 0, high = ARRAY_SIZE(ranges)-1, middle;
+    if (codepoint<ranges[0][0]) return 1;//all of Latin, which is most of what's looked up
+    while (low<=high)
+    {
+        middle = (low+high)/2;
+        if (codepoint<ranges[middle][0]) high = middle-1;
+        else if (codepoint>ranges[middle][1]) low = middle+1;
+        else return ranges[middle][2];
+    }
+    return 1;
+}
+
 void showscore()
 {
     calculatescore(1);
 }
 
+int commandline(int argc, char * argv[])
+{
+    int i, first = 1, inputformat = -1, outputformat = -1;
+    char * names[2] = {NULL,NULL}, * command, * end;
+    char outputfilename[MAXTEXTLENGTH+1];
+    char * formatnames[] = {"sv","csv","tsv","jsonl"};
+    while (first<argc && !strncmp(argv[first],"--",2))//options for the tester itself come before any subcommand
+    {
+        if (!strcmp(argv[first],"--seed") && first+1<argc)
+        {
+            randomseed = strtoull(argv[first+1],&end,0);
+            if (!isdigit((unsigned char)argv[first+1][0]) || *end) {fprintf(stderr,"The seed has to be a whole number.\n");goto usage;}
+            seedgiven = 1;
+            first += 2;
+        }
+        else if (!strcmp(argv[first],"--deck") && first+1<argc)
+        {
+            startdeckname = argv[first+1];
+            first += 2;
+        }
+        else if (!strcmp(argv[first],"--format") && first+1<argc)
+        {
+            startdeckformat = !strcasecmp(argv[first+1],"vtd") ? FORMATCOMPILED : formatfromname(argv[first+1]);
+            if (startdeckformat!=FORMATSV && startdeckformat!=FORMATCSV && startdeckformat!=FORMATCOMPILED) {fprintf(stderr,"A deck to load has to be sv, csv or vtd.\n");goto usage;}
+            first += 2;
+        }
+        else if (!strcmp(argv[first],"--test")) {starttest = 1;first++;}
+        else if (!strcmp(argv[first],"--rapid")) {rapiddrill = 1;first++;}
+        else if (!strcmp(argv[first],"--metrics") && first+1<argc) {metricsaddress = argv[first+1];first += 2;}
+        else if (!strcmp(argv[first],"--timings")) {showtimings = 1;first++;}
+        else {fprintf(stderr,"Unknown option '%s'.\n",argv[first]);goto usage;}
+    }
+    if (startdeckname && startdeckformat<0)
+    {
+        startdeckformat = hasextension(startdeckname,".vtd") ? FORMATCOMPILED : formatfromname(startdeckname);
+        if (startdeckformat!=FORMATCSV && startdeckformat!=FORMATCOMPILED) startdeckformat = FORMATSV;//as loaddatabase() assumes
+    }
+    else if (startdeckformat>=0 && !startdeckname) {fprintf(stderr,"--format goes with --deck.\n");goto usage;}
+    marktime(TIMEOPTIONS);
+    if (first==argc) return -1;
+    command = argv[first];
+    if (!strcmp(command,"simulate")) return simulate(argc-first,argv+first);
+    if (strcmp(command,"import") && strcmp(command,"export") && strcmp(command,"convert"))
+    {
+        fprintf(stderr,"Unknown command '%s'.\n",command);
+        goto usage;
+    }
+    for (i=first+1;i<argc;i++)
+    {
+        if (!strcmp(argv[i],"--from") && i+1<argc) inputformat = formatfromname(argv[++i]);
+        else if (!strcmp(argv[i],"--to") && i+1<argc) outputformat = formatfromname(argv[++i]);
+        else if (argv[i][0]=='-' && argv[i][1]) {fprintf(stderr,"Unknown option '%s'.\n",argv[i]);goto usage;}
+        else if (!names[0]) names[0] = argv[i];
+        else if (!names[1]) names[1] = argv[i];
+        else goto usage;
+    }
+    if (!names[0]) goto usage;
+    if (!strcmp(command,"import"))
+    {
+        if (outputformat>=0) {fprintf(stderr,"import always writes a .~sv deck, so takes no --to.\n");goto usage;}
+        if (inputformat<0) inputformat = FORMATCSV;
+        outputformat = FORMATSV;
+    }
+    else if (!strcmp(command,"export"))
+    {
+        if (inputformat>=0) {fprintf(stderr,"export always reads a .~sv deck, so takes no --from.\n");goto usage;}
+        inputformat = FORMATSV;
+    }
+    if (!names[1])//only import can leave out the output, which is then the input with a .~sv extension
+    {
+        if (strcmp(command,"import") || !strcmp(names[0],"-") || strlen(names[0])>=MAXTEXTLENGTH-4) goto usage;
+        strcpy(outputfilename,names[0]);
+        names[1] = validfilename(outputfilename,".~sv");
+    }
+    if (inputformat<0) inputformat = formatfromname(names[0]);
+    if (outputformat<0) outputformat = formatfromname(names[1]);
+    if (inputformat<0 || outputformat<0)
+    {
+        fprintf(stderr,"Can't tell the format of '%s', use --from or --to.\n",inputformat<0?names[0]:names[1]);
+        goto usage;
+    }
+    if (inputformat==FORMATJSONL) {fprintf(stderr,"JSON Lines can be written but not read.\n");return 2;}
+    i = convertdeck(names[0],inputformat,names[1],outputformat);
+    if (!i) fprintf(stderr,"Converted %s (%s) to %s (%s).\n",names[0],formatnames[inputformat],names[1],formatnames[outputformat]);
+    return i;
+
+    usage:
+    fprintf(stderr,"Usage: %s [--seed N] [--deck FILE [--format F]] start the vocab tester, optionally replaying a session\n"
+                   "                [--test] [--rapid] [--timings]  or loading a .~sv, .csv or .vtd deck without asking\n"
+                   "                [--metrics PORT|SOCKET]         serving Prometheus metrics on a localhost port or Unix socket\n"
+                   "       %s import INPUT [OUTPUT]                 .csv (or --from format) to a .~sv deck\n"
+                   "       %s export [--to F] INPUT.~sv OUTPUT      deck to .csv, .tsv or .jsonl\n"
+                   "       %s convert [--from F] [--to F] INPUT OUTPUT\n"
+                   "       %s simulate [--learners N] [--entries N] [--reviews N] [--threads N]\n"
+                   "                [--stability X] [--growth X] [--lapse X] [--tiers FILE]\n"
+                   "Formats are sv, csv, tsv and jsonl (written only), taken from the file extension unless given.\n"
+                   "A .vtz file is an sv deck compressed, and can be read or written wherever one can (loaded, its text is held unpacked in memory).\n"
+                   "A file name of '-' reads standard input or writes standard output.\n",argv[0],argv[0],argv[0],argv[0],argv[0]);
+    return 2;
+}
+
+int formatfromname(char * name)
+{
+    char * extension = strrchr(name,'.');
+    extension = extension ? extension+1 : name;//a bare format name, as given to --from and --to
+    if (!strcmp(extension,"~sv") || !strcmp(extension,"sv") || !strcmp(extension,PACKEDEXTENSION+1)) return FORMATSV;//a .vtz deck is .~sv text, compressed
+    if (!strcasecmp(extension,"csv")) return FORMATCSV;
+    if (!strcasecmp(extension,"tsv") || !strcasecmp(extension,"tab")) return FORMATTSV;
+    if (!strcasecmp(extension,"jsonl") || !strcasecmp(extension,"ndjson")) return FORMATJSONL;
+    return -1;
+}
+
+int convertdeck(char * inputfilename, int inputformat, char * outputfilename, int outputformat)
+{
+    static char outputbuffer[4*CSVBLOCKSIZE];
+    char separators[] = {'~',',','\t'};
+    char * fields[CSVFIELDS];
+    int numberoffields, right, counter, level, failed;
+    long records = 0;
+    FILE * input, * output;
+    struct csvreader * reader;
+    struct packedfile * packed;
+    if (!strcmp(inputfilename,"-")) input = stdin;
+    else if (!(input = hasextension(inputfilename,PACKEDEXTENSION) ? openpacked(inputfilename,&packed) : fopen(inputfilename,"rb"))) {fprintf(stderr,"Unable to read input file: '%s'.\n",inputfilename);return 1;}
+    if (!strcmp(outputfilename,"-")) output = stdout;
+    else if (!(output = fopen(outputfilename,"wb")) || (hasextension(outputfilename,PACKEDEXTENSION) && !(output = createpacked(output)))) {fprintf(stderr,"Unable to write output file: '%s'.\n",outputfilename);if (input!=stdin) fclose(input);return 1;}
+    setvbuf(output,outputbuffer,_IOFBF,sizeof(outputbuffer));
+    reader = csvopenreader(input,separators[inputformat],inputformat==FORMATCSV);
+    while ((numberoffields = csvreadrecord(reader,fields,CSVFIELDS))!=CSVEND)
+    {
+        if (!csvcheckrecord(reader,fields,numberoffields)) continue;
+        if (outputformat==FORMATSV) csvclipfields(reader,fields);//the other formats have no limit, and clip on import
+        right = fields[4] && atoi(fields[4]) ? 1 : 0;
+        counter = fields[5] && atoi(fields[5])>0 ? atoi(fields[5]) : 0;
+        if (counter>MAXSTREAK) counter = MAXSTREAK;
+        level = fields[6] ? atoi(fields[6]) : newtier;
+        if (level<0) level = 0;
+        if (level>=MAXTIERS) level = MAXTIERS-1;//the tiers in use aren't known here, so the loader finishes the job
+        if (outputformat==FORMATJSONL)
+        {
+            fputs("{\"question\":",output);
+            writefield(output,fields[0],outputformat);
+            fputs(",\"answer\":",output);
+            writefield(output,fields[1],outputformat);
+            fputs(",\"info\":",output);
+            writefield(output,fields[2],outputformat);
+            fputs(",\"hint\":",output);
+            writefield(output,fields[3],outputformat);
+            fputs(",\"right\":",output);
+            writenumber(output,right);
+            fputs(",\"counter\":",output);
+            writenumber(output,counter);
+            fputs(",\"level\":",output);
+            writenumber(output,level);
+            fputs("}\n",output);
+        }
+        else
+        {
+            if (outputformat==FORMATSV && records) putc('\n',output);//.~sv files have no newline after the last record, as the loader would take it for an empty one
+            writefield(output,fields[0],outputformat);
+            putc(separators[outputformat],output);
+            writefield(output,fields[1],outputformat);
+            putc(separators[outputformat],output);
+            writefield(output,fields[2],outputformat);
+            putc(separators[outputformat],output);
+            writefield(output,fields[3],outputformat);
+            putc(separators[outputformat],output);
+            writenumber(output,right);
+            putc(separators[outputformat],output);
+            writenumber(output,counter);
+            putc(separators[outputformat],output);
+            writenumber(output,level);
+            if (outputformat!=FORMATSV) putc('\n',output);
+        }
+        records++;
+    }
+    csvsummary(reader,passingstring);
+    csvclosereader(reader);
+    failed = ferror(output);
+    if (output!=stdout) failed |= fclose(output);
+    else failed |= fflush(output);
+    if (*passingstring) fprintf(stderr,"%s\n",passingstring);
+    if (failed) {fprintf(stderr,"Error writing output file: '%s'.\n",outputfilename);return 1;}
+    fprintf(stderr,"%li records written.\n",records);
+    return 0;
+}
+
+void writefield(FILE * file, char * text, int format)
+{
+    char * c;
+    size_t run;
+    if (!text) {if (format==FORMATJSONL) fputs("null",file);return;}
+    switch (format)
+    {
+        case FORMATCSV://quoted only if it has to be, with quotes doubled
+            if (!strpbrk(text,",\"\r\n") && !isspace((unsigned char)text[0]) && !isspace((unsigned char)text[strlen(text)-1])) {fputs(text,file);break;}
+            putc('"',file);
+            for (c=text;*c;c++) {if (*c=='"') putc('"',file);putc(*c,file);}
+            putc('"',file);
+            break;
+        case FORMATJSONL:
+            putc('"',file);
+            for (c=text;*c;c++)
+            {
+                run = strcspn(c,"\"\\\x01\x02\x03\x04\x05\x06\x07\x08\t\n\x0b\x0c\r\x0e\x0f\x10\x11\x12\x13\x14\x15\x16\x17\x18\x19\x1a\x1b\x1c\x1d\x1e\x1f");
+                fwrite(c,1,run,file);//UTF-8 passes straight through
+                c += run;
+                if (!*c) break;
+                if (*c=='"' || *c=='\\') {putc('\\',file);putc(*c,file);}
+                else if (*c=='\n') fputs("\\n",file);
+                else if (*c=='\t') fputs("\\t",file);
+                else fprintf(file,"\\u%04x",*c);
+            }
+            putc('"',file);
+            break;
+        default://neither .~sv nor .tsv has a way of quoting, so a separator within a field becomes a space
+            if (!strchr(text,format==FORMATSV?'~':'\t')) {fputs(text,file);break;}
+            for (c=text;*c;c++) putc((*c==(format==FORMATSV?'~':'\t')) ? ' ' : *c,file);
+            break;
+    }
+}
+
+void seedrandom(uint64_t * state, uint64_t seed)
+{
+    int i;
+    for (i=0;i<4;i++)//splitmix64, so that similar seeds still give unrelated states
+    {
+        seed += 0x9e3779b97f4a7c15ull;
+        state[i] = seed;
+        state[i] = (state[i] ^ (state[i]>>30)) * 0xbf58476d1ce4e5b9ull;
+        state[i] = (state[i] ^ (state[i]>>27)) * 0x94d049bb133111ebull;
+        state[i] ^= state[i]>>31;
+    }
+}
+
+uint64_t nextrandom(uint64_t * state)
+{
+    uint64_t result = state[1]*5, t = state[1]<<17;
+    result = ((result<<7) | (result>>57))*9;
+    state[2] ^= state[0];
+    state[3] ^= state[1];
+    state[1] ^= state[2];
+    state[0] ^= state[3];
+    state[2] ^= t;
+    state[3] = (state[3]<<45) | (state[3]>>19);
+    return result;
+}
+
+unsigned int randombelow(uint64_t * state, unsigned int bound)
+{
+    //Lemire's method: the top 32 bits of a 32x32 bit product are in range, and the few draws that would make some values more likely than others are thrown away
+    uint64_t product = (nextrandom(state)>>32)*(uint64_t)bound;
+    uint32_t threshold;
+    if ((uint32_t)product<bound)
+    {
+        threshold = -bound%bound;
+        while ((uint32_t)product<threshold) product = (nextrandom(state)>>32)*(uint64_t)bound;
+    }
+    return product>>32;
+}
+
+int simulate(int argc, char * argv[])
+{
+    pthread_t threads[MAXSIMTHREADS];
+    int started_thread[MAXSIMTHREADS];
+    struct simjob jobs[MAXSIMTHREADS];
+    struct timespec started, finished;
+    char * tiersfilename = TIERSFILENAME, * end;
+    long long reviews = 0, rights = 0, moves = 0, tierreviews[MAXTIERS] = {0}, tierrights[MAXTIERS] = {0}, finalentries[MAXTIERS] = {0};
+    double seconds, value;
+    int i, t;
+
+    simulation.learners = SIMLEARNERS;
+    simulation.entries = SIMENTRIES;
+    simulation.reviews = SIMREVIEWS;
+    simulation.threads = sysconf(_SC_NPROCESSORS_ONLN);
+    simulation.stability = SIMSTABILITY;
+    simulation.growth = SIMGROWTH;
+    simulation.lapse = SIMLAPSE;
+    simulation.seed = seedgiven ? randomseed : 1;//the same results every time, unless asked otherwise
+    for (i=1;i<argc;i++)
+    {
+        if (i+1==argc) {fprintf(stderr,"'%s' needs a value.\n",argv[i]);return 2;}
+        if (!strcmp(argv[i],"--tiers")) {tiersfilename = argv[++i];continue;}
+        if (!strcmp(argv[i],"--seed"))//parsed as the tester's own --seed is, as a double would round any seed past 2^53
+        {
+            simulation.seed = strtoull(argv[i+1],&end,0);
+            if (!isdigit((unsigned char)argv[i+1][0]) || *end) {fprintf(stderr,"The seed has to be a whole number.\n");return 2;}
+            i++;
+            continue;
+        }
+        value = strtod(argv[i+1],&end);
+        if (*end || value<=0) {fprintf(stderr,"'%s' needs a positive number, not '%s'.\n",argv[i],argv[i+1]);return 2;}
+        if (!strcmp(argv[i],"--learners")) simulation.learners = value;
+        else if (!strcmp(argv[i],"--entries")) simulation.entries = value;
+        else if (!strcmp(argv[i],"--reviews")) simulation.reviews = value;
+        else if (!strcmp(argv[i],"--threads")) simulation.threads = value;
+        else if (!strcmp(argv[i],"--stability")) simulation.stability = value;
+        else if (!strcmp(argv[i],"--growth")) simulation.growth = value;
+        else if (!strcmp(argv[i],"--lapse")) simulation.lapse = value;
+        else {fprintf(stderr,"Unknown option '%s'.\n",argv[i]);return 2;}
+        i++;
+    }
+    if (simulation.threads<1) simulation.threads = 1;
+    if (simulation.threads>MAXSIMTHREADS) simulation.threads = MAXSIMTHREADS;
+    if (simulation.threads>simulation.learners) simulation.threads = simulation.learners;
+    loadtiers(tiersfilename);//the same tiers as the tester would use, so they can be tuned here first
+    simulation.halfway = (int *)malloc(simulation.learners*sizeof(int));
+    simulation.mastered = (int *)malloc(simulation.learners*sizeof(int));
+    if (!simulation.halfway || !simulation.mastered) {fprintf(stderr,"Out of memory.\n");return 1;}
+
+    clock_gettime(CLOCK_MONOTONIC,&started);
+    for (t=0;t<simulation.threads;t++)//each learner is seeded from its own number, so the results don't depend on how they're shared out
+    {
+        memset(&jobs[t],0,sizeof(struct simjob));
+        jobs[t].firstlearner = (long long)simulation.learners*t/simulation.threads;
+        jobs[t].lastlearner = (long long)simulation.learners*(t+1)/simulation.threads;
+        started_thread[t] = t && !pthread_create(&threads[t],NULL,simulatelearners,&jobs[t]);
+        if (t && !started_thread[t]) simulatelearners(&jobs[t]);//no thread to be had, so do it here
+    }
+    simulatelearners(&jobs[0]);
+    for (t=1;t<simulation.threads;t++) if (started_thread[t]) pthread_join(threads[t],NULL);
+    clock_gettime(CLOCK_MONOTONIC,&finished);
+    seconds = (finished.tv_sec-started.tv_sec)+(finished.tv_nsec-started.tv_nsec)/1e9;
+
+    for (t=0;t<simulation.threads;t++)
+    {
+        reviews += jobs[t].reviews;
+        rights += jobs[t].rights;
+        moves += jobs[t].moves;
+        for (i=0;i<numberoftiers;i++)
+        {
+            tierreviews[i] += jobs[t].tierreviews[i];
+            tierrights[i] += jobs[t].tierrights[i];
+            finalentries[i] += jobs[t].finalentries[i];
+        }
+    }
+    printf("%i learners each answered %i questions on a deck of %i entries.\n",simulation.learners,simulation.reviews,simulation.entries);
+    printf("%lli answers simulated in %.2fs on %i thread%s, %.1f million a second.\n\n",reviews,seconds,simulation.threads,simulation.threads>1?"s":"",reviews/seconds/1e6);
+    printf("%-20s  questions   right  entries at the end\n","Tier");
+    for (i=0;i<numberoftiers;i++)
+        printf("%-20.20s     %5.1f%%  %5.1f%%  %5.1f%%\n",tiers[i].name,100.0*tierreviews[i]/reviews,tierreviews[i]?100.0*tierrights[i]/tierreviews[i]:0,100.0*finalentries[i]/((double)simulation.learners*simulation.entries));
+    printf("\n%.1f%% of answers were right, and entries changed tier %lli times.\n",100.0*rights/reviews,moves);
+    printf("Questions until the top tier ('%s') held:\n",tiers[numberoftiers-1].name);
+    reportmastery("half the entries",simulation.halfway);
+    reportmastery("90% of the entries",simulation.mastered);
+    free(simulation.halfway);
+    free(simulation.mastered);
+    return 0;
+}
+
+void * simulatelearners(void * job)
+{
+    struct simjob * simjob = (struct simjob *)job;
+    int entries = simulation.entries, top = numberoftiers-1;
+    int learner, review, i, last, tier, newlevel, right, counter, blocked, ontop, total, grade;
+    int count[MAXTIERS], rolls[MAXTIERS*MAXTIERWEIGHT];
+    uint64_t state[4];
+    double ability;
+    int * members = (int *)malloc((size_t)numberoftiers*entries*sizeof(int));//the entries on each tier, in any order, so one can be drawn at random
+    int * slot = (int *)malloc(entries*sizeof(int));//where each entry is in its tier's members
+    int * lastseen = (int *)malloc(entries*sizeof(int));
+    float * stability = (float *)malloc(entries*sizeof(float));
+    unsigned char * rights = (unsigned char *)malloc(entries);
+    unsigned char * streak = (unsigned char *)malloc(entries);
+    if (!members || !slot || !lastseen || !stability || !rights || !streak) {fprintf(stderr,"Out of memory.\n");exit(EXIT_FAILURE);}
+
+    for (learner=simjob->firstlearner;learner<simjob->lastlearner;learner++)
+    {
+        seedrandom(state,simulation.seed*0x9e3779b97f4a7c15ull+learner);
+        ability = 0.5+(nextrandom(state)>>11)*0x1.0p-53;//some learners remember twice as well as others
+        for (i=0;i<numberoftiers;i++) count[i] = 0;
+        for (i=0;i<entries;i++)
+        {
+            rights[i] = streak[i] = 0;
+            lastseen[i] = -1;
+            stability[i] = simulation.stability*ability*(0.5+(nextrandom(state)>>11)*0x1.0p-53);//and some entries are harder than others
+            slot[i] = count[newtier];
+            members[newtier*entries+count[newtier]++] = i;
+        }
+        total = fillrolltable(rolls,count);
+        blocked = 0;
+        ontop = newtier==top ? entries : 0;
+        simulation.halfway[learner] = simulation.mastered[learner] = -1;
+        for (review=0;review<simulation.reviews;review++)
+        {
+            tier = choosetier(state,rolls,total,&blocked,count[newtier]);
+            i = members[tier*entries+randombelow(state,count[tier])];
+            //a new entry is always got wrong, after that it's remembered with a probability that falls off with the time since it was last seen
+            if (lastseen[i]>=0 && (nextrandom(state)>>11)*0x1.0p-53 < exp(-(review-lastseen[i])/stability[i])) grade = GRADERIGHT;
+            else grade = GRADEWRONG;
+            if (grade==GRADERIGHT) stability[i] *= simulation.growth;
+            else if (lastseen[i]>=0 && (stability[i] *= simulation.lapse)<1) stability[i] = 1;
+            lastseen[i] = review;
+            simjob->tierreviews[tier]++;
+            if (grade==GRADERIGHT) simjob->tierrights[tier]++;
+
+            right = rights[i];
+            counter = streak[i];
+            updatestreak(&right,&counter,grade,0);
+            newlevel = tierafteranswer(tier,counter,grade,0);
+            if (newlevel!=tier)//move it to its new tier's members, filling the gap with the last of the old tier's
+            {
+                counter = 1;
+                last = members[tier*entries+--count[tier]];
+                members[tier*entries+slot[i]] = last;
+                slot[last] = slot[i];
+                slot[i] = count[newlevel];
+                members[newlevel*entries+count[newlevel]++] = i;
+                if (!count[tier] || count[newlevel]==1) total = fillrolltable(rolls,count);
+                ontop += (newlevel==top)-(tier==top);
+                simjob->moves++;
+                if (simulation.halfway[learner]<0 && 2*ontop>=entries) simulation.halfway[learner] = review+1;
+                if (simulation.mastered[learner]<0 && 10*ontop>=9*entries) simulation.mastered[learner] = review+1;
+            }
+            rights[i] = right;
+            streak[i] = counter>MAXSTREAK ? MAXSTREAK : counter;
+        }
+        for (i=0;i<numberoftiers;i++) simjob->finalentries[i] += count[i];
+    }
+    for (i=0;i<numberoftiers;i++)
+    {
+        simjob->reviews += simjob->tierreviews[i];
+        simjob->rights += simjob->tierrights[i];
+    }
+    free(members);
+    free(slot);
+    free(lastseen);
+    free(stability);
+    free(rights);
+    free(streak);
+    return NULL;
+}
+
+int compareints(const void * a, const void * b)
+{
+    return (*(int *)a > *(int *)b) - (*(int *)a < *(int *)b);
+}
+
+void reportmastery(char * what, int * reviews)
+{
+    int i, reached = 0;
+    double sum = 0;
+    for (i=0;i<simulation.learners;i++) if (reviews[i]>=0) {reviews[reached++] = reviews[i];sum += reviews[i];}
+    if (!reached) {printf("  %s: no learner got there.\n",what);return;}
+    qsort(reviews,reached,sizeof(int),compareints);
+    printf("  %s: median %i, mean %.0f",what,reviews[reached/2],sum/reached);
+    if (reached<simulation.learners) printf(", and %i learner%s never got there",simulation.learners-reached,simulation.learners-reached>1?"s":"");
+    printf(".\n");
+}
+
+void writenumber(FILE * file, int number)
+{
+    if (number>=10) writenumber(file,number/10);
+    putc('0'+number%10,file);
+}
+
 int main(int argc, char* argv[])
 {
+    int status;
+    uithread = pthread_self();
+    marktime(TIMESTARTED);
+    if ((status = commandline(argc,argv))>=0) return status;
     startup();//star curses mode
     WINDOW * wbmainmenu, * wmainmenu;//main menu window for title and border, subwindow for text
     PANEL * pmainmenu;//attach to panel (panels library just makes life easier)
@@ -1611,6 +6498,8 @@ int main(int argc, char* argv[])
         {"t:","Test Me!"},
         {"l:","Load"},
         {"m:","Manage Database"},
+        {"d:","Decks"},
+        {"o:","Options"},
         {"s:","Save"},
         {"x:","Exit"}
     };
@@ -1622,8 +6511,10 @@ int main(int argc, char* argv[])
         testme,
         reloaddatabase,
         databasemenu,
+        deckmenu,
+        optionsmenu,
         savedatabase,
-        shutdown
+        closedown
     };
     
     ITEM * ITEMselected; //this will point to selected item
@@ -1633,13 +6524,13 @@ int main(int argc, char* argv[])
     int welcomeflag = 0;
     int menuchoice = '\0';
 
-    windowtitle(stdscr,"Vocab Tester Version N by Rob Davies");
+    drawbackground();
     wbmainmenu = nicebigwindow();
     pmainmenu = new_panel(wbmainmenu);
     windowtitle(wbmainmenu,"Main Menu");
     wmainmenu = innerwindow(wbmainmenu);
 
-    loaddatabase();
+    if (!startdeckname) loaddatabase();//a --deck deck goes on loading while the menu is up
 
     if(!(mainmenuitems = (ITEM**)calloc(numberofchoices+1,sizeof(ITEM*)))) outofmemory();
     for(i=0;i < numberofchoices;i++)
@@ -1654,18 +6545,27 @@ int main(int argc, char* argv[])
     wattroff(wmainmenu,A_BOLD);
     mainmenu = new_menu(mainmenuitems);
     set_menu_win(mainmenu,wmainmenu);
-    set_menu_sub(mainmenu,derwin(wmainmenu,6,19,5,4));
+    set_menu_sub(mainmenu,derwin(wmainmenu,numberofchoices,19,5,4));
     set_menu_back(mainmenu,COLOR_PAIR(1));
     menu_opts_off(mainmenu,O_NONCYCLIC);
     post_menu(mainmenu);
     update_panels();
     doupdate();
+    marktime(TIMEMENU);
+    if (starttest)
+    {
+        finishstartdeck(NULL);
+        testme();
+        update_panels();
+        doupdate();
+    }
     while (tolower(menuchoice)!='x')
     {
-        menuchoice=wgetch(wmainmenu);
+        menuchoice=waitforkey(wmainmenu,EVENTIDLE);
+        if (menuchoice!=KEY_UP && menuchoice!=KEY_DOWN) finishstartdeck(NULL);//everything else needs the deck, so waits for it to be loaded
         switch (tolower(menuchoice))
         {
-            case 'x': shutdown();
+            case 'x': closedown();
                       break;
             case KEY_UP: menu_driver(mainmenu,REQ_UP_ITEM);break;
             case KEY_DOWN: menu_driver(mainmenu,REQ_DOWN_ITEM);break;
@@ -1678,6 +6578,8 @@ int main(int argc, char* argv[])
             case 's': savedatabase();break;
             case 'l': reloaddatabase();break;
             case 'm': databasemenu(); break;
+            case 'd': deckmenu(); break;
+            case 'o': optionsmenu(); break;
             default: popupinfo(2,"Invalid choice","Please try again.");break;
         }
         update_panels();
@@ -1690,6 +6592,6 @@ int main(int argc, char* argv[])
     del_panel(pmainmenu);
     delwin(wmainmenu);
     delwin(wbmainmenu);
-    shutdown();
+    closedown();
     return 0;
 }
\ No newline at end of file